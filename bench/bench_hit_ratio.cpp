@@ -0,0 +1,186 @@
+// Cache hit ratio benchmark
+// Replays an access trace through the eviction policies of the cache (lru, slru and
+// tinylfu) with the same watermarks as FileCache and prints request and byte hit ratios.
+//
+// Usage: bench_hit_ratio [trace_file|-] [cache_percent]
+//
+// A trace has one request per line, "<request path> <size in bytes>"; an nginx or
+// apt-cacher-ng access log converts with e.g. awk '{print $7, $10}'. Without a trace
+// (or with "-") a synthetic one is generated: Zipf distributed package downloads with
+// periodic one-off scans, like a mirror sync or a CI job pulling the whole archive.
+// The cache budget is cache_percent (default 10) of the bytes of all distinct paths.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+#include <unordered_map>
+
+#include <console/io/eviction.hpp>
+#include <console/io/admission.hpp>
+
+struct trace_request {
+    std::string request_path;
+    std::uint64_t size;
+};
+
+// Read "<path> <size>" lines, skipping anything malformed
+static std::vector<trace_request> load_trace(const std::string& file_path) {
+    std::vector<trace_request> trace;
+    std::ifstream in(file_path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        trace_request request;
+        if (fields >> request.request_path >> request.size && request.size > 0) {
+            trace.push_back(std::move(request));
+        }
+    }
+    return trace;
+}
+
+// Zipf(0.9) over 20000 packages, every 20000 requests a scan of 4000 never seen files
+static std::vector<trace_request> synthetic_trace() {
+    constexpr std::size_t packages = 20000;
+    constexpr std::size_t requests = 400000;
+    constexpr std::size_t scan_every = 20000;
+    constexpr std::size_t scan_length = 4000;
+
+    std::mt19937_64 rng(42);
+    std::lognormal_distribution<double> size_dist(12.5, 1.2);
+    std::vector<std::uint64_t> sizes(packages);
+    std::vector<double> cdf(packages);
+    double total = 0;
+    for (std::size_t rank = 0; rank < packages; rank++) {
+        sizes[rank] = std::clamp<std::uint64_t>(static_cast<std::uint64_t>(size_dist(rng)), 1024, 256 * 1024 * 1024);
+        total += 1.0 / std::pow(rank + 1, 0.9);
+        cdf[rank] = total;
+    }
+
+    // Popularity and package name are unrelated
+    std::vector<std::size_t> names(packages);
+    for (std::size_t i = 0; i < packages; i++) {
+        names[i] = i;
+    }
+    std::shuffle(names.begin(), names.end(), rng);
+
+    std::uniform_real_distribution<double> pick(0, total);
+    std::vector<trace_request> trace;
+    std::size_t scanned = 0;
+    for (std::size_t i = 0; i < requests; i++) {
+        if (i % scan_every == 0 && i > 0) {
+            for (std::size_t j = 0; j < scan_length; j++, scanned++) {
+                trace.push_back({"/debian/pool/main/s/scan/scan" + std::to_string(scanned) + ".deb",
+                                 static_cast<std::uint64_t>(size_dist(rng))});
+            }
+        }
+        std::size_t rank = std::lower_bound(cdf.begin(), cdf.end(), pick(rng)) - cdf.begin();
+        rank = std::min(rank, packages - 1);
+        trace.push_back({"/debian/pool/main/p/pkg/pkg" + std::to_string(names[rank]) + ".deb", sizes[rank]});
+    }
+    return trace;
+}
+
+struct replay_result {
+    std::uint64_t hits = 0;
+    std::uint64_t hit_bytes = 0;
+    std::uint64_t total_bytes = 0;
+};
+
+// Replay the trace through one policy, evicting like CacheEvictor::run_once
+static replay_result replay(const std::vector<trace_request>& trace, eviction_policy policy, std::uint64_t max_bytes,
+                            std::size_t expected_items) {
+    const std::uint64_t high_bytes = static_cast<std::uint64_t>(max_bytes * 0.90);
+    const std::uint64_t low_bytes = static_cast<std::uint64_t>(max_bytes * 0.80);
+    const std::uint64_t window_bytes = static_cast<std::uint64_t>(max_bytes * CacheEvictor::window_fraction);
+
+    FrequencySketch sketch(expected_items);
+    std::unordered_map<std::string, eviction_candidate> cached;
+    std::uint64_t used = 0;
+    std::int64_t clock = 0;
+    replay_result result;
+
+    for (const auto& request : trace) {
+        clock++;
+        sketch.increment(request.request_path);
+        result.total_bytes += request.size;
+
+        auto it = cached.find(request.request_path);
+        if (it != cached.end()) {
+            result.hits++;
+            result.hit_bytes += request.size;
+            it->second.last_access = clock;
+            it->second.hit_count++;
+            continue;
+        }
+
+        // Fetched and touched once, as FileCache::ensure_entry does
+        cached[request.request_path] = {request.request_path, request.size, clock, 1};
+        used += request.size;
+        if (used <= high_bytes) {
+            continue;
+        }
+
+        std::vector<eviction_candidate> candidates;
+        candidates.reserve(cached.size());
+        for (const auto& [path, candidate] : cached) {
+            candidates.push_back(candidate);
+        }
+        auto victims = policy == eviction_policy::tinylfu
+            ? order_victims_tinylfu(std::move(candidates), sketch, window_bytes, low_bytes * 4 / 5)
+            : order_victims(std::move(candidates), policy, low_bytes * 4 / 5);
+        for (const auto& victim : victims) {
+            if (used <= low_bytes) {
+                break;
+            }
+            used -= victim.size;
+            cached.erase(victim.request_path);
+        }
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    std::string trace_file = argc > 1 ? argv[1] : "-";
+    double cache_percent = argc > 2 ? std::stod(argv[2]) : 10.0;
+
+    auto trace = trace_file == "-" ? synthetic_trace() : load_trace(trace_file);
+    if (trace.empty()) {
+        std::cerr << "No requests in trace: " << trace_file << std::endl;
+        return 1;
+    }
+
+    std::unordered_map<std::string, std::uint64_t> distinct;
+    for (const auto& request : trace) {
+        distinct[request.request_path] = request.size;
+    }
+    std::uint64_t distinct_bytes = 0;
+    for (const auto& [path, size] : distinct) {
+        distinct_bytes += size;
+    }
+    auto max_bytes = static_cast<std::uint64_t>(distinct_bytes * cache_percent / 100);
+
+    std::cout << "Trace: " << (trace_file == "-" ? "synthetic" : trace_file) << ", "
+              << trace.size() << " requests, " << distinct.size() << " distinct paths, "
+              << distinct_bytes / (1024 * 1024) << "MB" << std::endl;
+    std::cout << "Cache budget: " << max_bytes / (1024 * 1024) << "MB (" << cache_percent << "%)" << std::endl;
+
+    const std::pair<const char*, eviction_policy> policies[] = {
+        {"lru", eviction_policy::lru},
+        {"slru", eviction_policy::slru},
+        {"tinylfu", eviction_policy::tinylfu},
+    };
+    std::cout << std::fixed << std::setprecision(2);
+    for (const auto& [name, policy] : policies) {
+        auto result = replay(trace, policy, max_bytes, distinct.size());
+        std::cout << std::setw(8) << name << ": "
+                  << 100.0 * result.hits / trace.size() << "% requests, "
+                  << 100.0 * result.hit_bytes / result.total_bytes << "% bytes" << std::endl;
+    }
+    return 0;
+}
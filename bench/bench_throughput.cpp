@@ -0,0 +1,123 @@
+// Cache hit throughput benchmark
+// Serves one cached file to concurrent clients, once with buffered file_body writes
+// and once with sendfile, and prints the aggregate throughput of both.
+//
+// Usage: bench_throughput [file_mb] [clients] [requests_per_client]
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <limits>
+#include <filesystem>
+
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+
+#include <network/transmission/transmission.hpp>
+#include <network/router/router.hpp>
+#include <node/dht/dht_operation.hpp>
+#include <node/validator/validator.hpp>
+#include <console/io/io.hpp>
+
+namespace fs = std::filesystem;
+
+static const std::string bench_path = "/debian/pool/main/b/bench/bench_1.0_amd64.deb";
+
+// Download the file requests times over one keep-alive connection, return body bytes read
+static std::uint64_t run_client(unsigned short port, int requests) {
+    net::io_context io_context;
+    tcp::socket socket(io_context);
+    socket.connect({net::ip::make_address("127.0.0.1"), port});
+
+    beast::flat_buffer buffer;
+    std::vector<char> chunk(256 * 1024);
+    std::uint64_t total = 0;
+    for (int i = 0; i < requests; i++) {
+        http::request<http::empty_body> request{http::verb::get, bench_path, 11};
+        request.set(http::field::host, "127.0.0.1");
+        http::write(socket, request);
+
+        // Discard the body chunk by chunk, the client should not be the bottleneck
+        http::response_parser<http::buffer_body> parser;
+        parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+        http::read_header(socket, buffer, parser);
+        while (!parser.is_done()) {
+            parser.get().body().data = chunk.data();
+            parser.get().body().size = chunk.size();
+            beast::error_code ec;
+            http::read(socket, buffer, parser, ec);
+            if (ec && ec != http::error::need_buffer) {
+                throw beast::system_error(ec);
+            }
+            total += chunk.size() - parser.get().body().size;
+        }
+    }
+    return total;
+}
+
+// Run one round against a fresh server, return GB/s
+static double run_round(Router& router, bool zero_copy, unsigned short port, int clients, int requests) {
+    IoContextPool pool(clients);
+    auto server = ServerTrans::create(pool, router, true);
+    server->set_zero_copy(zero_copy);
+    server->start_server(net::ip::make_address("127.0.0.1"), port);
+    std::thread pool_thread([&pool]() { pool.run(); });
+
+    std::atomic<std::uint64_t> bytes{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) {
+        threads.emplace_back([&]() { bytes += run_client(port, requests); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    pool.stop();
+    pool_thread.join();
+    return bytes.load() / elapsed.count() / 1e9;
+}
+
+int main(int argc, char** argv) {
+    int file_mb = argc > 1 ? std::stoi(argv[1]) : 256;
+    int clients = argc > 2 ? std::stoi(argv[2]) : 4;
+    int requests = argc > 3 ? std::stoi(argv[3]) : 8;
+
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    fs::remove_all("./bench_cache");
+    FileCache cache(config, "./bench_cache", "127.0.0.1:1");
+    Router router(dht, validator, cache);
+
+    // Cached file, warm in the page cache after the first round
+    std::string cache_path = cache.get_cache_path(bench_path);
+    fs::create_directories(fs::path(cache_path).parent_path());
+    {
+        std::ofstream file(cache_path, std::ios::binary);
+        std::string block(1024 * 1024, 'x');
+        for (int i = 0; i < file_mb; i++) {
+            file << block;
+        }
+    }
+
+    std::cout << "File: " << file_mb << "MB, clients: " << clients
+              << ", requests per client: " << requests << std::endl;
+
+    // Warm up the page cache
+    run_round(router, true, 19290, clients, 1);
+
+    double buffered = run_round(router, false, 19291, clients, requests);
+    double zero_copy = run_round(router, true, 19292, clients, requests);
+
+    std::cout << "Buffered file_body: " << buffered << " GB/s" << std::endl;
+    std::cout << "Zero-copy sendfile: " << zero_copy << " GB/s" << std::endl;
+
+    fs::remove_all("./bench_cache");
+    return 0;
+}
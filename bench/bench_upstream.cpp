@@ -0,0 +1,227 @@
+// Upstream miss latency benchmark
+// Fetches distinct files through FileCache from a built-in mirror, one after another,
+// with fresh connections and lookups per miss, with the keep-alive pool and DNS cache,
+// and with the pool plus segmented downloads (4 ranges in parallel), and prints mean,
+// p50 and p99 miss latency of each.
+//
+// Usage: bench_upstream [misses] [body_kb] [rtt_ms] [conn_mbps]
+//
+// The mirror answers on "localhost" so every fetch goes through the resolver. rtt_ms
+// (default 0) simulates the distance to a real mirror: every response is delayed by one
+// round trip, the first one on a new connection by another for the TCP handshake.
+// conn_mbps (default 0, unlimited) caps every connection like a congested long path.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <iomanip>
+#include <algorithm>
+
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+
+#include <console/io/io.hpp>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+// Keep-alive HTTP mirror serving body_size bytes for every path
+class BenchMirror {
+public:
+    BenchMirror(std::size_t body_size, std::chrono::milliseconds rtt, double bytes_per_second)
+        : m_acceptor(m_io_context, {net::ip::make_address("127.0.0.1"), 0}),
+          m_body(body_size, 'p'),
+          m_rtt(rtt),
+          m_bytes_per_second(bytes_per_second) {
+        accept();
+        m_thread = std::thread([this]() { m_io_context.run(); });
+    }
+
+    ~BenchMirror() {
+        m_io_context.stop();
+        m_thread.join();
+    }
+
+    std::string host() const {
+        return "localhost:" + std::to_string(m_acceptor.local_endpoint().port());
+    }
+
+private:
+    struct Session {
+        explicit Session(net::io_context& io_context) : socket(io_context), timer(io_context) {}
+        tcp::socket socket;
+        net::steady_timer timer;
+        beast::flat_buffer buffer;
+        http::request<http::empty_body> request;
+        std::string header;
+        std::size_t body_begin = 0;
+        std::size_t body_end = 0;
+        bool keep_alive = true;
+        bool handshake = true;
+    };
+
+    void accept() {
+        auto session = std::make_shared<Session>(m_io_context);
+        m_acceptor.async_accept(session->socket, [this, session](const beast::error_code& ec) {
+            if (ec) return;
+            read(session);
+            accept();
+        });
+    }
+
+    void read(std::shared_ptr<Session> session) {
+        session->request = {};
+        http::async_read(session->socket, session->buffer, session->request,
+            [this, session](const beast::error_code& ec, std::size_t) {
+                if (ec) return;
+                build_response(*session);
+
+                auto delay = session->handshake ? 2 * m_rtt : m_rtt;
+                session->handshake = false;
+                session->timer.expires_after(delay);
+                session->timer.async_wait([this, session](const beast::error_code&) { write(session); });
+            });
+    }
+
+    // 200 with the whole body, or 206 for "bytes=a-b" and "bytes=a-"
+    void build_response(Session& session) {
+        session.keep_alive = session.request.keep_alive();
+        session.body_begin = 0;
+        session.body_end = m_body.size();
+        std::string status = "200 OK";
+        std::string content_range;
+        auto range = session.request[http::field::range];
+        if (range.starts_with("bytes=")) {
+            std::string spec(range.substr(6));
+            std::size_t dash = spec.find('-');
+            session.body_begin = std::min<std::size_t>(std::stoull(spec.substr(0, dash)), m_body.size());
+            if (dash + 1 < spec.size()) {
+                session.body_end = std::min<std::size_t>(std::stoull(spec.substr(dash + 1)) + 1, m_body.size());
+            }
+            status = "206 Partial Content";
+            content_range = "Content-Range: bytes " + std::to_string(session.body_begin) + "-" +
+                            std::to_string(session.body_end - 1) + "/" + std::to_string(m_body.size()) + "\r\n";
+        }
+        session.header = "HTTP/1.1 " + status + "\r\nAccept-Ranges: bytes\r\n" + content_range +
+                         "Content-Length: " + std::to_string(session.body_end - session.body_begin) + "\r\n" +
+                         (session.keep_alive ? "" : "Connection: close\r\n") + "\r\n";
+    }
+
+    void write(std::shared_ptr<Session> session) {
+        net::async_write(session->socket, net::buffer(session->header),
+            [this, session](const beast::error_code& ec, std::size_t) {
+                if (ec) return;
+                write_body(session);
+            });
+    }
+
+    // Body in 64KB pieces, paced to the connection rate
+    void write_body(std::shared_ptr<Session> session) {
+        if (session->body_begin == session->body_end) {
+            if (session->keep_alive) {
+                read(session);
+            } else {
+                beast::error_code ignored;
+                session->socket.shutdown(tcp::socket::shutdown_both, ignored);
+            }
+            return;
+        }
+        std::size_t piece = std::min<std::size_t>(64 * 1024, session->body_end - session->body_begin);
+        net::async_write(session->socket, net::buffer(m_body.data() + session->body_begin, piece),
+            [this, session, piece](const beast::error_code& ec, std::size_t) {
+                if (ec) return;
+                session->body_begin += piece;
+                if (m_bytes_per_second <= 0) {
+                    write_body(session);
+                    return;
+                }
+                session->timer.expires_after(std::chrono::microseconds(
+                    static_cast<std::int64_t>(piece / m_bytes_per_second * 1e6)));
+                session->timer.async_wait([this, session](const beast::error_code&) { write_body(session); });
+            });
+    }
+
+private:
+    net::io_context m_io_context;
+    tcp::acceptor m_acceptor;
+    std::string m_body;
+    std::chrono::milliseconds m_rtt;
+    double m_bytes_per_second;
+    std::thread m_thread;
+};
+
+// Sequential misses, returns the latency of each in microseconds
+static std::vector<double> run_misses(const std::string& host, bool pooled, std::size_t segment_size,
+                                      int misses, const std::string& label) {
+    Config config;
+    config.set("upstream_keep_alive", pooled ? "true" : "false");
+    config.set("upstream_dns_ttl", pooled ? "60" : "0");
+    config.set("persistent_index", "false");
+    config.set("segment_threshold", segment_size > 0 ? "64K" : "0");
+    config.set("segment_size", std::to_string(segment_size));
+    config.set("segment_parallelism", "4");
+    std::string cache_dir = "./bench_upstream_cache";
+    fs::remove_all(cache_dir);
+
+    std::vector<double> latencies;
+    {
+        FileCache cache(config, cache_dir, host);
+        net::io_context io_context;
+
+        // Silence the per-fetch log lines of the cache
+        std::streambuf* saved = std::cout.rdbuf(nullptr);
+        for (int i = 0; i < misses; i++) {
+            std::string path = "/debian/pool/main/" + label + "/package" + std::to_string(i) + ".deb";
+            auto start = std::chrono::steady_clock::now();
+            cache.async_ensure_cached(io_context.get_executor(), path, [](bool) {});
+            io_context.run();
+            io_context.restart();
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+        std::cout.rdbuf(saved);
+    }
+    fs::remove_all(cache_dir);
+    return latencies;
+}
+
+static void report(const std::string& name, std::vector<double> latencies) {
+    std::sort(latencies.begin(), latencies.end());
+    double mean = 0;
+    for (double latency : latencies) {
+        mean += latency;
+    }
+    mean /= latencies.size();
+    std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << mean
+              << std::setw(12) << latencies[latencies.size() / 2]
+              << std::setw(12) << latencies[latencies.size() * 99 / 100] << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int misses = argc > 1 ? std::max(1, std::atoi(argv[1])) : 2000;
+    std::size_t body_kb = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 64;
+    std::chrono::milliseconds rtt(argc > 3 ? std::atoi(argv[3]) : 0);
+    double conn_mbps = argc > 4 ? std::atof(argv[4]) : 0;
+
+    BenchMirror mirror(body_kb * 1024, rtt, conn_mbps * 1000 * 1000 / 8);
+    std::cout << misses << " sequential misses of " << body_kb << " KB, simulated RTT "
+              << rtt.count() << " ms";
+    if (conn_mbps > 0) {
+        std::cout << ", " << conn_mbps << " Mbit/s per connection";
+    }
+    std::cout << std::endl;
+    std::cout << std::left << std::setw(24) << "mode" << std::right
+              << std::setw(12) << "mean us" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::endl;
+
+    report("connect per miss", run_misses(mirror.host(), false, 0, misses, "cold"));
+    report("keep-alive pool", run_misses(mirror.host(), true, 0, misses, "warm"));
+    // Four ranges per file, at least 64KB each
+    std::size_t segment_size = std::max<std::size_t>(body_kb * 1024 / 4, 64 * 1024);
+    report("pool + 4 segments", run_misses(mirror.host(), true, segment_size, misses, "split"));
+    return 0;
+}
@@ -17,6 +17,10 @@ endfunction()
 # Configure network dependencies
 function(configure_network_dependencies target_name)
     target_link_libraries(${target_name} PRIVATE Boost::boost)
+    if(PACPRISM_IO_URING)
+        target_link_libraries(${target_name} PRIVATE ${LIBURING_LIBRARIES})
+        target_include_directories(${target_name} PRIVATE ${LIBURING_INCLUDE_DIRS})
+    endif()
     if(WIN32)
         target_link_libraries(${target_name} PRIVATE ws2_32 mswsock)
     endif()
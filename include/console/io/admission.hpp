@@ -0,0 +1,45 @@
+// Frequency sketch for TinyLFU cache admission
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Count-min sketch of how often each request path was asked for
+// Four rows of 4-bit (saturating at 15) counters; an increment only raises the
+// smallest counters of a key (conservative update). After 10x width increments every
+// counter is halved, so popularity ages out and yesterday's scan does not count forever.
+// Lock-free for increments and estimates; halving takes a mutex that is only tried.
+class FrequencySketch {
+public:
+    // Sized for roughly expected_items distinct hot paths
+    explicit FrequencySketch(std::size_t expected_items);
+
+    // Record one access
+    void increment(const std::string& key);
+
+    // Estimated access count (0-15)
+    unsigned estimate(const std::string& key) const;
+
+    // Counters per row
+    std::size_t width() const { return m_mask + 1; }
+
+private:
+    static constexpr int depth = 4;
+    static constexpr std::uint8_t max_count = 15;
+
+    // Counter slot of a key hash in a row
+    std::size_t slot(std::uint64_t hash, int row) const;
+    // Halve every counter
+    void age();
+
+private:
+    std::vector<std::atomic<std::uint8_t>> m_counters;
+    std::size_t m_mask;
+    std::size_t m_sample_size;
+    std::atomic<std::size_t> m_additions{0};
+    std::mutex m_age_mutex;
+};
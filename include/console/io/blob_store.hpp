@@ -0,0 +1,63 @@
+// Content-addressed storage of cached files for the pacPrism file cache
+#pragma once
+
+#include <atomic>
+#include <shared_mutex>
+#include <string>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Blobs of cached files keyed by SHA256, shared through hardlinks
+// Every hashed cache file gets a second name <root>/<first two hex digits>/<sha256>; a
+// later file with the same digest is replaced by another link to that blob, so bytes
+// published under several paths (by-hash copies, pool files of several suites) are stored
+// once. The link count is the reference count: a blob whose cache paths are all gone has
+// only its own name left and is removed by release() or collect(). Cached files are
+// never written in place, so sharing an inode between paths is safe.
+// Disk use is counted as blobs come and go rather than by walking the store; collect()
+// recounts it at startup.
+class BlobStore {
+public:
+    // Directory under the cache directory holding the blobs
+    static constexpr const char* dir_name = ".pacprism-blobs";
+
+    explicit BlobStore(const fs::path& root) : m_root(root) {}
+
+    // Blob path of a digest
+    fs::path blob_path(const std::string& sha256) const;
+
+    // Share a cache file with the blob of its digest, true if both are one file now
+    // A file with the same size already stored replaces file_path (renamed over it).
+    bool share(const fs::path& file_path, const std::string& sha256);
+
+    // Remove the blob of a digest if no cache path links to it anymore
+    // Called after a cache path of the digest went away.
+    void release(const std::string& sha256);
+
+    // Remove the blob of a digest even if cache paths still link to it, if file_path is one of its names
+    bool discard(const std::string& sha256, const fs::path& file_path);
+
+    // Remove every blob no cache path links to, returns how many, and recount the rest
+    std::size_t collect();
+
+    // Disk use of the store
+    struct stats {
+        std::uint64_t blobs = 0;
+        std::uint64_t stored_bytes = 0;     // Bytes on disk, once per blob
+        std::uint64_t linked_bytes = 0;     // Bytes of every cache path linked to a blob
+    };
+    stats get_stats() const;
+
+private:
+    // Lower a counter, never below zero (release() can only estimate the linked bytes)
+    static void subtract(std::atomic<std::uint64_t>& counter, std::uint64_t amount);
+
+    fs::path m_root;
+    // Held exclusively by collect(), so its count sees no share or release halfway
+    std::shared_mutex m_mutex;
+    std::atomic<std::uint64_t> m_blobs{0};
+    std::atomic<std::uint64_t> m_stored_bytes{0};
+    std::atomic<std::uint64_t> m_linked_bytes{0};
+};
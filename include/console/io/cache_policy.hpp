@@ -0,0 +1,34 @@
+// Freshness policies of the pacPrism file cache
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <optional>
+
+// Freshness class of cached paths, decided by glob rules
+// Pool files never change once published and are served as long as they are cached.
+// Repository metadata (dists/*/InRelease, Packages.xz, Arch *.db, ...) is replaced in
+// place upstream, so a cached copy older than its rule's TTL is revalidated. Rules are
+// "glob" or "glob:seconds", the first matching one wins; '*' also matches '/'.
+class CachePolicy {
+public:
+    struct rule {
+        std::string pattern;
+        std::chrono::seconds ttl;
+    };
+
+    // patterns is a whitespace or comma separated rule list, ttl applies to rules without their own
+    CachePolicy(const std::string& patterns, std::chrono::seconds ttl);
+
+    // Whether any path is revalidated at all
+    bool enabled() const;
+
+    // Age after which a cached copy of the path is revalidated, nullopt for immutable paths
+    std::optional<std::chrono::seconds> ttl(const std::string& request_path) const;
+
+    const std::vector<rule>& rules() const { return m_rules; }
+
+private:
+    std::vector<rule> m_rules;
+};
@@ -0,0 +1,109 @@
+// Size-bounded eviction of the pacPrism file cache
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+
+class FileCache;
+class FrequencySketch;
+
+// Order in which cached files are given up
+// lru: least recently used first.
+// slru: segmented LRU, files hit only once (probation) go before files hit again
+// (protected); the protected segment is capped, its oldest files fall back to probation.
+// tinylfu: W-TinyLFU, new files live in a small LRU window; a file leaving the window only
+// stays if the frequency sketch says it is asked for more often than the main segment
+// (SLRU) file it would push out. A one-off scan of the archive cannot flush hot packages.
+enum class eviction_policy {
+    lru,
+    slru,
+    tinylfu
+};
+
+// A cached file as seen by the evictor
+struct eviction_candidate {
+    std::string request_path;
+    std::uint64_t size = 0;
+    std::int64_t last_access = 0;
+    std::uint64_t hit_count = 0;
+};
+
+// Order candidates by policy, the first one is evicted first
+// protected_bytes caps the SLRU protected segment (ignored for LRU).
+// tinylfu needs a sketch and is ordered as slru here, see order_victims_tinylfu.
+std::vector<eviction_candidate> order_victims(std::vector<eviction_candidate> candidates,
+                                              eviction_policy policy,
+                                              std::uint64_t protected_bytes);
+
+// W-TinyLFU order: files hit at most once form the window, its most recent window_bytes
+// are kept; older window files duel the main segment victims (SLRU order within
+// protected_bytes) and the one with the lower sketch estimate goes first, ties against
+// the newcomer.
+std::vector<eviction_candidate> order_victims_tinylfu(std::vector<eviction_candidate> candidates,
+                                                      const FrequencySketch& sketch,
+                                                      std::uint64_t window_bytes,
+                                                      std::uint64_t protected_bytes);
+
+// Background evictor keeping the cache under its byte budget
+// Hits only bump per-file atomic access stats, so the hot path takes no lock; a pass
+// snapshots the index, orders it by policy and removes files once the cache grew
+// past the high watermark until it is back under the low watermark.
+class CacheEvictor {
+public:
+    CacheEvictor(FileCache& cache,
+                 std::uint64_t max_bytes,
+                 double high_watermark,
+                 double low_watermark,
+                 eviction_policy policy,
+                 std::chrono::seconds interval,
+                 const FrequencySketch* sketch = nullptr);
+    ~CacheEvictor();
+
+    // Start or stop the background thread
+    void start();
+    void stop();
+
+    // Wake the background thread early (the cache grew)
+    void notify();
+
+    // Run one pass now, returns the number of evicted files
+    std::size_t run_once();
+
+    // Totals since start
+    std::uint64_t get_evicted_files() const { return m_evicted_files.load(); }
+    std::uint64_t get_evicted_bytes() const { return m_evicted_bytes.load(); }
+
+    // Byte counts at which eviction starts and stops
+    std::uint64_t high_bytes() const;
+    std::uint64_t low_bytes() const;
+
+    // Share of the budget held by the W-TinyLFU window
+    static constexpr double window_fraction = 0.01;
+
+private:
+    void run();
+
+private:
+    FileCache& m_cache;
+    std::uint64_t m_max_bytes;
+    double m_high_watermark;
+    double m_low_watermark;
+    eviction_policy m_policy;
+    std::chrono::seconds m_interval;
+    const FrequencySketch* m_sketch;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stopping = false;
+    bool m_notified = false;
+
+    std::atomic<std::uint64_t> m_evicted_files{0};
+    std::atomic<std::uint64_t> m_evicted_bytes{0};
+};
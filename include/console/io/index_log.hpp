@@ -0,0 +1,73 @@
+// Persistent on-disk log of the pacPrism metadata index
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <cstdio>
+#include <cstddef>
+#include <filesystem>
+
+#include <console/io/metadata_index.hpp>
+
+// Append-only log of cache entries, replayed into the MetadataIndex on startup
+// Every fetched or dropped file appends one line; access statistics are written when
+// the log is compacted (when it grew well past the live entries, and on shutdown).
+// Compaction writes a fresh log to a temp file, fsyncs it and renames it over the old
+// one, so a crash leaves either the old or the new log. A torn last line is ignored.
+// Appends are not held up by the walk of the index, only by the final swap.
+//
+// Format: a "pacprism-index 2" header, then one record per line:
+//   + <size> <mtime> <last_access> <hit_count> <sha256 or -> <upstream ETag or -> <upstream mtime> <request path>
+//   - <request path>
+// A version 1 log (without the upstream fields) is loaded and rewritten as version 2.
+class IndexLog {
+public:
+    explicit IndexLog(const std::string& log_path);
+    ~IndexLog();
+
+    // Replay the log into the index as unverified entries
+    // Returns false if the log is missing or corrupt (the caller should rescan).
+    bool load(MetadataIndex& index);
+
+    // Append a record for a new or changed file
+    void append_put(const std::string& request_path, const cache_entry& entry);
+
+    // Append a record for a dropped file
+    void append_erase(const std::string& request_path);
+
+    // Rewrite the log with the live entries of the index
+    bool compact(const MetadataIndex& index);
+
+    // Whether the log holds enough dead records to be worth compacting
+    bool needs_compaction(std::size_t live_entries) const;
+
+    // Rebuild the index by walking the cache tree, directories are scanned by
+    // worker_count threads in parallel. Files of the log itself are skipped.
+    // Returns the number of files found.
+    static std::size_t rescan(const std::filesystem::path& cache_dir, MetadataIndex& index, std::size_t worker_count);
+
+    // File name of the log inside the cache directory
+    static constexpr const char* file_name = ".pacprism-index";
+
+private:
+    // Apply every record of the log, version is the format it was written in
+    bool replay(MetadataIndex& index, int& version);
+
+    // Open the log for appending (lock held)
+    bool open_for_append();
+    // Write one line and flush it (lock held)
+    void write_line(const std::string& line);
+
+private:
+    std::string m_path;
+    mutable std::mutex m_mutex;
+    std::FILE* m_out = nullptr;
+    std::size_t m_records = 0;
+
+    // One compaction at a time
+    std::mutex m_compact_mutex;
+    // Records appended while a compaction walks the index, replayed into its new log
+    bool m_compacting = false;
+    std::string m_pending;
+    std::size_t m_pending_records = 0;
+};
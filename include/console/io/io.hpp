@@ -1,14 +1,38 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <filesystem>
 #include <memory>
+#include <variant>
+#include <optional>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
 
 #include <boost/beast.hpp>
+#include <boost/asio.hpp>
+
+#include <console/io/upstream.hpp>
+#include <console/io/metadata_index.hpp>
+#include <console/io/index_log.hpp>
+#include <console/io/eviction.hpp>
+#include <console/io/admission.hpp>
+#include <console/io/memory_tier.hpp>
+#include <console/io/upstream_pool.hpp>
+#include <console/io/mirror_set.hpp>
+#include <console/io/negative_cache.hpp>
+#include <console/io/cache_policy.hpp>
+#include <console/io/blob_store.hpp>
+#include <console/io/scrubber.hpp>
+#include <node/package/package_index.hpp>
 
 namespace beast = boost::beast;
 namespace http = beast::http;
+namespace net = boost::asio;
 
 namespace fs = std::filesystem;
 
@@ -18,6 +42,33 @@ using file_cache_response = std::variant<
     std::shared_ptr<http::response<http::empty_body>>
 >;
 
+// Response for a cache miss that is streamed to the client while it downloads
+// The header is final; the body follows the file named by the fetch progress.
+struct streaming_response {
+    http::response<http::empty_body> header;
+    std::shared_ptr<FetchProgress> progress;
+    std::uint64_t generation = 0;    // Body generation the header was built for
+};
+
+// Cache hit whose header comes prepared with the index entry
+// Per request only the status line (HTTP/1.0, 206) and the range fields of a 206 are
+// produced; the body is [offset, offset + length) of the open cache file.
+struct file_hit_response {
+    std::shared_ptr<const cache_entry> entry;
+    beast::file file;
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+    unsigned http_version = 11;
+    bool partial = false;
+    std::string range_fields;   // Content-Range and Content-Length of a 206
+
+    // Header as buffers into the entry and this response
+    std::array<net::const_buffer, 3> header_buffers() const;
+
+    // HTTP/1.1 connections stay open, as for Beast responses without a Connection field
+    bool keep_alive() const { return http_version >= 11; }
+};
+
 // Configuration reader for pacPrism
 class Config {
 public:
@@ -49,6 +100,90 @@ public:
     int get_connect_timeout() const;
     int get_read_timeout() const;
 
+    // Get the number of server worker threads (one per CPU core by default)
+    std::size_t get_worker_threads() const;
+
+    // Get the per-fetch upstream read buffer size in bytes (bounds memory per fetch)
+    std::size_t get_fetch_buffer_size() const;
+
+    // Get whether every worker gets its own SO_REUSEPORT acceptor
+    bool get_reuse_port() const;
+
+    // Get whether the metadata index is persisted in the cache directory
+    bool get_persistent_index() const;
+
+    // Get the cache size budget in bytes, 0 means unbounded (accepts K/M/G/T suffixes)
+    std::uint64_t get_cache_max_bytes() const;
+
+    // Get the memory tier budget and largest object in bytes (K/M/G/T suffixes, 0 disables)
+    std::uint64_t get_memory_tier_bytes() const;
+    std::uint64_t get_memory_tier_max_object() const;
+
+    // Get how many earlier requests a file needs before it is held in memory
+    int get_memory_tier_min_hits() const;
+
+    // Get the fractions of the budget at which eviction starts and stops
+    double get_cache_high_watermark() const;
+    double get_cache_low_watermark() const;
+
+    // Get the eviction policy (lru, slru or tinylfu) and how often the evictor checks the cache
+    eviction_policy get_eviction_policy() const;
+    int get_eviction_interval() const;
+
+    // Get whether cached files are sent with sendfile(2)
+    bool get_zero_copy() const;
+
+    // Get the I/O engine name for cached file responses ("epoll" or "io_uring")
+    std::string get_io_engine() const;
+
+    // Get the upstream connection limit per host and how long idle connections are kept
+    std::size_t get_upstream_max_connections() const;
+    int get_upstream_idle_timeout() const;
+
+    // Get how long resolved upstream addresses are reused in seconds, 0 disables the cache
+    int get_upstream_dns_ttl() const;
+
+    // Get whether upstream connections are kept alive between fetches
+    bool get_upstream_keep_alive() const;
+
+    // Get the seconds between reachability probes of mirrors marked down
+    int get_mirror_probe_interval() const;
+
+    // Get the size above which misses are fetched as parallel byte ranges (0 disables),
+    // the size of those ranges and how many are fetched at once
+    std::uint64_t get_segment_threshold() const;
+    std::uint64_t get_segment_size() const;
+    std::size_t get_segment_parallelism() const;
+
+    // Check if completed downloads are flushed to disk before and after their rename
+    bool get_commit_fsync() const;
+
+    // Get the seconds a partial download is kept at startup to be resumed
+    int get_resume_max_age() const;
+
+    // Get the number of failed upstream paths remembered (0 disables), and the seconds
+    // a missing file (404, 410) and any other failure are remembered
+    std::size_t get_negative_cache_entries() const;
+    int get_negative_ttl() const;
+    int get_negative_error_ttl() const;
+
+    // Get the glob rules of paths upstream changes in place, and the seconds after which
+    // a cached copy of them is revalidated (rules may carry their own as "glob:seconds")
+    std::string get_metadata_paths() const;
+    int get_metadata_ttl() const;
+
+    // Check if downloaded files are hashed and identical ones stored once
+    bool get_dedup() const;
+
+    // Check if downloads are verified against the SHA256 of cached Packages indexes
+    bool get_verify_downloads() const;
+
+    // Get the seconds between scrubs of the cached files (0 disables), the threads hashing
+    // them and the byte rate all of them together read at (0 unlimited)
+    int get_scrub_interval() const;
+    std::size_t get_scrub_threads() const;
+    std::uint64_t get_scrub_rate() const;
+
 private:
     std::unordered_map<std::string, std::string> m_config;
 
@@ -61,10 +196,12 @@ private:
 
 // File cache manager for pacPrism
 // Handles caching of package files from upstream mirrors
+// Safe to share between worker threads once configured (set_cache_dir is setup only).
 class FileCache {
 public:
+    // upstream_host may list several mirrors, separated by commas
     FileCache(const Config& config, const std::string& cache_dir, const std::string& upstream_host);
-    ~FileCache() = default;
+    ~FileCache();
 
     // Get file from cache or fetch from upstream
     // Returns a file response if successful, nullptr on failure
@@ -81,9 +218,102 @@ public:
         const std::string& range_header
     );
 
-    // Check if file exists in cache
+    // Open a cached file (fetching it on a miss) as a hit with a prepared header
+    // A valid range yields a 206, anything else the whole file; nullptr on failure.
+    std::shared_ptr<file_hit_response> get_file_hit(
+        const std::string& request_path,
+        unsigned http_version,
+        const std::string& range_header = ""
+    );
+
+    // Serve a small hot file from the memory tier, nullptr if it is not (and may not be) held there
+    // A hit needs neither the file nor header formatting; a file requested memory_tier_min_hits
+    // times before is loaded on the way. Only plain HTTP/1.1 GETs qualify.
+    std::shared_ptr<const memory_object> get_memory_object(const std::string& request_path, unsigned http_version);
+
+    // Make sure a file is cached, fetching it from upstream without blocking on a miss
+    // The handler runs on the given executor with true once the file can be served
+    void async_ensure_cached(
+        net::any_io_executor executor,
+        const std::string& request_path,
+        fetch_handler handler
+    );
+
+    // Stream a file while it is fetched from upstream (or joined mid-download)
+    // The handler receives the response once the upstream body started, nullptr if the fetch failed.
+    // A path that is already cached yields a response whose progress is complete.
+    void async_fetch_streaming(
+        net::any_io_executor executor,
+        const std::string& request_path,
+        unsigned http_version,
+        std::function<void(std::shared_ptr<streaming_response>)> handler
+    );
+
+    // Check if file exists in cache (false while it is still being fetched)
     bool is_cached(const std::string& request_path) const;
 
+    // Metadata of a cached file, nullptr if it is not cached (or still being fetched)
+    // Served from the index; a file cached before start up is stat'ed once and indexed.
+    std::shared_ptr<const cache_entry> get_entry(const std::string& request_path) const;
+
+    // Drop the indexed metadata and any remembered upstream failure of a path
+    void invalidate(const std::string& request_path);
+
+    // Metadata index of the cache
+    const MetadataIndex& get_index() const { return m_index; }
+
+    // Access frequency of request paths, fed by every request (hits and misses)
+    const FrequencySketch& get_sketch() const { return m_sketch; }
+
+    // Block until the background rescan, staging file cleanup and Packages loading of the cache directory finished
+    void wait_for_index();
+
+    // Wait for the hashing and commits handed to the disk pool, at shutdown
+    // Their results go back to the io contexts of the fetches, call it before those are destroyed.
+    void wait_for_disk_work();
+
+    // Remove a cached file and its index entry
+    // Returns false if the path is not cached or is being fetched right now.
+    bool evict(const std::string& request_path);
+
+    // Total size of the cached files in bytes
+    std::uint64_t get_cached_bytes() const { return m_index.total_bytes(); }
+
+    // Small hot files held in memory
+    const MemoryTier& get_memory_tier() const { return m_memory; }
+
+    // Keep-alive connections and DNS cache used by upstream fetches
+    const UpstreamPool& get_upstream_pool() const { return m_upstream_pool; }
+
+    // Upstream mirrors with their observed latency, throughput and health
+    MirrorSet& get_mirrors() { return m_mirrors; }
+
+    // Recent upstream failures, misses of these paths fail without contacting upstream
+    NegativeCache& get_negative_cache() { return m_negative; }
+
+    // Which paths are revalidated with upstream, and after how long
+    const CachePolicy& get_policy() const { return m_policy; }
+
+    // Expected digests of the files listed by cached Packages indexes
+    const PackageIndex& get_package_index() const { return m_packages; }
+
+    // Content-addressed store deduplicating the cached files
+    BlobStore& get_blob_store() { return *m_blobs; }
+
+    // Evictor keeping the cache within cache_max_bytes, nullptr if unbounded
+    CacheEvictor* get_evictor() { return m_evictor.get(); }
+
+    // Scrubber re-hashing the cached files, nullptr if scrub_interval is 0
+    CacheScrubber* get_scrubber() { return m_scrubber.get(); }
+
+    // Take the digest a scrub computed for a cached file
+    // Recorded if the entry had none; a file that does not match its recorded (or Packages)
+    // digest is moved to quarantine and unindexed, returns true then, along with other cached
+    // paths hardlinked to it. Nothing happens if the path was refetched or changed since
+    // checked was read.
+    bool check_scrubbed(const std::string& request_path, const std::shared_ptr<const cache_entry>& checked,
+                        const std::string& sha256);
+
     // Get the local file path for a given request path
     std::string get_cache_path(const std::string& request_path) const;
 
@@ -100,19 +330,128 @@ public:
     );
 
 private:
-    // Fetch file from upstream and cache it
+    // Fetch file from upstream and cache it, blocking until the fetch completes
     bool fetch_from_upstream(const std::string& request_path);
 
+    // Entry of a cached file, fetching it synchronously on a miss (nullptr on failure)
+    std::shared_ptr<const cache_entry> ensure_entry(const std::string& request_path);
+
+    // Fetch file from upstream and cache it on the given executor
+    // Concurrent fetches of the same path attach to the first one instead of downloading again
+    void async_fetch_from_upstream(
+        net::any_io_executor executor,
+        const std::string& request_path,
+        fetch_handler handler
+    );
+
     // Ensure cache directory exists
     void ensure_cache_dir();
 
+    // Load the persistent index, or rebuild it in the background if it is missing or corrupt
+    void load_index();
+
+    // Remove staging files left by fetches that did not finish, except resumable ones younger than resume_max_age,
+    // and blobs no cached path links to
+    void clean_staging_files();
+
+    // Update the index and its persistent log together
+    void index_put(const std::string& request_path, cache_entry entry) const;
+    void index_erase(const std::string& request_path) const;
+
+    // Read a cached file into a ready-to-send memory object, nullptr if it no longer matches its entry
+    std::shared_ptr<const memory_object> load_memory_object(const std::string& request_path, const cache_entry& entry) const;
+
+    // Check an entry loaded from the persistent index against the file on disk
+    std::shared_ptr<const cache_entry> verify_entry(const std::string& request_path, const cache_entry& loaded) const;
+
     // Build upstream URL
     std::string build_upstream_url(const std::string& request_path) const;
 
 private:
     const Config& m_config;
     fs::path m_cache_dir;
-    std::string m_upstream_host;
+
+    // In-flight fetches keyed on request path (single-flight)
+    // Every request for the same path waits on or streams from the same progress.
+    mutable std::mutex m_in_flight_mutex;
+    std::unordered_map<std::string, std::shared_ptr<FetchProgress>> m_in_flight;
+    // In-flight paths that are revalidations of a cached copy, which stays servable
+    std::unordered_set<std::string> m_revalidating;
+
+    // Path to size, mtime, ETag and Last-Modified of every known cached file
+    // Filled lazily on lookups, hence mutable.
+    mutable MetadataIndex m_index;
+
+    // Popularity of paths for W-TinyLFU, remembers files that were evicted meanwhile
+    FrequencySketch m_sketch;
+
+    // Complete responses of small hot files, dropped whenever the index entry changes
+    mutable MemoryTier m_memory;
+    int m_memory_min_hits;
+
+    // Warm upstream connections, shared by the fetches of every worker
+    UpstreamPool m_upstream_pool;
+
+    // Mirrors of the upstream list, every miss goes to the best healthy one
+    MirrorSet m_mirrors;
+
+    // Paths upstream recently failed to deliver
+    NegativeCache m_negative;
+
+    // Freshness classes of cached paths
+    CachePolicy m_policy;
+
+    // Expected digests of pool files, downloads that do not match are never cached
+    PackageIndex m_packages;
+
+    // Runs revalidations of stale metadata, blob deduplication, index log compaction and
+    // the loading of Packages indexes in the background (only if any of them is enabled)
+    mutable net::io_context m_background_context;
+    std::optional<net::executor_work_guard<net::io_context::executor_type>> m_background_work;
+    std::thread m_background_thread;
+
+    // Blocking file work of fetches (hashing an assembled download, the commit), off the io threads
+    net::thread_pool m_disk_pool;
+
+    // Deduplicated copies of the cached files, follows the cache directory
+    std::unique_ptr<BlobStore> m_blobs;
+
+    // Persistent copy of the index in the cache directory (null if disabled)
+    std::unique_ptr<IndexLog> m_log;
+    mutable std::atomic<bool> m_compacting{false};
+
+    // Rebuilds the index when the log was missing or corrupt
+    std::thread m_rescan_thread;
+
+    // Runs clean_staging_files and load_package_indexes once at startup
+    std::thread m_cleanup_thread;
+
+    // Background integrity checks (stops before the rest goes away, like the evictor)
+    std::unique_ptr<CacheScrubber> m_scrubber;
+
+    // Background eviction (declared last, so it stops before the rest goes away)
+    std::unique_ptr<CacheEvictor> m_evictor;
+
+    // Join the in-flight fetch of a path, or start one on the given executor
+    std::shared_ptr<FetchProgress> start_or_join_fetch(net::any_io_executor executor, const std::string& request_path);
+
+    // Remove a finished fetch from the in-flight table and publish its result
+    // result.status is the last upstream HTTP status, remembered for a failed fetch; a failed
+    // revalidation keeps the cached copy instead.
+    void complete_in_flight(const std::string& request_path, bool success, const FetchProgress::state& result,
+                            bool revalidation = false);
+
+    // Start a background revalidation if the path is metadata older than its TTL
+    // The first hit past the TTL starts it, every hit is served the cached copy meanwhile.
+    void revalidate_if_stale(const std::string& request_path, const cache_entry& entry);
+
+    // Add the checksums of a cached Packages index, and of every one found at startup
+    void load_package_index(const std::string& request_path);
+    void load_package_indexes();
+
+    // Share a freshly cached file with an identical one through the blob store (hashed here unless the download did)
+    // Runs in the background; skipped if the file was replaced or is being fetched meanwhile.
+    void store_blob(const std::string& request_path);
 
     // Helper: Parse Range header (e.g., "bytes=0-1023")
     struct RangeInfo {
@@ -121,16 +460,10 @@ private:
         std::size_t end = 0;
         std::size_t file_size = 0;
     };
-    RangeInfo parse_range_header(const std::string& range_header, const std::string& cache_path) const;
-
-    // Helper: Get file modification time as HTTP date format
-    std::string get_last_modified(const std::string& cache_path) const;
-
-    // Helper: Generate ETag from file size and modification time
-    std::string generate_etag(const std::string& cache_path) const;
+    RangeInfo parse_range_header(const std::string& range_header, std::size_t file_size) const;
 
     // Helper: Check if file has been modified based on If-Modified-Since header
-    bool check_modified_since(const std::string& if_modified_since, const std::string& cache_path) const;
+    bool check_modified_since(const std::string& if_modified_since, std::time_t file_mod_time) const;
 
     // Helper: Parse HTTP date format
     std::time_t parse_http_date(const std::string& date_str) const;
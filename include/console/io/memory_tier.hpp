@@ -0,0 +1,54 @@
+// In-memory tier of the pacPrism file cache for small hot files
+#pragma once
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+
+// A cached file held in memory as a complete HTTP/1.1 200 response
+// Immutable once built and shared by every connection sending it; dropping it from
+// the tier only releases the tier's reference, sends in progress keep their copy.
+struct memory_object {
+    std::string etag;                                // ETag of the file it was loaded from
+    std::string wire;                                // Serialized header followed by the body
+    mutable std::atomic<std::uint64_t> last_use{0};  // Tier clock at the last hit
+};
+
+// Byte-bounded map from request path to memory objects
+// Lookups share a reader lock and stamp the object with a logical clock; inserts drop
+// the least recently used objects until the new one fits.
+class MemoryTier {
+public:
+    MemoryTier(std::uint64_t max_bytes, std::uint64_t max_object_bytes);
+
+    // Whether the tier holds anything at all (a zero budget disables it)
+    bool enabled() const { return m_max_bytes > 0; }
+
+    // Whether a file of this size may be held
+    bool fits(std::uint64_t size) const;
+
+    // Object of a path, nullptr if not held
+    std::shared_ptr<const memory_object> lookup(const std::string& request_path) const;
+
+    // Add or replace the object of a path, false if it is too large for the tier
+    bool insert(const std::string& request_path, std::shared_ptr<const memory_object> object);
+
+    // Drop the object of a path
+    void erase(const std::string& request_path);
+
+    // Bytes and objects held
+    std::uint64_t used_bytes() const;
+    std::size_t size() const;
+
+private:
+    std::uint64_t m_max_bytes;
+    std::uint64_t m_max_object_bytes;
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<const memory_object>> m_objects;
+    std::uint64_t m_used_bytes = 0;
+    mutable std::atomic<std::uint64_t> m_clock{0};
+};
@@ -0,0 +1,96 @@
+// In-memory metadata index of the pacPrism file cache
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <atomic>
+#include <ctime>
+#include <functional>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Access statistics of a cached file, updated in place on every hit
+struct access_stats {
+    std::atomic<std::int64_t> last_access{0};   // Unix time of the last hit
+    std::atomic<std::uint64_t> hit_count{0};    // Hits since the file was cached
+    std::atomic<std::int64_t> validated{0};     // Unix time upstream last confirmed the copy, 0 if unknown
+};
+
+// Metadata of one cached file, everything a hit or a 304 needs without a stat
+struct cache_entry {
+    std::uint64_t size = 0;        // File size in bytes
+    std::time_t mtime = 0;         // Modification time
+    std::string etag;              // "size-mtime"
+    std::string last_modified;     // HTTP date of mtime
+    std::string sha256;            // Hex digest, empty until the file was hashed
+    std::string upstream_etag;     // ETag upstream sent with the file, empty if none
+    std::time_t upstream_mtime = 0; // Last-Modified upstream sent with the file, 0 if none
+    std::string header;            // Serialized HTTP/1.1 200 header, ends with Content-Length and the blank line
+    std::size_t header_fields_end = 0; // Offset of the Content-Length line in header
+    bool verified = true;          // False for entries loaded from the persistent index until checked
+    std::shared_ptr<access_stats> access = std::make_shared<access_stats>(); // Shared by snapshots of the same file
+
+    // Status line header starts with
+    static constexpr std::string_view header_status = "HTTP/1.1 200 OK\r\n";
+
+    // Record a hit
+    void touch() const;
+
+    // Build an entry with derived ETag and Last-Modified
+    static cache_entry make(std::uint64_t size, std::time_t mtime, const std::string& sha256 = "");
+    // Build an entry from a file on disk, nullopt if it is not a regular file
+    static std::optional<cache_entry> from_file(const std::string& file_path);
+
+    // Format a time as an HTTP date (RFC 1123, always GMT)
+    static std::string http_date(std::time_t time);
+};
+
+// Concurrent index from request path to cache entry
+// Paths are spread over shards by hash, each shard behind its own reader/writer lock,
+// so hits on different paths never contend. Entries are immutable snapshots shared
+// with readers; an update replaces the snapshot instead of changing it in place.
+class MetadataIndex {
+public:
+    explicit MetadataIndex(std::size_t shard_count = 64);
+
+    // Entry of a path, nullptr if not indexed
+    std::shared_ptr<const cache_entry> lookup(const std::string& request_path) const;
+
+    // Add or replace the entry of a path
+    void insert(const std::string& request_path, cache_entry entry);
+
+    // Add the entry of a path unless it is already indexed
+    bool try_insert(const std::string& request_path, cache_entry entry);
+
+    // Remove a path, false if it was not indexed
+    bool erase(const std::string& request_path);
+
+    // Number of indexed paths
+    std::size_t size() const { return m_count.load(std::memory_order_relaxed); }
+
+    // Total size of the indexed files in bytes
+    std::uint64_t total_bytes() const { return m_total_bytes.load(std::memory_order_relaxed); }
+
+    // Visit every entry (each shard is read locked while it is visited)
+    void for_each(const std::function<void(const std::string&, const cache_entry&)>& visitor) const;
+
+    // Drop every entry
+    void clear();
+
+private:
+    struct shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<const cache_entry>> entries;
+    };
+
+    shard& shard_of(const std::string& request_path) const;
+
+private:
+    std::vector<std::unique_ptr<shard>> m_shards;
+    std::atomic<std::uint64_t> m_total_bytes{0};
+    std::atomic<std::size_t> m_count{0};
+};
@@ -0,0 +1,86 @@
+// Upstream mirror selection for the pacPrism file cache
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <condition_variable>
+
+// Observed state of one upstream mirror
+struct mirror_stats {
+    std::string host;               // "host" or "host:port"
+    bool healthy = true;            // False after a failure until a probe reaches it again
+    double latency_ms = 0;          // EWMA time from request start to response header
+    double throughput = 0;          // EWMA body bytes per second of larger downloads
+    std::uint64_t fetches = 0;      // Successful downloads
+    std::uint64_t failures = 0;     // Failed attempts
+    std::chrono::steady_clock::time_point failed_at{};
+};
+
+// Upstream mirrors of the cache, ranked by what fetches observed
+// Every miss goes to the healthy mirror with the lowest expected download time
+// (latency plus a typical package at its throughput); mirrors without samples yet are
+// tried first, in configured order. A failing mirror is taken out until a background
+// TCP probe reaches it again. If every mirror is down the least recently failed one is
+// still used, so a single configured mirror behaves as before.
+class MirrorSet {
+public:
+    MirrorSet(const std::string& hosts, std::chrono::seconds probe_interval);
+    ~MirrorSet();
+
+    MirrorSet(const MirrorSet&) = delete;
+    MirrorSet& operator=(const MirrorSet&) = delete;
+
+    // Split a comma or whitespace separated mirror list
+    static std::vector<std::string> parse_hosts(const std::string& hosts);
+
+    std::size_t size() const { return m_mirrors.size(); }
+    const std::string& host(std::size_t index) const { return m_mirrors[index].host; }
+
+    // Best mirror not in tried, nullopt once every mirror was tried
+    // rank picks the n-th best healthy mirror instead (wrapping), to spread parallel fetches.
+    std::optional<std::size_t> select(const std::vector<std::size_t>& tried = {}, std::size_t rank = 0) const;
+
+    // Feed the outcome of a fetch attempt
+    void report_success(std::size_t index,
+                        std::chrono::steady_clock::duration latency,
+                        std::uint64_t bytes,
+                        std::chrono::steady_clock::duration transfer);
+    void report_failure(std::size_t index);
+
+    // Try to connect to every unhealthy mirror, returns how many are healthy again
+    std::size_t probe_once(std::chrono::milliseconds timeout);
+
+    // Start or stop the background probe thread (only runs with more than one mirror)
+    void start();
+    void stop();
+
+    // Copy of the per-mirror state
+    std::vector<mirror_stats> snapshot() const;
+
+    // Weight of a new sample in the moving averages
+    static constexpr double ewma_alpha = 0.3;
+    // Download size the ranking assumes, and the smallest one that updates throughput
+    static constexpr double typical_bytes = 1024.0 * 1024.0;
+    static constexpr std::uint64_t min_throughput_bytes = 64 * 1024;
+
+private:
+    // Expected seconds to fetch typical_bytes (lock held)
+    double score(const mirror_stats& mirror) const;
+
+    void run();
+
+private:
+    std::vector<mirror_stats> m_mirrors;
+    std::chrono::seconds m_probe_interval;
+    mutable std::mutex m_mutex;
+
+    std::thread m_thread;
+    std::mutex m_thread_mutex;
+    std::condition_variable m_cv;
+    bool m_stopping = false;
+};
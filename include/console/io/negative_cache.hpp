@@ -0,0 +1,63 @@
+// Negative cache of failed upstream fetches for the pacPrism file cache
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+// Bounded map from request path to the last upstream failure of that path
+// Missing files (404, 410) are remembered for not_found_ttl, other failures (5xx, network
+// errors, 0 as status) for the shorter error_ttl, so repeated requests for a path upstream
+// does not have are answered without contacting it. Past max_entries the oldest entry goes.
+class NegativeCache {
+public:
+    NegativeCache(std::size_t max_entries, std::chrono::seconds not_found_ttl, std::chrono::seconds error_ttl);
+
+    // Whether anything is remembered at all (no entries or both TTLs zero disable it)
+    bool enabled() const;
+
+    // Remember a failed fetch of a path with the upstream status
+    void insert(const std::string& request_path, int status);
+
+    // Status of a remembered failure, nullopt if none or expired (counted as hit or miss)
+    std::optional<int> lookup(const std::string& request_path);
+
+    // Same without counting, for building the answer to a failure
+    std::optional<int> peek(const std::string& request_path) const;
+
+    // Forget a path
+    void erase(const std::string& request_path);
+
+    // Remembered paths, expired ones included until they are looked up or pushed out
+    std::size_t size() const;
+
+    // Lookups that found a failure and those that did not, since start
+    std::uint64_t get_hits() const { return m_hits.load(); }
+    std::uint64_t get_misses() const { return m_misses.load(); }
+
+private:
+    struct entry {
+        int status;
+        std::chrono::steady_clock::time_point expires;
+        std::list<std::string>::iterator order;
+    };
+
+    // Valid entry of a path, expired ones are dropped (lock held)
+    const entry* find(const std::string& request_path) const;
+
+private:
+    std::size_t m_max_entries;
+    std::chrono::seconds m_not_found_ttl;
+    std::chrono::seconds m_error_ttl;
+
+    mutable std::mutex m_mutex;
+    mutable std::unordered_map<std::string, entry> m_entries;
+    mutable std::list<std::string> m_order;     // Oldest insert first
+    std::atomic<std::uint64_t> m_hits{0};
+    std::atomic<std::uint64_t> m_misses{0};
+};
@@ -0,0 +1,67 @@
+// Background integrity checks of the pacPrism file cache
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+
+class FileCache;
+
+// Background scrubber re-hashing the cached files
+// A pass snapshots the index and hashes every file again on a small pool of worker
+// threads, comparing the SHA256 with the one recorded when the file was downloaded (or
+// listed by a Packages index). Reads of all workers together are held under rate bytes
+// per second, so a pass never competes with live traffic for the disk. A file that does
+// not match any more (bit rot, a truncated write) is moved to the quarantine directory
+// and unindexed, and the next request fetches it again; a file without a recorded digest
+// gets the one computed now.
+class CacheScrubber {
+public:
+    // Directory under the cache directory corrupt files are moved to, for inspection
+    static constexpr const char* quarantine_dir = ".pacprism-quarantine";
+
+    // rate 0 reads as fast as the disk allows
+    CacheScrubber(FileCache& cache, std::size_t threads, std::uint64_t rate, std::chrono::seconds interval);
+    ~CacheScrubber();
+
+    // Start or stop the background thread, a pass in progress stops after the current reads
+    void start();
+    void stop();
+
+    // Run one pass now, returns the number of corrupt files found
+    std::size_t run_once();
+
+    // Totals since start
+    std::uint64_t get_scrubbed_files() const { return m_scrubbed_files.load(); }
+    std::uint64_t get_scrubbed_bytes() const { return m_scrubbed_bytes.load(); }
+    std::uint64_t get_corrupt_files() const { return m_corrupt_files.load(); }
+
+private:
+    void run();
+
+    // Hash one cached file and report it to the cache, true if it was corrupt
+    bool scrub(const std::string& request_path);
+
+    // Wait until bytes more may be read at the rate, false if stopping
+    bool throttle(std::uint64_t bytes);
+
+private:
+    FileCache& m_cache;
+    std::size_t m_threads;
+    std::uint64_t m_rate;
+    std::chrono::seconds m_interval;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::atomic<bool> m_stopping{false};
+    std::chrono::steady_clock::time_point m_next_read{};  // Start of the next free read slot
+
+    std::atomic<std::uint64_t> m_scrubbed_files{0};
+    std::atomic<std::uint64_t> m_scrubbed_bytes{0};
+    std::atomic<std::uint64_t> m_corrupt_files{0};
+};
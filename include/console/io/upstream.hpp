@@ -0,0 +1,376 @@
+// Asynchronous upstream fetching for the pacPrism file cache
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <functional>
+
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+
+#include <console/io/upstream_pool.hpp>
+#include <console/io/mirror_set.hpp>
+#include <node/validator/digest.hpp>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+class Config;
+
+// Completion handler for upstream fetches, true if the file is now cached
+using fetch_handler = std::function<void(bool)>;
+
+class SegmentedDownload;
+
+// Download state shared between an upstream fetch and the clients reading its file
+// The fetch publishes how many body bytes are on disk; readers follow the live tail
+// and are woken on their own executor whenever more data arrives.
+class FetchProgress {
+public:
+    // Snapshot of the download state
+    struct state {
+        bool started = false;                       // Upstream accepted, body is being written
+        bool done = false;                          // Fetch finished (successfully or not)
+        bool success = false;                       // File is complete
+        std::optional<std::uint64_t> content_length; // Announced body size, if any
+        std::uint64_t bytes_on_disk = 0;            // Body bytes written so far
+        int status = 0;                             // Last upstream HTTP status, 0 before any response
+        std::string sha256;                         // Digest of the complete body, empty if it was not hashed
+        std::string etag;                           // ETag of the response delivering the body
+        std::string last_modified;                  // Last-Modified of that response
+        std::uint64_t generation = 0;               // Bumped whenever the body restarts from byte 0
+    };
+
+    explicit FetchProgress(const std::string& file_path) : m_file_path(file_path) {}
+
+    // Progress of a file that is already complete on disk
+    static std::shared_ptr<FetchProgress> completed(const std::string& file_path, std::uint64_t size);
+
+    // Fetch side: body (re)started, more bytes written, fetch finished
+    void start(std::optional<std::uint64_t> content_length);
+    void advance(std::uint64_t bytes_on_disk);
+    void finish(bool success);
+    // Fetch side: the body written so far is void (failed its checksum), readers that relayed part of it give up
+    void reset();
+    void set_status(int status);
+    void set_sha256(const std::string& sha256);
+    void set_validators(const std::string& etag, const std::string& last_modified);
+
+    // Fetch side: write to a staging file (before start), then rename it to final_path
+    // With sync the file and the rename are flushed to disk first and after, so this blocks;
+    // fetches call it on their disk executor.
+    void relocate(const std::string& staging_path);
+    bool commit(const std::string& final_path, bool sync);
+
+    // Reader side
+    state snapshot() const;
+    std::string file_path() const;
+    // Open the file for reading, wherever it is right now
+    void open(beast::file& file, beast::error_code& ec) const;
+
+    // Wait until the body started (true) or the fetch failed before that (false)
+    void async_wait_started(net::any_io_executor executor, fetch_handler handler);
+    // Wait until the fetch finished
+    void async_wait_done(net::any_io_executor executor, fetch_handler handler);
+    // Wait until more than seen_bytes are on disk, the body restarted past generation or the fetch finished
+    void async_wait_progress(net::any_io_executor executor, std::uint64_t generation, std::uint64_t seen_bytes,
+                             fetch_handler handler);
+
+private:
+    enum class wait_kind { started, done, progress };
+
+    struct waiter {
+        wait_kind kind;
+        std::uint64_t generation;
+        std::uint64_t seen_bytes;
+        net::any_io_executor executor;
+        fetch_handler handler;
+    };
+
+    // Queue a waiter, or complete it right away if already satisfied
+    void add_waiter(wait_kind kind, std::uint64_t generation, std::uint64_t seen_bytes, net::any_io_executor executor,
+                    fetch_handler handler);
+    // Check if a waiter is satisfied by the current state (lock held)
+    bool satisfied(const waiter& w) const;
+    // Result handed to a satisfied waiter (lock held)
+    bool result_of(const waiter& w) const;
+    // Post every satisfied waiter to its executor
+    void notify();
+
+private:
+    std::string m_file_path;
+    mutable std::mutex m_mutex;
+    state m_state;
+    std::vector<waiter> m_waiters;
+};
+
+// A single upstream download running on the caller's executor
+// Writes the response body to a staging file as it arrives and renames it into place once complete.
+class UpstreamFetch : public std::enable_shared_from_this<UpstreamFetch> {
+public:
+    // Factory method for creating shared_ptr instances
+    // The body goes to a staging file next to progress's path, continuing a partial one
+    // left by an earlier fetch of the same file, and is renamed into place when complete.
+    // Blocking file work (hashing a whole file) runs on disk_executor, never on executor.
+    static std::shared_ptr<UpstreamFetch> create(net::any_io_executor executor,
+                                                 net::any_io_executor disk_executor,
+                                                 const Config& config,
+                                                 UpstreamPool& pool,
+                                                 MirrorSet& mirrors,
+                                                 const std::string& request_path,
+                                                 std::shared_ptr<FetchProgress> progress,
+                                                 fetch_handler handler);
+
+    // Conditional fetch of a cached file with the validators upstream sent for it
+    // (If-Modified-Since and If-None-Match, an unconditional fetch if both are empty)
+    // A 304 leaves the cached file in place (progress status 304, handler true), a 200 replaces it.
+    static std::shared_ptr<UpstreamFetch> create_revalidation(net::any_io_executor executor,
+                                                              net::any_io_executor disk_executor,
+                                                              const Config& config,
+                                                              UpstreamPool& pool,
+                                                              MirrorSet& mirrors,
+                                                              const std::string& request_path,
+                                                              std::shared_ptr<FetchProgress> progress,
+                                                              const std::string& last_modified,
+                                                              const std::string& etag,
+                                                              fetch_handler handler);
+
+    // Fetch of one byte range of a segmented download, reports to the download instead of a handler
+    static std::shared_ptr<UpstreamFetch> create_segment(net::any_io_executor executor,
+                                                         net::any_io_executor disk_executor,
+                                                         const Config& config,
+                                                         UpstreamPool& pool,
+                                                         MirrorSet& mirrors,
+                                                         const std::string& request_path,
+                                                         std::shared_ptr<FetchProgress> progress,
+                                                         std::shared_ptr<SegmentedDownload> download,
+                                                         std::size_t segment);
+
+    // Check the body against the SHA256 a repository index lists before it is committed
+    // A mismatch counts as a failed attempt of the mirror, the next one is tried.
+    void expect_sha256(const std::string& sha256);
+
+    // Start the first attempt, the handler is invoked exactly once on the executor
+    // A failed attempt moves on to the next untried mirror; once every mirror failed, the
+    // round counts as an attempt and the next one waits out a backoff timer (1s, 2s, 4s).
+    void start();
+
+private:
+    // Private constructor for factory method
+    UpstreamFetch(net::any_io_executor executor,
+                  net::any_io_executor disk_executor,
+                  const Config& config,
+                  UpstreamPool& pool,
+                  MirrorSet& mirrors,
+                  const std::string& request_path,
+                  std::shared_ptr<FetchProgress> progress,
+                  fetch_handler handler);
+
+    // Attempt steps.
+    void on_resolve(const beast::error_code& ec, std::vector<tcp::endpoint> endpoints);
+    void on_acquire(bool reused);
+    void on_connect(const beast::error_code& ec);
+    void on_write(const beast::error_code& ec);
+    void on_header(const beast::error_code& ec);
+    void read_body();
+    void on_body(const beast::error_code& ec);
+
+    // Schedule another attempt after backoff, or fail if retries are exhausted.
+    // A pooled connection the server closed meanwhile is replaced without counting an attempt.
+    void retry_or_fail(const std::string& reason);
+
+    // Point the next attempt at a mirror
+    void use_mirror(std::size_t index);
+
+    // Split the download after the first response announced a large file
+    void become_segmented(std::uint64_t total);
+
+    // Open the staging file at the segment's next byte
+    bool open_segment_file();
+
+    // Resumable downloads: pick up a partial file, remember or forget its validator,
+    // continue the body after a 206 to our "bytes=N-" request (once the digest caught up
+    // with a partial file of an earlier fetch, read back on the disk executor)
+    void load_resume();
+    void remember_validator(std::optional<std::uint64_t> content_length);
+    void discard_resume();
+    void resume_body(std::uint64_t total);
+    void continue_resume(bool hashed);
+
+    // Publish the digest of a complete body, false (body discarded) if it is not the expected one
+    bool verify_body();
+
+    // Hand the connection back to the pool, kept open only if reusable.
+    void release_connection(bool reusable);
+
+    // Release the connection and commit a complete body on the disk executor, then conclude
+    void finish(bool success);
+
+    // Keep or drop the staging files of a fetch that is over and invoke the handler
+    void conclude(bool success);
+
+private:
+    net::any_io_executor m_executor;
+    net::any_io_executor m_disk_executor;
+    UpstreamPool& m_pool;
+    MirrorSet& m_mirrors;
+    std::vector<tcp::endpoint> m_endpoints;
+    beast::tcp_stream m_stream;
+    bool m_leased = false;     // Holding a pool slot
+    bool m_reused = false;     // The slot came with a warm connection
+    net::steady_timer m_timer;
+    beast::flat_buffer m_buffer;
+    http::request<http::empty_body> m_request;
+    std::unique_ptr<http::response_parser<http::buffer_body>> m_parser;
+    // The body is parsed into this fixed size buffer and flushed to disk after every read,
+    // so memory per fetch is bounded by fetch_buffer_size
+    std::vector<char> m_chunk;
+    beast::file m_file;
+    std::uint64_t m_bytes_written = 0;
+    std::shared_ptr<FetchProgress> m_progress;
+
+    // Resumable downloads: retries continue a partial body with "Range: bytes=N-" and If-Range,
+    // the validator is kept next to the staging file so this works across restarts too
+    std::string m_final_path;
+    std::string m_validator;             // ETag or Last-Modified of the partial body
+    std::optional<std::uint64_t> m_total;
+    std::uint64_t m_resume_offset = 0;   // Offset requested by the current attempt
+
+    // Digest of the body, fed with every chunk written from offset 0 (not for segments)
+    // With dedup, scrubbing or an expected digest; checked before the commit.
+    bool m_hash;
+    Digest m_digest;
+    std::uint64_t m_hashed = 0;          // Body bytes fed to m_digest, a retry resuming there needs no read back
+    std::string m_expected_sha256;
+
+    // Revalidation: upstream confirmed the cached copy, nothing to commit
+    bool m_revalidation = false;
+    bool m_not_modified = false;
+
+    // Segmented downloads (m_download is set once this fetch works on a byte range)
+    const Config& m_config;
+    std::shared_ptr<SegmentedDownload> m_download;
+    std::size_t m_segment = 0;
+    std::uint64_t m_range_begin = 0;
+    std::uint64_t m_range_end = 0;       // Exclusive
+    std::uint64_t m_received = 0;        // Bytes of the range on disk, kept across retries
+    std::size_t m_rank = 0;              // Start on the n-th best mirror
+    bool m_may_split;                    // Split a large 200 that accepts ranges into segments
+    std::uint64_t m_segment_threshold;
+
+    std::size_t m_mirror = 0;
+    std::vector<std::size_t> m_tried;    // Mirrors that failed in this round
+    std::chrono::steady_clock::time_point m_attempt_start;
+    std::chrono::steady_clock::time_point m_header_time;
+    std::string m_host;
+    std::string m_port;
+    std::string m_pool_key;
+    std::string m_request_path;
+    fetch_handler m_handler;
+
+    int m_attempt = 0;
+    int m_max_retries;
+    int m_connect_timeout;
+    int m_read_timeout;
+};
+
+// A large file fetched as byte ranges over several connections
+// The first fetch learns the size and range support from the Content-Length and
+// Accept-Ranges of its plain 200, preallocates a staging file next to the cache file and
+// keeps streaming that response as the first segment; helper fetches take the other
+// segments in order, at most parallelism at a time, starting on different mirrors. Each
+// writes at its offset. Readers see the contiguous prefix on disk as progress, and the
+// staging file is renamed into place once every segment is in, so a cache file is never
+// partly filled. Segments arrive out of order, so a digest takes one read of the assembled
+// file; that read and the commit run on the disk executor, everything else on the executor
+// of the first fetch.
+class SegmentedDownload : public std::enable_shared_from_this<SegmentedDownload> {
+public:
+    struct segment {
+        std::uint64_t begin;
+        std::uint64_t end;              // Exclusive
+        std::uint64_t received = 0;
+        enum class status { pending, active, done } state = status::pending;
+    };
+
+    static std::shared_ptr<SegmentedDownload> create(net::any_io_executor executor,
+                                                     net::any_io_executor disk_executor,
+                                                     const Config& config,
+                                                     UpstreamPool& pool,
+                                                     MirrorSet& mirrors,
+                                                     const std::string& request_path,
+                                                     std::shared_ptr<FetchProgress> progress,
+                                                     const std::string& final_path,
+                                                     std::uint64_t total,
+                                                     fetch_handler handler) {
+        return std::shared_ptr<SegmentedDownload>(new SegmentedDownload(
+            executor, disk_executor, config, pool, mirrors, request_path, std::move(progress), final_path, total,
+            std::move(handler)));
+    }
+
+    std::uint64_t total_size() const { return m_total; }
+    std::size_t segment_count() const { return m_segments.size(); }
+    const segment& get_segment(std::size_t index) const { return m_segments[index]; }
+
+    // A segment failed for good, the others stop early
+    bool failed() const { return m_failed; }
+
+    // Claim the first segment for the fetch already receiving the file from offset 0
+    std::size_t claim_first();
+
+    // Check the assembled file against a SHA256 before it is committed
+    void expect_sha256(const std::string& sha256) { m_expected_sha256 = sha256; }
+
+    // Start helper fetches for the remaining segments
+    void start();
+
+    // Segment fetch side
+    void segment_written(std::size_t index, std::uint64_t received);
+    void segment_finished(std::size_t index, bool success);
+
+private:
+    SegmentedDownload(net::any_io_executor executor,
+                      net::any_io_executor disk_executor,
+                      const Config& config,
+                      UpstreamPool& pool,
+                      MirrorSet& mirrors,
+                      const std::string& request_path,
+                      std::shared_ptr<FetchProgress> progress,
+                      const std::string& final_path,
+                      std::uint64_t total,
+                      fetch_handler handler);
+
+    // Start fetches for pending segments up to the parallelism
+    void spawn();
+
+    // Commit or discard the staging file once no segment fetch is left
+    void complete();
+
+    // Hash the assembled file if needed and rename it into place (on the disk executor)
+    bool verify_and_commit(bool hash);
+
+private:
+    net::any_io_executor m_executor;
+    net::any_io_executor m_disk_executor;
+    const Config& m_config;
+    UpstreamPool& m_pool;
+    MirrorSet& m_mirrors;
+    std::string m_request_path;
+    std::shared_ptr<FetchProgress> m_progress;
+    std::string m_final_path;
+    std::uint64_t m_total;
+    fetch_handler m_handler;
+
+    std::vector<segment> m_segments;
+    std::size_t m_parallelism;
+    std::size_t m_active = 0;
+    std::uint64_t m_prefix = 0;          // Contiguous bytes on disk from offset 0
+    bool m_failed = false;
+    std::string m_expected_sha256;
+};
@@ -0,0 +1,103 @@
+// Persistent upstream connections for the pacPrism file cache
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+
+namespace beast = boost::beast;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+// Keep-alive connections and cached DNS results, shared by every upstream fetch
+// Idle connections are parked as raw descriptors, so one opened on a worker's io_context
+// can carry the next fetch on any other worker. Per host at most max_per_host connections
+// exist (busy plus idle); further fetches queue until one is handed back. Idle connections
+// expire after idle_timeout and are checked for a server side close before reuse.
+class UpstreamPool {
+public:
+    using resolve_handler = std::function<void(const beast::error_code&, std::vector<tcp::endpoint>)>;
+    // True if the socket now holds a warm connection, false if the caller has to connect it
+    using acquire_handler = std::function<void(bool reused)>;
+
+    UpstreamPool(std::size_t max_per_host,
+                 std::chrono::seconds idle_timeout,
+                 std::chrono::seconds dns_ttl,
+                 bool keep_alive = true);
+    ~UpstreamPool();
+
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool& operator=(const UpstreamPool&) = delete;
+
+    // Resolve host and port, from the cache while the last result is younger than dns_ttl
+    void async_resolve(net::any_io_executor executor, const std::string& host, const std::string& port,
+                       resolve_handler handler);
+
+    // Wait for a connection slot of a host ("host:port"), the handler runs on the executor
+    // A warm connection is assigned to socket before the handler runs.
+    void async_acquire(net::any_io_executor executor, const std::string& host_key, tcp::socket& socket,
+                       acquire_handler handler);
+
+    // Hand a slot back, parking the connection if it is reusable (response fully read)
+    // Otherwise the socket is closed. Every acquire must be matched by one release.
+    void release(const std::string& host_key, tcp::socket& socket, bool reusable);
+
+    // Idle connections parked for a host
+    std::size_t idle_count(const std::string& host_key) const;
+
+    // Totals since start
+    std::uint64_t get_reused_connections() const { return m_reused.load(); }
+    std::uint64_t get_dns_cache_hits() const { return m_dns_hits.load(); }
+
+private:
+    struct idle_connection {
+        int fd;
+        bool v6;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    struct waiter {
+        net::any_io_executor executor;
+        tcp::socket* socket;
+        acquire_handler handler;
+    };
+
+    struct host_state {
+        std::size_t open = 0;                 // Busy plus idle connections
+        std::deque<idle_connection> idle;     // Most recently used at the back
+        std::deque<waiter> waiters;
+    };
+
+    struct dns_entry {
+        std::vector<tcp::endpoint> endpoints;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    // Pop a live idle connection of a host, closing expired or dead ones (lock held)
+    bool take_idle(host_state& host, idle_connection& connection);
+
+    // Run an acquire handler on its executor, assigning the connection first if there is one
+    void grant(waiter w, const idle_connection* connection);
+
+private:
+    std::size_t m_max_per_host;
+    std::chrono::seconds m_idle_timeout;
+    std::chrono::seconds m_dns_ttl;
+    bool m_keep_alive;
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, host_state> m_hosts;
+    std::unordered_map<std::string, dns_entry> m_dns;
+
+    std::atomic<std::uint64_t> m_reused{0};
+    std::atomic<std::uint64_t> m_dns_hits{0};
+};
@@ -2,8 +2,10 @@
 
 #include <memory>
 #include <variant>
+#include <functional>
 
 #include <boost/beast.hpp>
+#include <boost/asio.hpp>
 
 #include <node/dht/dht_operation.hpp>
 #include <node/validator/validator.hpp>
@@ -11,6 +13,7 @@
 
 namespace beast = boost::beast;
 namespace http = beast::http;
+namespace net = boost::asio;
 
 // Forward declaration
 class FileCache;
@@ -18,14 +21,24 @@ class FileCache;
 using router_response = std::variant<
     std::shared_ptr<http::response<http::string_body>>,
     std::shared_ptr<http::response<http::file_body>>,
-    std::shared_ptr<http::response<http::empty_body>>
+    std::shared_ptr<http::response<http::empty_body>>,
+    std::shared_ptr<streaming_response>,
+    std::shared_ptr<const memory_object>,
+    std::shared_ptr<file_hit_response>
 >;
 
+// Completion handler for asynchronously routed requests.
+using router_handler = std::function<void(router_response)>;
+
 class Router {
 public:
     Router(DHT_operation& dht, Validator& validator, FileCache& cache);
     // Route request by operation.
     router_response global_router(const http::request<http::string_body>& request);
+    // Route request without blocking on upstream, the handler receives the response.
+    void async_global_router(const http::request<http::string_body>& request,
+                             net::any_io_executor executor,
+                             router_handler handler);
 
 private:
     // Process requests from non node cilents.
@@ -34,6 +47,12 @@ private:
     // Process requests from other nodes.
     router_response node_response_router(const http::request<http::string_body>& request);
 
+    // Extract the cached file path of a plain request, empty for the root page.
+    std::string extract_file_path(const http::request<http::string_body>& request) const;
+
+    // Answer to a file upstream could not deliver, 404 or 410 if it said the file is missing.
+    router_response upstream_failure_response(const std::string& file_path, std::size_t version);
+
     // Default response builder.
     router_response default_response_builder(const std::string& body_string, std::size_t version, http::status status);
 
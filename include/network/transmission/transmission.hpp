@@ -2,6 +2,8 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+#include <atomic>
 
 #include <boost/beast.hpp>
 #include <boost/asio.hpp>
@@ -16,6 +18,51 @@ using tcp = net::ip::tcp;
 // Forward declarations
 class ServerTrans;
 class ClientTrans;
+struct stream_state;
+struct sendfile_state;
+struct uring_state;
+
+// Disk and socket I/O engine for cached file responses
+// epoll: readiness based, file bodies go out with sendfile or buffered writes.
+// io_uring: file reads and socket sends are submitted to the kernel ring, so disk reads
+// never block the event loop (needs a build with PACPRISM_IO_URING).
+enum class io_engine {
+    epoll,
+    io_uring
+};
+
+// Pool of io_contexts, one per worker thread
+// Each accepted connection is bound to one context, so its handlers run on a single
+// thread and need no strand, while connections spread over all cores.
+class IoContextPool {
+public:
+    explicit IoContextPool(std::size_t size);
+    ~IoContextPool();
+
+    // Next context in round-robin order.
+    net::io_context& get_io_context();
+    // Context by index.
+    net::io_context& get_io_context(std::size_t index);
+    // Number of contexts (worker threads).
+    std::size_t size() const { return m_io_contexts.size(); }
+
+    // Run every context on its own thread and block until all of them stopped.
+    void run();
+    // Stop all contexts.
+    void stop();
+
+private:
+    // io_context whose pending handlers can be destroyed before the context itself
+    class worker_context : public net::io_context {
+    public:
+        using net::io_context::io_context;
+        using net::execution_context::shutdown;
+    };
+
+    std::vector<std::unique_ptr<worker_context>> m_io_contexts;
+    std::vector<net::executor_work_guard<net::io_context::executor_type>> m_work_guards;
+    std::atomic<std::size_t> m_next{0};
+};
 
 // Transmission base class (pure interface)
 class Transmission {
@@ -30,14 +77,29 @@ public:
     static std::shared_ptr<ServerTrans> create(net::io_context& io_context, Router& router) {
         return std::shared_ptr<ServerTrans>(new ServerTrans(io_context, router));
     }
+    // Factory method for a server spreading connections over a worker pool
+    // With reuse_port every worker gets its own SO_REUSEPORT acceptor on the same port,
+    // letting the kernel balance new connections without a shared accept queue.
+    static std::shared_ptr<ServerTrans> create(IoContextPool& pool, Router& router, bool reuse_port = false) {
+        return std::shared_ptr<ServerTrans>(new ServerTrans(pool, router, reuse_port));
+    }
     // Start a server with ip and port.
     void start_server(const net::ip::address& address, unsigned short port);
+    // Connections accepted by each acceptor so far.
+    std::vector<std::uint64_t> get_accept_counts() const;
+    // Send cached file bodies with sendfile(2) instead of copying them through userspace.
+    void set_zero_copy(bool enabled) { m_zero_copy = enabled; }
+    // Select the I/O engine, false (and unchanged) if it is not compiled in.
+    bool set_io_engine(io_engine engine);
+    // Whether this build has the io_uring engine.
+    static bool io_uring_available();
 
 private:
     // Private constructor for factory method
     explicit ServerTrans(net::io_context& io_context, Router& router);
+    explicit ServerTrans(IoContextPool& pool, Router& router, bool reuse_port);
     // On creating a server, start it.
-    void start_accept();
+    void start_accept(std::size_t index);
     // Read individual client connections.
     void read_from_connection(std::shared_ptr<tcp::socket> socket,
                               std::shared_ptr<beast::flat_buffer> buffer,
@@ -47,11 +109,46 @@ private:
     // Send a response.
     void response_sender(std::shared_ptr<tcp::socket> socket,
                          router_response response);
+    // Send a response whose body is still being downloaded.
+    void stream_sender(std::shared_ptr<tcp::socket> socket,
+                       std::shared_ptr<streaming_response> response);
+    // Relay the next part of a streamed body, waiting for the download when caught up.
+    void stream_body(std::shared_ptr<tcp::socket> socket,
+                     std::shared_ptr<streaming_response> response,
+                     std::shared_ptr<stream_state> state);
+    // Send a cached file response, header first and the body with sendfile(2).
+    void sendfile_sender(std::shared_ptr<tcp::socket> socket,
+                         std::shared_ptr<http::response<http::file_body>> response);
+    // Push the next part of a sendfile body, waiting for the socket when it is full.
+    void sendfile_body(std::shared_ptr<tcp::socket> socket, std::shared_ptr<sendfile_state> state);
+    // Send a cache hit, its prepared header first, then the body by the selected engine.
+    void hit_sender(std::shared_ptr<tcp::socket> socket, std::shared_ptr<file_hit_response> hit);
+    // Read the next part of a body from the file and write it (zero copy disabled).
+    void buffered_body(std::shared_ptr<tcp::socket> socket, std::shared_ptr<sendfile_state> state);
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    // Send a cached file response, reading the body through io_uring.
+    void uring_sender(std::shared_ptr<tcp::socket> socket,
+                      std::shared_ptr<http::response<http::file_body>> response);
+    // Read the next part of the body from the ring and send it.
+    void uring_body(std::shared_ptr<tcp::socket> socket, std::shared_ptr<uring_state> state);
+#endif
+    // Keep the connection alive for the next request or shut it down.
+    void finish_response(std::shared_ptr<tcp::socket> socket, bool keep_alive);
 
 private:
+    // A listening socket and the number of connections it accepted.
+    struct acceptor_shard {
+        std::unique_ptr<tcp::acceptor> acceptor;
+        std::atomic<std::uint64_t> accepted{0};
+    };
+
     // Member variables
     net::io_context& m_io_context;
-    std::unique_ptr<tcp::acceptor> m_acceptor;
+    IoContextPool* m_pool = nullptr;
+    bool m_reuse_port = false;
+    bool m_zero_copy = true;
+    io_engine m_io_engine = io_engine::epoll;
+    std::vector<std::unique_ptr<acceptor_shard>> m_acceptors;
     Router& m_router;
 };
 
@@ -6,13 +6,18 @@
 #include <unordered_map>
 #include <set>
 #include <optional>
+#include <memory>
+#include <shared_mutex>
 #include <cstdint>
 
 #include <node/dht/dht_types.hpp>
 
 // DHT operation class for managing distributed hash table entries
+// Safe to call from any worker thread: lookups share a reader lock, updates take it exclusively.
 class DHT_operation {
 private:
+    // Guards all tables below.
+    mutable std::shared_mutex m_mutex;
     // Node IP to node ID.
     std::unordered_map<std::string, std::string> node_ip_to_node_id_entries;
     // Node ID to node IP.
@@ -37,8 +42,8 @@ public:
     bool verify_entry(std::string node_id);
     // Store an entry.
     void store_entry(dht_entry entry);
-    // Query node IDs by shard ID.
-    const std::set<std::string>* query_node_ids_by_shard_id(std::string shard_id_querying);
+    // Query node IDs by shard ID, returns a snapshot or nullptr if the shard is unknown.
+    std::shared_ptr<const std::set<std::string>> query_node_ids_by_shard_id(std::string shard_id_querying);
     // Build an entry.
     dht_entry entry_builder(std::string node_id);
     // Remove expired nodes based on expiry time.
@@ -47,6 +52,8 @@ public:
     void clean_by_liveness();
 
 private:
-    // Remove a node by ID from all entries.
+    // Check if an entry exist (lock held).
+    bool contains_entry(const std::string& node_id) const;
+    // Remove a node by ID from all entries (exclusive lock held).
     void remove_entry(const std::string& node_id);
 };
\ No newline at end of file
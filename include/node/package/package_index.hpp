@@ -0,0 +1,52 @@
+// Expected checksums of repository files, read from Debian Packages indexes
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <filesystem>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+// Size and digest a Packages index lists for a file
+struct package_digest {
+    std::uint64_t size = 0;
+    std::string sha256;         // Lowercase hex
+};
+
+// Request path to expected digest, for every file the loaded Packages indexes list
+// A Packages index at <root>/dists/<suite>/.../Packages names its files relative to
+// <root> ("Filename: pool/main/h/hello/hello_2.10-3_amd64.deb"). Pool files never
+// change under the same name, so entries of replaced indexes are kept. Thread-safe.
+// Indexes may be stored uncompressed, xz or gzip compressed (Packages.xz, Packages.gz).
+class PackageIndex {
+public:
+    // Repository root of an index path ("/debian" for "/debian/dists/bookworm/.../Packages")
+    static std::optional<std::string> repository_root(const std::string& index_path);
+
+    // Whether a request path is a Packages index (Packages, Packages.xz, Packages.gz or a by-hash copy)
+    static bool is_index(const std::string& request_path);
+
+    // Add the files of an uncompressed Packages index, returns how many had a SHA256
+    std::size_t load(const std::string& root, std::istream& packages);
+
+    // Add the files of an index file, uncompressed, xz or gzip (told by its magic bytes)
+    // Nothing is added from a file that fails to decompress.
+    std::size_t load_file(const std::string& root, const std::filesystem::path& file);
+
+    // Expected digest of a request path, nullopt if no loaded index lists it
+    std::optional<package_digest> lookup(const std::string& request_path) const;
+
+    std::size_t size() const;
+
+private:
+    using file_list = std::vector<std::pair<std::string, package_digest>>;
+
+    static file_list parse(const std::string& root, std::istream& packages);
+    std::size_t add(file_list files);
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<std::string, package_digest> m_files;
+};
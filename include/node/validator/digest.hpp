@@ -0,0 +1,49 @@
+// Incremental message digests for file integrity checks
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <limits>
+#include <functional>
+
+struct evp_md_st;
+struct evp_md_ctx_st;
+
+// Streaming digest through OpenSSL EVP ("sha256", "sha512", "md5", ...)
+// Fed with the same buffers a download writes to disk, so the digest is ready when the
+// last byte arrives instead of costing another read of the finished file. EVP picks the
+// fastest implementation for the CPU at runtime (SHA-NI, AVX2, ARMv8 crypto extensions)
+// and, unlike the SHA256_* calls, is not deprecated in OpenSSL 3.
+class Digest {
+public:
+    explicit Digest(const std::string& algorithm = "sha256");
+    ~Digest();
+
+    Digest(const Digest&) = delete;
+    Digest& operator=(const Digest&) = delete;
+
+    // Feed more bytes
+    void update(const void* data, std::size_t size);
+
+    // Feed the first length bytes of a file, false if it could not be read that far
+    // Read with sequential readahead into a page aligned buffer of up to read_buffer_size.
+    // on_read sees the size of every read and can stop reading by returning false.
+    bool update_file(const std::string& file_path,
+                     std::uint64_t length = std::numeric_limits<std::uint64_t>::max(),
+                     const std::function<bool(std::size_t)>& on_read = nullptr);
+
+    // Hex digest of everything fed so far, the digest starts over afterwards
+    std::string hex_digest();
+
+    // Start over
+    void reset();
+
+    // Lowercase hex of raw bytes
+    static std::string to_hex(const unsigned char* data, std::size_t size);
+
+    static constexpr std::size_t read_buffer_size = 1024 * 1024;
+
+private:
+    const evp_md_st* m_md;
+    evp_md_ctx_st* m_ctx;
+};
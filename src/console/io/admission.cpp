@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <functional>
+
+#include <console/io/admission.hpp>
+
+// Helper: splitmix64 finalizer, spreads a row-salted hash over the counters
+static std::uint64_t mix(std::uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// FrequencySketch implementation
+
+FrequencySketch::FrequencySketch(std::size_t expected_items) {
+    // Power of two width, at least 1024 counters per row
+    std::size_t width = 1024;
+    while (width < expected_items) {
+        width <<= 1;
+    }
+    m_mask = width - 1;
+    m_sample_size = 10 * width;
+    m_counters = std::vector<std::atomic<std::uint8_t>>(depth * width);
+}
+
+std::size_t FrequencySketch::slot(std::uint64_t hash, int row) const {
+    return row * width() + (mix(hash + row * 0x632be59bd9b4e019ULL) & m_mask);
+}
+
+void FrequencySketch::increment(const std::string& key) {
+    std::uint64_t hash = std::hash<std::string>{}(key);
+
+    // Conservative update: only the counters at the current minimum are raised
+    std::size_t slots[depth];
+    std::uint8_t minimum = max_count;
+    for (int row = 0; row < depth; row++) {
+        slots[row] = slot(hash, row);
+        minimum = std::min(minimum, m_counters[slots[row]].load(std::memory_order_relaxed));
+    }
+    if (minimum == max_count) {
+        return;
+    }
+    for (int row = 0; row < depth; row++) {
+        std::uint8_t expected = minimum;
+        m_counters[slots[row]].compare_exchange_strong(expected, minimum + 1, std::memory_order_relaxed);
+    }
+
+    if (m_additions.fetch_add(1, std::memory_order_relaxed) + 1 >= m_sample_size) {
+        age();
+    }
+}
+
+unsigned FrequencySketch::estimate(const std::string& key) const {
+    std::uint64_t hash = std::hash<std::string>{}(key);
+    std::uint8_t minimum = max_count;
+    for (int row = 0; row < depth; row++) {
+        minimum = std::min(minimum, m_counters[slot(hash, row)].load(std::memory_order_relaxed));
+    }
+    return minimum;
+}
+
+void FrequencySketch::age() {
+    // One thread ages, the others just keep counting
+    std::unique_lock<std::mutex> lock(m_age_mutex, std::try_to_lock);
+    if (!lock.owns_lock() || m_additions.load(std::memory_order_relaxed) < m_sample_size) {
+        return;
+    }
+    for (auto& counter : m_counters) {
+        counter.store(counter.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+    m_additions.store(m_sample_size / 2, std::memory_order_relaxed);
+}
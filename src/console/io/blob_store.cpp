@@ -0,0 +1,147 @@
+#include <iostream>
+#include <mutex>
+
+#include <console/io/blob_store.hpp>
+
+// BlobStore implementation
+
+fs::path BlobStore::blob_path(const std::string& sha256) const {
+    return m_root / sha256.substr(0, 2) / sha256;
+}
+
+bool BlobStore::share(const fs::path& file_path, const std::string& sha256) {
+    if (sha256.size() < 2) {
+        return false;
+    }
+    fs::path blob = blob_path(sha256);
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    // Not create_directories, a cache directory removed meanwhile stays removed
+    std::error_code ec;
+    fs::create_directory(m_root, ec);
+    fs::create_directory(blob.parent_path(), ec);
+
+    // First copy of these bytes, the file itself becomes the blob
+    fs::create_hard_link(file_path, blob, ec);
+    if (!ec) {
+        std::error_code size_ec;
+        std::uint64_t size = fs::file_size(blob, size_ec);
+        if (!size_ec) {
+            m_blobs.fetch_add(1, std::memory_order_relaxed);
+            m_stored_bytes.fetch_add(size, std::memory_order_relaxed);
+            m_linked_bytes.fetch_add(size, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    if (ec != std::errc::file_exists) {
+        std::cerr << "Failed to store blob " << sha256 << ": " << ec.message() << std::endl;
+        return false;
+    }
+    if (fs::equivalent(file_path, blob, ec)) {
+        return true;
+    }
+    std::error_code size_ec;
+    std::uint64_t size = fs::file_size(file_path, ec);
+    if (size != fs::file_size(blob, size_ec) || ec || size_ec) {
+        std::cerr << "Blob " << sha256 << " does not match " << file_path.string() << ", not shared" << std::endl;
+        return false;
+    }
+
+    // Already stored, swap the file for another name of the blob (released meanwhile: a new one next time)
+    fs::path link = file_path.parent_path() / (".pacprism-" + file_path.filename().string() + ".link");
+    fs::remove(link, ec);
+    fs::create_hard_link(blob, link, ec);
+    if (ec) {
+        return false;
+    }
+    fs::rename(link, file_path, ec);
+    if (ec) {
+        fs::remove(link, ec);
+        return false;
+    }
+    m_linked_bytes.fetch_add(size, std::memory_order_relaxed);
+    return true;
+}
+
+void BlobStore::release(const std::string& sha256) {
+    if (sha256.size() < 2) {
+        return;
+    }
+    fs::path blob = blob_path(sha256);
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    std::error_code ec;
+    std::uint64_t size = fs::file_size(blob, ec);
+    if (ec) {
+        return;
+    }
+    subtract(m_linked_bytes, size);
+    if (fs::hard_link_count(blob, ec) == 1 && !ec && fs::remove(blob, ec)) {
+        subtract(m_blobs, 1);
+        subtract(m_stored_bytes, size);
+    }
+}
+
+bool BlobStore::discard(const std::string& sha256, const fs::path& file_path) {
+    if (sha256.size() < 2) {
+        return false;
+    }
+    fs::path blob = blob_path(sha256);
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    std::error_code ec;
+    if (!fs::equivalent(blob, file_path, ec)) {
+        return false;
+    }
+    std::uint64_t size = fs::file_size(blob, ec);
+    std::uint64_t links = fs::hard_link_count(blob, ec);
+    if (ec || !fs::remove(blob, ec)) {
+        return false;
+    }
+    subtract(m_blobs, 1);
+    subtract(m_stored_bytes, size);
+    subtract(m_linked_bytes, size * (links - 1));
+    return true;
+}
+
+std::size_t BlobStore::collect() {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    std::size_t removed = 0;
+    stats counted;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(m_root, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        std::error_code file_ec;
+        if (!it->is_regular_file(file_ec)) {
+            continue;
+        }
+        std::uint64_t size = it->file_size(file_ec);
+        std::uint64_t links = it->hard_link_count(file_ec);
+        if (file_ec) {
+            continue;
+        }
+        if (links == 1) {
+            removed += fs::remove(it->path(), file_ec);
+            continue;
+        }
+        counted.blobs++;
+        counted.stored_bytes += size;
+        counted.linked_bytes += size * (links - 1);
+    }
+    m_blobs.store(counted.blobs, std::memory_order_relaxed);
+    m_stored_bytes.store(counted.stored_bytes, std::memory_order_relaxed);
+    m_linked_bytes.store(counted.linked_bytes, std::memory_order_relaxed);
+    return removed;
+}
+
+BlobStore::stats BlobStore::get_stats() const {
+    stats result;
+    result.blobs = m_blobs.load(std::memory_order_relaxed);
+    result.stored_bytes = m_stored_bytes.load(std::memory_order_relaxed);
+    result.linked_bytes = m_linked_bytes.load(std::memory_order_relaxed);
+    return result;
+}
+
+void BlobStore::subtract(std::atomic<std::uint64_t>& counter, std::uint64_t amount) {
+    std::uint64_t current = counter.load(std::memory_order_relaxed);
+    while (!counter.compare_exchange_weak(current, current > amount ? current - amount : 0,
+                                          std::memory_order_relaxed)) {
+    }
+}
@@ -0,0 +1,47 @@
+#include <sstream>
+#include <algorithm>
+
+#include <fnmatch.h>
+
+#include <console/io/cache_policy.hpp>
+
+// CachePolicy implementation
+
+CachePolicy::CachePolicy(const std::string& patterns, std::chrono::seconds ttl) {
+    std::string list = patterns;
+    std::replace(list.begin(), list.end(), ',', ' ');
+    std::istringstream fields(list);
+    std::string field;
+    while (fields >> field) {
+        rule entry{field, ttl};
+        std::size_t colon = field.rfind(':');
+        if (colon != std::string::npos) {
+            entry.pattern = field.substr(0, colon);
+            try {
+                entry.ttl = std::chrono::seconds(std::stoll(field.substr(colon + 1)));
+            } catch (...) {
+                entry.ttl = ttl; // Default to the common TTL
+            }
+        }
+        if (!entry.pattern.empty()) {
+            m_rules.push_back(std::move(entry));
+        }
+    }
+}
+
+bool CachePolicy::enabled() const {
+    return std::any_of(m_rules.begin(), m_rules.end(), [](const rule& entry) { return entry.ttl.count() > 0; });
+}
+
+std::optional<std::chrono::seconds> CachePolicy::ttl(const std::string& request_path) const {
+    for (const auto& entry : m_rules) {
+        if (fnmatch(entry.pattern.c_str(), request_path.c_str(), 0) == 0) {
+            // A zero TTL keeps matching paths immutable
+            if (entry.ttl.count() <= 0) {
+                return std::nullopt;
+            }
+            return entry.ttl;
+        }
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,219 @@
+#include <iostream>
+#include <algorithm>
+
+#include <console/io/io.hpp>
+#include <console/io/eviction.hpp>
+#include <console/io/admission.hpp>
+
+// Helper: least recently used first, fewer hits break ties
+static bool older_than(const eviction_candidate& a, const eviction_candidate& b) {
+    if (a.last_access != b.last_access) {
+        return a.last_access < b.last_access;
+    }
+    return a.hit_count < b.hit_count;
+}
+
+std::vector<eviction_candidate> order_victims(std::vector<eviction_candidate> candidates,
+                                              eviction_policy policy,
+                                              std::uint64_t protected_bytes) {
+    if (policy == eviction_policy::lru) {
+        std::sort(candidates.begin(), candidates.end(), older_than);
+        return candidates;
+    }
+
+    // Split into probation (hit at most once) and protected (hit again)
+    std::vector<eviction_candidate> probation;
+    std::vector<eviction_candidate> protected_segment;
+    for (auto& candidate : candidates) {
+        if (candidate.hit_count >= 2) {
+            protected_segment.push_back(std::move(candidate));
+        } else {
+            probation.push_back(std::move(candidate));
+        }
+    }
+
+    // Keep the most recent protected files that fit, demote the rest to probation
+    std::sort(protected_segment.begin(), protected_segment.end(),
+              [](const auto& a, const auto& b) { return older_than(b, a); });
+    std::uint64_t kept_bytes = 0;
+    std::size_t kept = 0;
+    while (kept < protected_segment.size() && kept_bytes + protected_segment[kept].size <= protected_bytes) {
+        kept_bytes += protected_segment[kept].size;
+        kept++;
+    }
+    std::move(protected_segment.begin() + kept, protected_segment.end(), std::back_inserter(probation));
+    protected_segment.resize(kept);
+
+    std::sort(probation.begin(), probation.end(), older_than);
+    std::sort(protected_segment.begin(), protected_segment.end(), older_than);
+    std::move(protected_segment.begin(), protected_segment.end(), std::back_inserter(probation));
+    return probation;
+}
+
+std::vector<eviction_candidate> order_victims_tinylfu(std::vector<eviction_candidate> candidates,
+                                                      const FrequencySketch& sketch,
+                                                      std::uint64_t window_bytes,
+                                                      std::uint64_t protected_bytes) {
+    // Files hit again were admitted to the main segment, the rest are still in the window
+    std::vector<eviction_candidate> window;
+    std::vector<eviction_candidate> main_segment;
+    for (auto& candidate : candidates) {
+        if (candidate.hit_count >= 2) {
+            main_segment.push_back(std::move(candidate));
+        } else {
+            window.push_back(std::move(candidate));
+        }
+    }
+
+    // The most recent window files stay in the window, older ones ask for admission
+    std::sort(window.begin(), window.end(), [](const auto& a, const auto& b) { return older_than(b, a); });
+    std::uint64_t kept_bytes = 0;
+    std::size_t kept = 0;
+    while (kept < window.size() && kept_bytes + window[kept].size <= window_bytes) {
+        kept_bytes += window[kept].size;
+        kept++;
+    }
+    std::vector<eviction_candidate> admission(std::make_move_iterator(window.begin() + kept),
+                                              std::make_move_iterator(window.end()));
+    window.resize(kept);
+    std::reverse(admission.begin(), admission.end());
+
+    auto main_victims = order_victims(std::move(main_segment), eviction_policy::slru, protected_bytes);
+
+    // Each duel gives up the less popular of the oldest newcomer and the next main victim
+    std::vector<eviction_candidate> victims;
+    std::size_t next_candidate = 0;
+    std::size_t next_victim = 0;
+    while (next_candidate < admission.size() && next_victim < main_victims.size()) {
+        if (sketch.estimate(admission[next_candidate].request_path) >
+            sketch.estimate(main_victims[next_victim].request_path)) {
+            victims.push_back(std::move(main_victims[next_victim++]));
+        } else {
+            victims.push_back(std::move(admission[next_candidate++]));
+        }
+    }
+    std::move(admission.begin() + next_candidate, admission.end(), std::back_inserter(victims));
+    std::move(main_victims.begin() + next_victim, main_victims.end(), std::back_inserter(victims));
+
+    // The window itself goes last, oldest first
+    std::move(window.rbegin(), window.rend(), std::back_inserter(victims));
+    return victims;
+}
+
+// CacheEvictor implementation
+
+CacheEvictor::CacheEvictor(FileCache& cache,
+                           std::uint64_t max_bytes,
+                           double high_watermark,
+                           double low_watermark,
+                           eviction_policy policy,
+                           std::chrono::seconds interval,
+                           const FrequencySketch* sketch)
+    : m_cache(cache),
+      m_max_bytes(max_bytes),
+      m_high_watermark(high_watermark),
+      m_low_watermark(std::min(low_watermark, high_watermark)),
+      m_policy(policy),
+      m_interval(interval),
+      m_sketch(sketch) {}
+
+CacheEvictor::~CacheEvictor() {
+    stop();
+}
+
+void CacheEvictor::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_thread.joinable()) {
+        return;
+    }
+    m_stopping = false;
+    m_thread = std::thread([this]() { run(); });
+}
+
+void CacheEvictor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void CacheEvictor::notify() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_notified = true;
+    }
+    m_cv.notify_all();
+}
+
+std::uint64_t CacheEvictor::high_bytes() const {
+    return static_cast<std::uint64_t>(m_max_bytes * m_high_watermark);
+}
+
+std::uint64_t CacheEvictor::low_bytes() const {
+    return static_cast<std::uint64_t>(m_max_bytes * m_low_watermark);
+}
+
+void CacheEvictor::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        m_cv.wait_for(lock, m_interval, [this]() { return m_stopping || m_notified; });
+        if (m_stopping) {
+            break;
+        }
+        m_notified = false;
+
+        // Evict without holding our lock, notify() must never wait for a pass
+        lock.unlock();
+        run_once();
+        lock.lock();
+    }
+}
+
+std::size_t CacheEvictor::run_once() {
+    std::uint64_t used = m_cache.get_cached_bytes();
+    if (m_max_bytes == 0 || used <= high_bytes()) {
+        return 0;
+    }
+
+    // Snapshot the index, recency and hit counts are read once per pass
+    std::vector<eviction_candidate> candidates;
+    m_cache.get_index().for_each([&candidates](const std::string& request_path, const cache_entry& entry) {
+        candidates.push_back({request_path,
+                              entry.size,
+                              entry.access->last_access.load(std::memory_order_relaxed),
+                              entry.access->hit_count.load(std::memory_order_relaxed)});
+    });
+
+    // Protected segment gets 80% of the budget, as in the classic SLRU split
+    std::vector<eviction_candidate> victims;
+    if (m_policy == eviction_policy::tinylfu && m_sketch) {
+        victims = order_victims_tinylfu(std::move(candidates), *m_sketch,
+                                        static_cast<std::uint64_t>(m_max_bytes * window_fraction),
+                                        low_bytes() * 4 / 5);
+    } else {
+        victims = order_victims(std::move(candidates), m_policy, low_bytes() * 4 / 5);
+    }
+
+    std::size_t evicted = 0;
+    std::uint64_t evicted_bytes = 0;
+    for (const auto& victim : victims) {
+        if (used <= low_bytes()) {
+            break;
+        }
+        if (m_cache.evict(victim.request_path)) {
+            used -= std::min(used, victim.size);
+            evicted++;
+            evicted_bytes += victim.size;
+        }
+    }
+
+    m_evicted_files += evicted;
+    m_evicted_bytes += evicted_bytes;
+    std::cout << "Evicted " << evicted << " files (" << evicted_bytes << " bytes), cache now "
+              << m_cache.get_cached_bytes() << " of " << m_max_bytes << " bytes" << std::endl;
+    return evicted;
+}
@@ -0,0 +1,363 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <format>
+#include <charconv>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+#include <unistd.h>
+
+#include <console/io/index_log.hpp>
+
+namespace fs = std::filesystem;
+
+static constexpr std::string_view index_header = "pacprism-index 2";
+static constexpr std::string_view index_header_v1 = "pacprism-index 1";
+
+// Helper: format a put record, empty if the path cannot be stored in a line
+static std::string format_put(const std::string& request_path, const cache_entry& entry) {
+    if (request_path.find('\n') != std::string::npos) {
+        return "";
+    }
+    // ETags never contain spaces, a malformed one is not worth keeping
+    bool etag = !entry.upstream_etag.empty() && entry.upstream_etag.find_first_of(" \n") == std::string::npos;
+    return std::format("+ {} {} {} {} {} {} {} {}\n",
+        entry.size,
+        static_cast<std::int64_t>(entry.mtime),
+        entry.access->last_access.load(std::memory_order_relaxed),
+        entry.access->hit_count.load(std::memory_order_relaxed),
+        entry.sha256.empty() ? "-" : entry.sha256,
+        etag ? entry.upstream_etag : "-",
+        static_cast<std::int64_t>(entry.upstream_mtime),
+        request_path);
+}
+
+// Helper: split the next space separated field off a record
+static bool next_field(std::string_view& line, std::string_view& field) {
+    auto space = line.find(' ');
+    if (space == std::string_view::npos) {
+        return false;
+    }
+    field = line.substr(0, space);
+    line.remove_prefix(space + 1);
+    return !field.empty();
+}
+
+// Helper: parse an unsigned or signed number field
+template <typename T>
+static bool parse_number(std::string_view field, T& value) {
+    auto [end, ec] = std::from_chars(field.data(), field.data() + field.size(), value);
+    return ec == std::errc() && end == field.data() + field.size();
+}
+
+// Helper: apply one record to the index, false if it is malformed
+static bool apply_record(std::string_view line, MetadataIndex& index, int version) {
+    std::string_view kind;
+    if (!next_field(line, kind) || kind.size() != 1) {
+        return false;
+    }
+
+    if (kind == "-") {
+        if (line.empty()) {
+            return false;
+        }
+        index.erase(std::string(line));
+        return true;
+    }
+    if (kind != "+") {
+        return false;
+    }
+
+    std::string_view size_field, mtime_field, access_field, hits_field, sha_field, etag_field, upstream_field;
+    std::uint64_t size, hits;
+    std::int64_t mtime, last_access, upstream_mtime = 0;
+    if (!next_field(line, size_field) || !parse_number(size_field, size) ||
+        !next_field(line, mtime_field) || !parse_number(mtime_field, mtime) ||
+        !next_field(line, access_field) || !parse_number(access_field, last_access) ||
+        !next_field(line, hits_field) || !parse_number(hits_field, hits) ||
+        !next_field(line, sha_field)) {
+        return false;
+    }
+    if (version >= 2 && (!next_field(line, etag_field) ||
+                         !next_field(line, upstream_field) || !parse_number(upstream_field, upstream_mtime))) {
+        return false;
+    }
+    if (line.empty()) {
+        return false;
+    }
+
+    auto entry = cache_entry::make(size, static_cast<std::time_t>(mtime),
+                                   sha_field == "-" ? "" : std::string(sha_field));
+    // Trusted only after it was checked against the file
+    entry.verified = false;
+    entry.access->last_access = last_access;
+    entry.access->hit_count = hits;
+    if (!etag_field.empty() && etag_field != "-") {
+        entry.upstream_etag = std::string(etag_field);
+    }
+    entry.upstream_mtime = static_cast<std::time_t>(upstream_mtime);
+    index.insert(std::string(line), std::move(entry));
+    return true;
+}
+
+// IndexLog implementation
+
+IndexLog::IndexLog(const std::string& log_path) : m_path(log_path) {}
+
+IndexLog::~IndexLog() {
+    if (m_out) {
+        std::fclose(m_out);
+    }
+}
+
+bool IndexLog::load(MetadataIndex& index) {
+    int version = 0;
+    if (!replay(index, version)) {
+        return false;
+    }
+    // Appends are written in the current format, an older log is rewritten in it first
+    if (version < 2) {
+        std::cout << "Upgrading cache index " << m_path << " to the current format" << std::endl;
+        return compact(index);
+    }
+    return true;
+}
+
+bool IndexLog::replay(MetadataIndex& index, int& version) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::ifstream in(m_path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string content = ss.str();
+
+    auto eol = content.find('\n');
+    std::string_view header = eol == std::string::npos ? std::string_view() : std::string_view(content).substr(0, eol);
+    if (header == index_header) {
+        version = 2;
+    } else if (header == index_header_v1) {
+        version = 1;
+    } else {
+        std::cerr << "Cache index has an unknown format: " << m_path << std::endl;
+        return false;
+    }
+
+    std::size_t pos = eol + 1;
+    m_records = 0;
+    while (pos < content.size()) {
+        eol = content.find('\n', pos);
+        if (eol == std::string::npos) {
+            // Torn append from a crash, cut it off so new records start on a fresh line
+            std::cerr << "Dropping incomplete last record of cache index" << std::endl;
+            std::error_code ec;
+            fs::resize_file(m_path, pos, ec);
+            break;
+        }
+        if (!apply_record(std::string_view(content).substr(pos, eol - pos), index, version)) {
+            std::cerr << "Corrupt cache index record at byte " << pos << ": " << m_path << std::endl;
+            index.clear();
+            return false;
+        }
+        m_records++;
+        pos = eol + 1;
+    }
+    return true;
+}
+
+bool IndexLog::open_for_append() {
+    if (m_out) {
+        return true;
+    }
+
+    std::error_code ec;
+    bool fresh = !fs::exists(m_path, ec) || fs::file_size(m_path, ec) == 0;
+    m_out = std::fopen(m_path.c_str(), "a");
+    if (!m_out) {
+        return false;
+    }
+    if (fresh) {
+        std::fprintf(m_out, "%s\n", index_header.data());
+    }
+    return true;
+}
+
+void IndexLog::write_line(const std::string& line) {
+    if (line.empty()) {
+        return;
+    }
+    if (m_compacting) {
+        m_pending += line;
+        m_pending_records++;
+    }
+    if (!open_for_append()) {
+        return;
+    }
+    // Flushed but not fsynced: the log is a hint that is checked against the files
+    std::fwrite(line.data(), 1, line.size(), m_out);
+    std::fflush(m_out);
+    m_records++;
+}
+
+void IndexLog::append_put(const std::string& request_path, const cache_entry& entry) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_line(format_put(request_path, entry));
+}
+
+void IndexLog::append_erase(const std::string& request_path) {
+    if (request_path.find('\n') != std::string::npos) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_line("- " + request_path + "\n");
+}
+
+bool IndexLog::needs_compaction(std::size_t live_entries) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_records > 2 * live_entries + 1024;
+}
+
+bool IndexLog::compact(const MetadataIndex& index) {
+    std::lock_guard<std::mutex> compaction(m_compact_mutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_compacting = true;
+        m_pending.clear();
+        m_pending_records = 0;
+    }
+
+    std::string temp_path = m_path + ".tmp";
+    std::FILE* out = std::fopen(temp_path.c_str(), "w");
+    if (!out) {
+        std::cerr << "Failed to write cache index: " << temp_path << std::endl;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_compacting = false;
+        return false;
+    }
+
+    // Walked without the log lock, appends meanwhile still go to the old log and are kept
+    // for the new one; write in large blocks, the index can hold millions of entries
+    std::string buffer(index_header);
+    buffer += '\n';
+    std::size_t live = 0;
+    bool ok = true;
+    index.for_each([&](const std::string& request_path, const cache_entry& entry) {
+        buffer += format_put(request_path, entry);
+        live++;
+        if (buffer.size() >= 1024 * 1024) {
+            ok = ok && std::fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+            buffer.clear();
+        }
+    });
+    ok = ok && std::fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+    ok = ok && std::fflush(out) == 0 && ::fsync(fileno(out)) == 0;
+
+    // Records newer than the walk go last, a put the walk already saw is written twice (harmless)
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_compacting = false;
+    ok = ok && std::fwrite(m_pending.data(), 1, m_pending.size(), out) == m_pending.size();
+    ok = ok && std::fflush(out) == 0 && ::fsync(fileno(out)) == 0;
+    std::fclose(out);
+    std::size_t pending = m_pending_records;
+    m_pending.clear();
+    m_pending_records = 0;
+
+    std::error_code ec;
+    if (ok) {
+        fs::rename(temp_path, m_path, ec);
+    }
+    if (!ok || ec) {
+        std::cerr << "Failed to compact cache index: " << m_path << std::endl;
+        fs::remove(temp_path, ec);
+        return false;
+    }
+
+    // Appends go to the new file from now on
+    if (m_out) {
+        std::fclose(m_out);
+        m_out = nullptr;
+    }
+    m_records = live + pending;
+    return true;
+}
+
+std::size_t IndexLog::rescan(const fs::path& cache_dir, MetadataIndex& index, std::size_t worker_count) {
+    // Directories are a shared work queue, workers stop once it is empty and nobody
+    // is still listing a directory that could add more.
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<fs::path> pending{cache_dir};
+    std::size_t busy = 0;
+    std::atomic<std::size_t> found{0};
+
+    auto worker = [&]() {
+        while (true) {
+            fs::path dir;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]() { return !pending.empty() || busy == 0; });
+                if (pending.empty()) {
+                    return;
+                }
+                dir = std::move(pending.front());
+                pending.pop_front();
+                busy++;
+            }
+
+            std::vector<fs::path> subdirs;
+            std::error_code ec;
+            for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+                std::error_code type_ec;
+                if (it->is_symlink(type_ec)) {
+                    continue;
+                }
+                if (it->is_directory(type_ec)) {
+                    // Blob store and other bookkeeping directories
+                    if (!it->path().filename().string().starts_with(".pacprism-")) {
+                        subdirs.push_back(it->path());
+                    }
+                    continue;
+                }
+                // Skip the log and other bookkeeping files
+                if (!it->is_regular_file(type_ec) || it->path().filename().string().starts_with(".pacprism-")) {
+                    continue;
+                }
+
+                auto entry = cache_entry::from_file(it->path().string());
+                if (!entry) {
+                    continue;
+                }
+                // Entries added by fetches meanwhile are newer, keep them
+                std::string request_path = "/" + it->path().lexically_relative(cache_dir).generic_string();
+                if (index.try_insert(request_path, std::move(*entry))) {
+                    found++;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto& subdir : subdirs) {
+                    pending.push_back(std::move(subdir));
+                }
+                busy--;
+            }
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < std::max<std::size_t>(worker_count, 1); i++) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return found.load();
+}
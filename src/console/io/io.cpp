@@ -5,8 +5,13 @@
 #include <iomanip>
 #include <chrono>
 #include <thread>
+#include <cctype>
+#include <map>
+
+#include <sys/stat.h>
 
 #include <console/io/io.hpp>
+#include <node/validator/validator.hpp>
 
 // Boost.Beast HTTP client includes
 #include <boost/beast.hpp>
@@ -95,6 +100,271 @@ int Config::get_read_timeout() const {
     }
 }
 
+std::size_t Config::get_worker_threads() const {
+    std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    std::string value = get("worker_threads", "0");
+    try {
+        std::size_t threads = std::stoull(value);
+        return threads == 0 ? cores : threads; // 0 means one per core
+    } catch (...) {
+        return cores;
+    }
+}
+
+std::size_t Config::get_fetch_buffer_size() const {
+    std::string value = get("fetch_buffer_size", "65536");
+    try {
+        // Never go below what an HTTP header needs
+        return std::max<std::size_t>(std::stoull(value), 8192);
+    } catch (...) {
+        return 65536; // Default to 64KB
+    }
+}
+
+bool Config::get_reuse_port() const {
+    // Default to off, a second instance on the same port would silently share the clients
+    std::string value = get("reuse_port", "false");
+    return value == "true" || value == "1" || value == "yes";
+}
+
+bool Config::get_persistent_index() const {
+    std::string value = get("persistent_index", "true");
+    return value == "true" || value == "1" || value == "yes";
+}
+
+// Helper: parse a byte count with an optional binary K/M/G/T suffix
+static std::uint64_t parse_byte_size(const std::string& value, std::uint64_t default_value) {
+    try {
+        std::size_t pos = 0;
+        std::uint64_t bytes = std::stoull(value, &pos);
+        switch (pos < value.size() ? std::toupper(static_cast<unsigned char>(value[pos])) : 0) {
+            case 'T': bytes <<= 10; [[fallthrough]];
+            case 'G': bytes <<= 10; [[fallthrough]];
+            case 'M': bytes <<= 10; [[fallthrough]];
+            case 'K': bytes <<= 10; break;
+            default: break;
+        }
+        return bytes;
+    } catch (...) {
+        return default_value;
+    }
+}
+
+std::uint64_t Config::get_cache_max_bytes() const {
+    return parse_byte_size(get("cache_max_bytes", "0"), 0); // Default to unbounded
+}
+
+std::uint64_t Config::get_memory_tier_bytes() const {
+    return parse_byte_size(get("memory_tier_bytes", "64M"), 64 * 1024 * 1024); // Default to 64MB
+}
+
+std::uint64_t Config::get_memory_tier_max_object() const {
+    return parse_byte_size(get("memory_tier_max_object", "1M"), 1024 * 1024); // Default to 1MB
+}
+
+int Config::get_memory_tier_min_hits() const {
+    std::string value = get("memory_tier_min_hits", "2");
+    try {
+        return std::max(0, std::stoi(value));
+    } catch (...) {
+        return 2; // Default to the third request
+    }
+}
+
+double Config::get_cache_high_watermark() const {
+    std::string value = get("cache_high_watermark", "0.90");
+    try {
+        return std::clamp(std::stod(value), 0.01, 1.0);
+    } catch (...) {
+        return 0.90; // Default to 90%
+    }
+}
+
+double Config::get_cache_low_watermark() const {
+    std::string value = get("cache_low_watermark", "0.80");
+    try {
+        // Never above the high watermark
+        return std::clamp(std::stod(value), 0.0, get_cache_high_watermark());
+    } catch (...) {
+        return std::min(0.80, get_cache_high_watermark()); // Default to 80%
+    }
+}
+
+eviction_policy Config::get_eviction_policy() const {
+    std::string value = get("eviction_policy", "tinylfu");
+    if (value == "lru") {
+        return eviction_policy::lru;
+    }
+    if (value == "slru") {
+        return eviction_policy::slru;
+    }
+    return eviction_policy::tinylfu;
+}
+
+int Config::get_eviction_interval() const {
+    std::string value = get("eviction_interval", "10");
+    try {
+        return std::max(1, std::stoi(value));
+    } catch (...) {
+        return 10; // Default to 10 seconds
+    }
+}
+
+bool Config::get_zero_copy() const {
+    std::string value = get("zero_copy", "true");
+    return value == "true" || value == "1" || value == "yes";
+}
+
+std::string Config::get_io_engine() const {
+    std::string value = get("io_engine", "epoll");
+    return value == "io_uring" ? value : "epoll";
+}
+
+std::size_t Config::get_upstream_max_connections() const {
+    std::string value = get("upstream_max_connections", "8");
+    try {
+        return std::max<std::size_t>(std::stoull(value), 1);
+    } catch (...) {
+        return 8; // Default to 8 connections per host
+    }
+}
+
+int Config::get_upstream_idle_timeout() const {
+    std::string value = get("upstream_idle_timeout", "30");
+    try {
+        return std::max(0, std::stoi(value));
+    } catch (...) {
+        return 30; // Default to 30 seconds
+    }
+}
+
+int Config::get_upstream_dns_ttl() const {
+    std::string value = get("upstream_dns_ttl", "60");
+    try {
+        return std::max(0, std::stoi(value));
+    } catch (...) {
+        return 60; // Default to 60 seconds
+    }
+}
+
+bool Config::get_upstream_keep_alive() const {
+    std::string value = get("upstream_keep_alive", "true");
+    return value == "true" || value == "1" || value == "yes";
+}
+
+int Config::get_mirror_probe_interval() const {
+    std::string value = get("mirror_probe_interval", "30");
+    try {
+        return std::max(1, std::stoi(value));
+    } catch (...) {
+        return 30; // Default to 30 seconds
+    }
+}
+
+std::uint64_t Config::get_segment_threshold() const {
+    return parse_byte_size(get("segment_threshold", "64M"), 64 * 1024 * 1024); // Default to 64MB
+}
+
+std::uint64_t Config::get_segment_size() const {
+    // Smaller ranges cost more in requests than they gain in parallelism
+    return std::max<std::uint64_t>(parse_byte_size(get("segment_size", "8M"), 8 * 1024 * 1024), 64 * 1024);
+}
+
+std::size_t Config::get_segment_parallelism() const {
+    std::string value = get("segment_parallelism", "4");
+    try {
+        return std::max<std::size_t>(std::stoull(value), 1);
+    } catch (...) {
+        return 4; // Default to 4 connections per file
+    }
+}
+
+bool Config::get_commit_fsync() const {
+    std::string value = get("commit_fsync", "true");
+    return value == "true" || value == "1" || value == "yes";
+}
+
+int Config::get_resume_max_age() const {
+    std::string value = get("resume_max_age", "86400");
+    try {
+        return std::max(0, std::stoi(value));
+    } catch (...) {
+        return 86400; // Default to one day
+    }
+}
+
+std::size_t Config::get_negative_cache_entries() const {
+    std::string value = get("negative_cache_entries", "10000");
+    try {
+        return std::stoull(value);
+    } catch (...) {
+        return 10000; // Default to 10000 paths
+    }
+}
+
+int Config::get_negative_ttl() const {
+    std::string value = get("negative_ttl", "300");
+    try {
+        return std::max(0, std::stoi(value));
+    } catch (...) {
+        return 300; // Default to 5 minutes
+    }
+}
+
+int Config::get_negative_error_ttl() const {
+    std::string value = get("negative_error_ttl", "10");
+    try {
+        return std::max(0, std::stoi(value));
+    } catch (...) {
+        return 10; // Default to 10 seconds
+    }
+}
+
+std::string Config::get_metadata_paths() const {
+    return get("metadata_paths", "*/dists/* *.db *.db.sig *.files *.files.sig");
+}
+
+int Config::get_metadata_ttl() const {
+    std::string value = get("metadata_ttl", "300");
+    try {
+        return std::max(0, std::stoi(value));
+    } catch (...) {
+        return 300; // Default to 5 minutes
+    }
+}
+
+bool Config::get_dedup() const {
+    std::string value = get("dedup", "true");
+    return value == "true" || value == "1" || value == "yes";
+}
+
+bool Config::get_verify_downloads() const {
+    std::string value = get("verify_downloads", "true");
+    return value == "true" || value == "1" || value == "yes";
+}
+
+int Config::get_scrub_interval() const {
+    std::string value = get("scrub_interval", "604800");
+    try {
+        return std::max(0, std::stoi(value));
+    } catch (...) {
+        return 604800; // Default to weekly
+    }
+}
+
+std::size_t Config::get_scrub_threads() const {
+    std::string value = get("scrub_threads", "2");
+    try {
+        return std::max(1, std::stoi(value));
+    } catch (...) {
+        return 2; // Default to 2 threads
+    }
+}
+
+std::uint64_t Config::get_scrub_rate() const {
+    return parse_byte_size(get("scrub_rate", "32M"), 32 * 1024 * 1024); // Default to 32MB/s
+}
+
 std::string Config::trim(const std::string& str) {
     size_t first = str.find_first_not_of(" \t\r\n");
     if (first == std::string::npos) {
@@ -138,9 +408,89 @@ bool Config::parse_line(const std::string& line) {
 
 // FileCache Implementation
 
+// Helper: frequency sketch width for a cache budget, one counter per 256KB (an average
+// .deb is larger), at least 64K paths for an unbounded cache and at most 4M
+static std::size_t sketch_items(std::uint64_t max_bytes) {
+    if (max_bytes == 0) {
+        return 64 * 1024;
+    }
+    return static_cast<std::size_t>(std::clamp<std::uint64_t>(max_bytes / (256 * 1024), 1024, 4 * 1024 * 1024));
+}
+
 FileCache::FileCache(const Config& config, const std::string& cache_dir, const std::string& upstream_host)
-    : m_config(config), m_cache_dir(cache_dir), m_upstream_host(upstream_host) {
+    : m_config(config), m_cache_dir(cache_dir),
+      m_sketch(sketch_items(config.get_cache_max_bytes())),
+      m_memory(config.get_memory_tier_bytes(), config.get_memory_tier_max_object()),
+      m_memory_min_hits(config.get_memory_tier_min_hits()),
+      m_upstream_pool(config.get_upstream_max_connections(),
+                      std::chrono::seconds(config.get_upstream_idle_timeout()),
+                      std::chrono::seconds(config.get_upstream_dns_ttl()),
+                      config.get_upstream_keep_alive()),
+      m_mirrors(upstream_host, std::chrono::seconds(config.get_mirror_probe_interval())),
+      m_negative(config.get_negative_cache_entries(),
+                 std::chrono::seconds(config.get_negative_ttl()),
+                 std::chrono::seconds(config.get_negative_error_ttl())),
+      m_policy(config.get_metadata_paths(), std::chrono::seconds(config.get_metadata_ttl())),
+      m_disk_pool(std::max(2u, std::thread::hardware_concurrency() / 2)),
+      m_blobs(std::make_unique<BlobStore>(m_cache_dir / BlobStore::dir_name)) {
     ensure_cache_dir();
+    load_index();
+    m_mirrors.start();
+
+    // Staging files of fetches a crash or restart cut off, removed in the background
+    m_cleanup_thread = std::thread([this]() {
+        clean_staging_files();
+        load_package_indexes();
+    });
+
+    if (m_log || m_policy.enabled() || m_config.get_dedup() || m_config.get_verify_downloads()) {
+        m_background_work.emplace(m_background_context.get_executor());
+        m_background_thread = std::thread([this]() { m_background_context.run(); });
+    }
+
+    // Re-hash the cached files now and then, slowly
+    if (m_config.get_scrub_interval() > 0) {
+        m_scrubber = std::make_unique<CacheScrubber>(*this, m_config.get_scrub_threads(), m_config.get_scrub_rate(),
+                                                     std::chrono::seconds(m_config.get_scrub_interval()));
+        m_scrubber->start();
+    }
+
+    // Bounded cache, evict in the background
+    std::uint64_t max_bytes = m_config.get_cache_max_bytes();
+    if (max_bytes > 0) {
+        m_evictor = std::make_unique<CacheEvictor>(*this, max_bytes,
+                                                   m_config.get_cache_high_watermark(),
+                                                   m_config.get_cache_low_watermark(),
+                                                   m_config.get_eviction_policy(),
+                                                   std::chrono::seconds(m_config.get_eviction_interval()),
+                                                   &m_sketch);
+        m_evictor->start();
+    }
+}
+
+FileCache::~FileCache() {
+    // Commits already handed to the disk pool finish first
+    m_disk_pool.join();
+
+    // Revalidations still running are abandoned, the cached copies stay (and are not deduplicated)
+    m_background_work.reset();
+    m_background_context.stop();
+    if (m_background_thread.joinable()) {
+        m_background_thread.join();
+    }
+
+    if (m_evictor) {
+        m_evictor->stop();
+    }
+    if (m_scrubber) {
+        m_scrubber->stop();
+    }
+    wait_for_index();
+
+    // Persist access statistics for the next start
+    if (m_log && fs::exists(m_cache_dir)) {
+        m_log->compact(m_index);
+    }
 }
 
 void FileCache::ensure_cache_dir() {
@@ -154,8 +504,174 @@ void FileCache::ensure_cache_dir() {
 }
 
 void FileCache::set_cache_dir(const std::string& cache_dir) {
+    wait_for_index();
     m_cache_dir = cache_dir;
+    m_blobs = std::make_unique<BlobStore>(m_cache_dir / BlobStore::dir_name);
     ensure_cache_dir();
+    m_index.clear();
+    load_index();
+    m_cleanup_thread = std::thread([this]() {
+        clean_staging_files();
+        load_package_indexes();
+    });
+}
+
+void FileCache::load_index() {
+    m_log.reset();
+    if (!m_config.get_persistent_index()) {
+        return;
+    }
+
+    m_log = std::make_unique<IndexLog>((m_cache_dir / IndexLog::file_name).string());
+    auto start = std::chrono::steady_clock::now();
+    if (m_log->load(m_index)) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << "Loaded " << m_index.size() << " cache index entries in " << elapsed.count() << "ms" << std::endl;
+        return;
+    }
+
+    // A new cache has nothing to scan
+    std::error_code ec;
+    if (fs::is_empty(m_cache_dir, ec) && !ec) {
+        m_log->compact(m_index);
+        return;
+    }
+
+    // Files are found lazily until the rescan is done, so startup does not wait for it
+    std::cout << "Cache index missing or corrupt, rescanning " << m_cache_dir.string() << " in the background..." << std::endl;
+    m_rescan_thread = std::thread([this]() {
+        std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
+        std::size_t found = IndexLog::rescan(m_cache_dir, m_index, workers);
+        m_log->compact(m_index);
+        std::cout << "Cache index rebuilt with " << found << " files" << std::endl;
+    });
+}
+
+void FileCache::wait_for_disk_work() {
+    m_disk_pool.join();
+}
+
+void FileCache::wait_for_index() {
+    if (m_rescan_thread.joinable()) {
+        m_rescan_thread.join();
+    }
+    if (m_cleanup_thread.joinable()) {
+        m_cleanup_thread.join();
+    }
+}
+
+void FileCache::clean_staging_files() {
+    auto start = std::chrono::steady_clock::now();
+    auto now = fs::file_time_type::clock::now();
+    auto max_age = std::chrono::seconds(m_config.get_resume_max_age());
+    std::size_t removed = 0;
+    std::size_t kept = 0;
+
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(m_cache_dir, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name == BlobStore::dir_name) {
+            it.disable_recursion_pending();
+            continue;
+        }
+        // Link a blob swap did not rename into place
+        if (name.starts_with(".pacprism-") && name.ends_with(".link")) {
+            std::error_code fs_ec;
+            fs::remove(it->path(), fs_ec);
+            continue;
+        }
+        bool part = name.ends_with(".part");
+        if (!name.starts_with(".pacprism-") || !(part || name.ends_with(".resume"))) {
+            continue;
+        }
+        std::string target = name.substr(10, name.size() - 10 - (part ? 5 : 7));
+        fs::path dir = it->path().parent_path();
+        fs::path part_path = dir / (".pacprism-" + target + ".part");
+        fs::path resume_path = dir / (".pacprism-" + target + ".resume");
+        std::error_code fs_ec;
+        std::string request_path = "/" + fs::relative(dir / target, m_cache_dir, fs_ec).generic_string();
+
+        // Holding the in-flight lock keeps a fetch of the path from picking the files up meanwhile
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        if (m_in_flight.contains(request_path)) {
+            continue;
+        }
+        if (!part && fs::exists(part_path, fs_ec)) {
+            // Decided together with its partial file
+            continue;
+        }
+        // A partial body with its validator is continued by the next miss, unless it is stale
+        if (part && fs::exists(resume_path, fs_ec)) {
+            auto mtime = fs::last_write_time(part_path, fs_ec);
+            if (!fs_ec && now - mtime < max_age) {
+                kept++;
+                continue;
+            }
+        }
+        removed += fs::remove(part_path, fs_ec);
+        fs::remove(resume_path, fs_ec);
+    }
+
+    if (removed > 0 || kept > 0) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << "Removed " << removed << " unfinished downloads, kept " << kept
+                  << " to resume (" << elapsed.count() << "ms)" << std::endl;
+    }
+
+    // Blobs whose last path went while the cache was not running
+    std::size_t blobs = get_blob_store().collect();
+    if (blobs > 0) {
+        std::cout << "Removed " << blobs << " unreferenced blobs" << std::endl;
+    }
+}
+
+void FileCache::index_put(const std::string& request_path, cache_entry entry) const {
+    m_memory.erase(request_path);
+    // Indexed before it is logged, so a compaction in between cannot write a log without it
+    if (m_log) {
+        m_index.insert(request_path, entry);
+        m_log->append_put(request_path, entry);
+    } else {
+        m_index.insert(request_path, std::move(entry));
+    }
+    // Rewriting the log takes a while, never on the thread that happened to insert
+    if (m_log && m_log->needs_compaction(m_index.size()) && !m_compacting.exchange(true)) {
+        net::post(m_background_context, [this]() {
+            m_log->compact(m_index);
+            m_compacting = false;
+        });
+    }
+    // Grew past the high watermark, don't wait for the next periodic pass
+    if (m_evictor && m_index.total_bytes() > m_evictor->high_bytes()) {
+        m_evictor->notify();
+    }
+}
+
+void FileCache::index_erase(const std::string& request_path) const {
+    m_memory.erase(request_path);
+    if (m_index.erase(request_path) && m_log) {
+        m_log->append_erase(request_path);
+    }
+}
+
+std::shared_ptr<const cache_entry> FileCache::verify_entry(const std::string& request_path, const cache_entry& loaded) const {
+    auto current = cache_entry::from_file(get_cache_path(request_path));
+    if (!current) {
+        // Gone while we were not running
+        index_erase(request_path);
+        return nullptr;
+    }
+
+    if (current->size == loaded.size && current->mtime == loaded.mtime) {
+        // Unchanged since it was logged, keep its hash and access history
+        cache_entry entry = loaded;
+        entry.verified = true;
+        m_index.insert(request_path, std::move(entry));
+    } else {
+        index_put(request_path, std::move(*current));
+    }
+    return m_index.lookup(request_path);
 }
 
 std::string FileCache::get_cache_path(const std::string& request_path) const {
@@ -168,128 +684,614 @@ std::string FileCache::get_cache_path(const std::string& request_path) const {
 }
 
 bool FileCache::is_cached(const std::string& request_path) const {
+    return get_entry(request_path) != nullptr;
+}
+
+std::shared_ptr<const cache_entry> FileCache::get_entry(const std::string& request_path) const {
+    // Downloads are renamed into place complete and indexed before they leave the in-flight
+    // table, so an indexed hit needs no lock
+    auto entry = m_index.lookup(request_path);
+    if (entry && entry->verified) {
+        return entry;
+    }
+
+    // A path that is still being downloaded is not cached yet, one being revalidated is
+    // served as it is on disk but left for the refresh to index
+    bool revalidating = false;
+    {
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        if (m_in_flight.contains(request_path)) {
+            if (!m_revalidating.contains(request_path)) {
+                return nullptr;
+            }
+            revalidating = true;
+        }
+    }
+
+    if (entry && !revalidating) {
+        return verify_entry(request_path, *entry);
+    }
+
+    // Not indexed yet (cached by an earlier run), stat it once
+    auto found = cache_entry::from_file(get_cache_path(request_path));
+    if (!found) {
+        return nullptr;
+    }
+    if (revalidating) {
+        return std::make_shared<const cache_entry>(std::move(*found));
+    }
+    index_put(request_path, std::move(*found));
+    return m_index.lookup(request_path);
+}
+
+bool FileCache::evict(const std::string& request_path) {
+    // Holding the in-flight lock keeps a new fetch of the path from starting meanwhile
+    std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+    auto entry = m_index.lookup(request_path);
+    if (m_in_flight.contains(request_path) || !entry) {
+        return false;
+    }
+
+    // Unindex first, so new requests miss instead of finding a vanished file
+    index_erase(request_path);
+    std::error_code ec;
+    fs::remove(get_cache_path(request_path), ec);
+    if (ec) {
+        std::cerr << "Failed to remove evicted file: " << get_cache_path(request_path) << " - " << ec.message() << std::endl;
+    }
+    // The last path of a blob takes the blob along
+    if (!entry->sha256.empty()) {
+        get_blob_store().release(entry->sha256);
+    }
+    return true;
+}
+
+bool FileCache::check_scrubbed(const std::string& request_path, const std::shared_ptr<const cache_entry>& checked,
+                               const std::string& sha256) {
+    std::string expected = checked->sha256;
+    if (expected.empty()) {
+        if (auto listed = m_packages.lookup(request_path)) {
+            expected = listed->sha256;
+        }
+    }
+
+    // With dedup the damaged inode may also be cached under other paths of the digest
+    std::vector<std::string> siblings;
+    if (!expected.empty() && expected != sha256 && !checked->sha256.empty()) {
+        m_index.for_each([&](const std::string& path, const cache_entry& entry) {
+            if (path != request_path && entry.sha256 == checked->sha256) {
+                siblings.push_back(path);
+            }
+        });
+    }
+
+    // Holding the in-flight lock keeps fetches and eviction of the path out meanwhile
+    std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+    if (m_in_flight.contains(request_path) || m_index.lookup(request_path) != checked) {
+        return false;
+    }
+    if (expected.empty() || expected == sha256) {
+        if (checked->sha256.empty()) {
+            cache_entry recorded = *checked;
+            recorded.sha256 = sha256;
+            index_put(request_path, std::move(recorded));
+        }
+        return false;
+    }
+
+    std::cerr << "Cached file " << request_path << " is corrupt (expected " << expected << ", got " << sha256
+              << "), moving it to quarantine" << std::endl;
+    index_erase(request_path);
     std::string cache_path = get_cache_path(request_path);
-    return fs::exists(cache_path) && fs::is_regular_file(cache_path);
+    struct stat corrupt;
+    bool known = ::stat(cache_path.c_str(), &corrupt) == 0;
+    fs::path target = m_cache_dir / CacheScrubber::quarantine_dir / request_path.substr(1);
+    std::error_code ec;
+    fs::create_directories(target.parent_path(), ec);
+    fs::rename(cache_path, target, ec);
+    if (ec) {
+        fs::remove(cache_path, ec);
+    }
+
+    // Never share the damaged bytes with a new download of the same digest
+    if (!checked->sha256.empty()) {
+        get_blob_store().discard(checked->sha256, target);
+    }
+
+    // Other names of the same inode hold the same damaged bytes
+    for (const auto& sibling : siblings) {
+        auto entry = m_index.lookup(sibling);
+        std::string sibling_path = get_cache_path(sibling);
+        struct stat current;
+        if (!known || m_in_flight.contains(sibling) || !entry || entry->sha256 != checked->sha256 ||
+            ::stat(sibling_path.c_str(), &current) != 0 ||
+            current.st_ino != corrupt.st_ino || current.st_dev != corrupt.st_dev) {
+            continue;
+        }
+        std::cerr << "Cached file " << sibling << " links the corrupt file, removing it" << std::endl;
+        index_erase(sibling);
+        fs::remove(sibling_path, ec);
+    }
+    return true;
+}
+
+void FileCache::invalidate(const std::string& request_path) {
+    index_erase(request_path);
+    m_negative.erase(request_path);
 }
 
 std::string FileCache::build_upstream_url(const std::string& request_path) const {
     // Remove leading slash if present
     std::string clean_path = (request_path[0] == '/') ? request_path.substr(1) : request_path;
-    return "http://" + m_upstream_host + "/" + clean_path;
+    return "http://" + m_mirrors.host(m_mirrors.select().value_or(0)) + "/" + clean_path;
+}
+
+std::shared_ptr<const cache_entry> FileCache::ensure_entry(const std::string& request_path) {
+    m_sketch.increment(request_path);
+    auto entry = get_entry(request_path);
+    if (!entry) {
+        std::cout << "Cache miss for: " << request_path << ", fetching from upstream..." << std::endl;
+        if (!fetch_from_upstream(request_path)) {
+            std::cerr << "Failed to fetch: " << request_path << std::endl;
+            return nullptr;
+        }
+        entry = get_entry(request_path);
+        if (!entry) {
+            return nullptr;
+        }
+    } else {
+        revalidate_if_stale(request_path, *entry);
+    }
+
+    // Count the access for eviction and statistics
+    entry->touch();
+    return entry;
 }
 
 bool FileCache::fetch_from_upstream(const std::string& request_path) {
-    const int MAX_RETRIES = m_config.get_max_retries();
-    const int CONNECT_TIMEOUT_SECONDS = m_config.get_connect_timeout();
-    const int READ_TIMEOUT_SECONDS = m_config.get_read_timeout();
-
-    for (int retry = 0; retry < MAX_RETRIES; retry++) {
-        try {
-            net::io_context io_ctx;
-
-            // Parse upstream host and port
-            std::string host = m_upstream_host;
-            std::string port = "80";
-            size_t colon_pos = host.find(':');
-            if (colon_pos != std::string::npos) {
-                port = host.substr(colon_pos + 1);
-                host = host.substr(0, colon_pos);
-            }
+    // Run the asynchronous fetch on a private context for synchronous callers
+    net::io_context io_ctx;
+    bool fetched = false;
+    async_fetch_from_upstream(io_ctx.get_executor(), request_path, [&fetched](bool success) {
+        fetched = success;
+    });
+    io_ctx.run();
+    return fetched;
+}
 
-            // Resolve host
-            tcp::resolver resolver(io_ctx);
-            auto const results = resolver.resolve(host, port);
-
-            // Create TCP stream
-            beast::tcp_stream stream(io_ctx);
-
-            // Set connect timeout
-            stream.expires_after(std::chrono::seconds(CONNECT_TIMEOUT_SECONDS));
-
-            // Connect to host
-            stream.connect(results);
-
-            // Set read timeout (reset for read operation)
-            stream.expires_after(std::chrono::seconds(READ_TIMEOUT_SECONDS));
-
-            // Build HTTP request
-            std::string target = (request_path[0] == '/') ? request_path : "/" + request_path;
-            http::request<http::string_body> req{
-                http::verb::get, target, 11
-            };
-            req.set(http::field::host, host);
-            req.set(http::field::user_agent, "pacPrism/0.1.0");
-
-            // Send request
-            http::write(stream, req);
-
-            // Receive response
-            beast::flat_buffer buffer;
-            http::response<http::dynamic_body> res;
-            http::read(stream, buffer, res);
-
-            // Check if response is OK
-            if (res.result() != http::status::ok) {
-                std::cerr << "Upstream returned HTTP " << res.result_int()
-                          << " for " << request_path << std::endl;
-                // Don't retry on client errors (4xx), but retry on server errors (5xx)
-                if (res.result_int() >= 400 && res.result_int() < 500) {
-                    return false;
-                }
-                throw std::runtime_error("HTTP error: " + std::to_string(res.result_int()));
-            }
+void FileCache::async_fetch_from_upstream(
+    net::any_io_executor executor,
+    const std::string& request_path,
+    fetch_handler handler
+) {
+    start_or_join_fetch(executor, request_path)->async_wait_done(executor, std::move(handler));
+}
 
-            // Get cache file path
-            std::string cache_path = get_cache_path(request_path);
+std::shared_ptr<FetchProgress> FileCache::start_or_join_fetch(net::any_io_executor executor, const std::string& request_path) {
+    std::shared_ptr<FetchProgress> progress;
+    std::optional<int> failed;
+    {
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        auto it = m_in_flight.find(request_path);
+        if (it != m_in_flight.end()) {
+            // Someone is already downloading this path, follow that fetch
+            std::cout << "Joining in-flight fetch for: " << request_path << std::endl;
+            return it->second;
+        }
 
-            // Create parent directories
-            fs::path file_path(cache_path);
-            fs::create_directories(file_path.parent_path());
+        progress = std::make_shared<FetchProgress>(get_cache_path(request_path));
 
-            // Write response body to file
-            std::ofstream outfile(cache_path, std::ios::binary);
-            if (!outfile) {
-                std::cerr << "Failed to create cache file: " << cache_path << std::endl;
-                return false;
-            }
+        // Failed recently, answer from the negative cache instead of asking upstream again
+        failed = m_negative.lookup(request_path);
+        if (!failed) {
+            m_in_flight.emplace(request_path, progress);
+        }
+    }
+    if (failed) {
+        // Outside the lock and not flushed, a failing path can be asked for hundreds of times a minute
+        std::cout << "Upstream recently failed for: " << request_path << " (HTTP " << *failed << ")\n";
+        progress->set_status(*failed);
+        progress->finish(false);
+        return progress;
+    }
 
-            auto& body = res.body();
-            auto body_data = body.data();
+    auto fetch = UpstreamFetch::create(executor, m_disk_pool.get_executor(), m_config, m_upstream_pool, m_mirrors,
+                                       request_path, progress,
+                                       [this, request_path, progress](bool success) {
+                                           complete_in_flight(request_path, success, progress->snapshot());
+                                       });
+    if (auto expected = m_packages.lookup(request_path)) {
+        fetch->expect_sha256(expected->sha256);
+    }
+    fetch->start();
+    return progress;
+}
 
-            // Write the buffer content to file
-            for (auto const& buffer : body_data) {
-                outfile.write(static_cast<const char*>(buffer.data()), buffer.size());
+void FileCache::complete_in_flight(const std::string& request_path, bool success, const FetchProgress::state& result,
+                                   bool revalidation) {
+    int status = result.status;
+    // Index the new file before it becomes visible, so even the first hit needs no stat
+    if (success && status == 304) {
+        // Upstream confirmed the cached copy, its entry stays as it is
+        std::cout << "Cached copy of " << request_path << " is current" << std::endl;
+    } else if (success) {
+        if (auto entry = cache_entry::from_file(get_cache_path(request_path))) {
+            entry->access->validated.store(std::time(nullptr), std::memory_order_relaxed);
+            entry->sha256 = result.sha256;
+            entry->upstream_etag = result.etag;
+            entry->upstream_mtime = parse_http_date(result.last_modified);
+            auto previous = m_index.lookup(request_path);
+            index_put(request_path, std::move(*entry));
+            // A refreshed file no longer links the blob of the old one
+            if (previous && !previous->sha256.empty()) {
+                get_blob_store().release(previous->sha256);
             }
+        }
+    } else if (revalidation) {
+        // Keep serving what we have, the next hit past the TTL tries again
+        std::cerr << "Failed to revalidate " << request_path << ", keeping the cached copy" << std::endl;
+    } else {
+        index_erase(request_path);
+        m_negative.insert(request_path, status);
+    }
+
+    std::shared_ptr<FetchProgress> progress;
+    {
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        auto it = m_in_flight.find(request_path);
+        if (it == m_in_flight.end()) {
+            return;
+        }
+        progress = it->second;
+        m_in_flight.erase(it);
+        m_revalidating.erase(request_path);
+    }
 
-            outfile.close();
+    // Requests that joined a failed refresh get the cached copy
+    std::error_code ec;
+    if (revalidation && !success && !progress->snapshot().started) {
+        auto size = fs::file_size(get_cache_path(request_path), ec);
+        if (!ec) {
+            progress->relocate(get_cache_path(request_path));
+            progress->start(size);
+            progress->advance(size);
+            success = true;
+        }
+    }
 
-            // Gracefully close connection
-            beast::error_code ec;
-            stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+    // Leave the table first so woken waiters already see the file as cached
+    progress->finish(success);
 
-            std::cout << "Successfully fetched: " << request_path << std::endl;
-            return true;
+    if (success && status != 304 && m_config.get_dedup()) {
+        net::post(m_background_context, [this, request_path]() { store_blob(request_path); });
+    }
+    if (success && status != 304 && m_config.get_verify_downloads() && PackageIndex::is_index(request_path)) {
+        net::post(m_background_context, [this, request_path]() { load_package_index(request_path); });
+    }
+}
 
-        } catch (const beast::system_error& e) {
-            if (retry == MAX_RETRIES - 1) {
-                std::cerr << "Failed to fetch " << request_path
-                          << " after " << MAX_RETRIES << " attempts: " << e.what() << std::endl;
-                return false;
-            }
+void FileCache::revalidate_if_stale(const std::string& request_path, const cache_entry& entry) {
+    auto ttl = m_policy.ttl(request_path);
+    if (!ttl) {
+        return;
+    }
+    std::int64_t now = std::time(nullptr);
+    std::int64_t validated = entry.access->validated.load(std::memory_order_relaxed);
+    if (now - validated < ttl->count()) {
+        return;
+    }
+    // Claim the refresh, concurrent hits see the copy as fresh again
+    if (!entry.access->validated.compare_exchange_strong(validated, now, std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::shared_ptr<FetchProgress> progress;
+    {
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        if (m_in_flight.contains(request_path)) {
+            return;
+        }
+        progress = std::make_shared<FetchProgress>(get_cache_path(request_path));
+        m_in_flight.emplace(request_path, progress);
+        m_revalidating.insert(request_path);
+    }
+
+    std::cout << "Revalidating " << request_path << " with upstream..." << std::endl;
+    auto fetch = UpstreamFetch::create_revalidation(m_background_context.get_executor(), m_disk_pool.get_executor(),
+                                                    m_config, m_upstream_pool, m_mirrors, request_path, progress,
+                                                    entry.upstream_mtime ? cache_entry::http_date(entry.upstream_mtime) : "",
+                                                    entry.upstream_etag,
+                                                    [this, request_path, progress](bool success) {
+                                                        complete_in_flight(request_path, success,
+                                                                           progress->snapshot(), true);
+                                                    });
+    net::post(m_background_context, [fetch]() { fetch->start(); });
+}
+
+void FileCache::load_package_index(const std::string& request_path) {
+    auto root = PackageIndex::repository_root(request_path);
+    if (!root) {
+        return;
+    }
+    std::size_t files = m_packages.load_file(*root, get_cache_path(request_path));
+    std::cout << "Loaded " << files << " package checksums from " << request_path << std::endl;
+}
+
+void FileCache::load_package_indexes() {
+    if (!m_config.get_verify_downloads()) {
+        return;
+    }
+    // One of Packages, Packages.xz, Packages.gz per directory, they list the same files
+    static const std::vector<std::string> preference = {"Packages", "Packages.xz", "Packages.gz"};
+    std::map<fs::path, std::size_t> chosen;
+    std::vector<std::string> by_hash;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(m_cache_dir, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        std::error_code type_ec;
+        // Indexes live under dists, pool and bookkeeping directories hold none
+        if (it->is_directory(type_ec) && (name == "pool" || name.starts_with(".pacprism-"))) {
+            it.disable_recursion_pending();
+            continue;
+        }
+        std::string request_path = "/" + it->path().lexically_relative(m_cache_dir).generic_string();
+        if (!PackageIndex::is_index(request_path) || !it->is_regular_file(type_ec)) {
+            continue;
+        }
+        auto rank = std::find(preference.begin(), preference.end(), name);
+        if (rank == preference.end()) {
+            by_hash.push_back(std::move(request_path));
+            continue;
+        }
+        auto [current, inserted] = chosen.try_emplace(it->path().parent_path(), rank - preference.begin());
+        if (!inserted) {
+            current->second = std::min<std::size_t>(current->second, rank - preference.begin());
+        }
+    }
+
+    for (const auto& [directory, rank] : chosen) {
+        load_package_index("/" + (directory / preference[rank]).lexically_relative(m_cache_dir).generic_string());
+    }
+    for (const auto& request_path : by_hash) {
+        load_package_index(request_path);
+    }
+}
+
+void FileCache::store_blob(const std::string& request_path) {
+    auto entry = m_index.lookup(request_path);
+    if (!entry) {
+        return;
+    }
+    std::string cache_path = get_cache_path(request_path);
+    struct stat hashed;
+    // Replaced since it was indexed, the new file is stored after its own fetch
+    if (::stat(cache_path.c_str(), &hashed) != 0 || static_cast<std::uint64_t>(hashed.st_size) != entry->size ||
+        hashed.st_mtime != entry->mtime) {
+        return;
+    }
+    std::string sha256 = entry->sha256.empty() ? Validator().calculate_sha256(cache_path) : entry->sha256;
+    if (sha256.empty()) {
+        return;
+    }
+
+    // Linking is disk work, done without the in-flight lock
+    struct stat current;
+    {
+        std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+        if (m_in_flight.contains(request_path) || ::stat(cache_path.c_str(), &current) != 0 ||
+            current.st_ino != hashed.st_ino || current.st_dev != hashed.st_dev) {
+            return;
+        }
+    }
+    if (!get_blob_store().share(cache_path, sha256)) {
+        return;
+    }
+
+    // Only index the swap if nothing fetched, evicted or replaced the path meanwhile
+    std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+    std::error_code ec;
+    if (m_in_flight.contains(request_path) || m_index.lookup(request_path) != entry ||
+        !fs::equivalent(cache_path, get_blob_store().blob_path(sha256), ec)) {
+        return;
+    }
+    // A file swapped for an older blob has its mtime
+    if (auto updated = cache_entry::from_file(cache_path)) {
+        updated->sha256 = sha256;
+        updated->upstream_etag = entry->upstream_etag;
+        updated->upstream_mtime = entry->upstream_mtime;
+        updated->access = entry->access;
+        index_put(request_path, std::move(*updated));
+    }
+}
+
+void FileCache::async_fetch_streaming(
+    net::any_io_executor executor,
+    const std::string& request_path,
+    unsigned http_version,
+    std::function<void(std::shared_ptr<streaming_response>)> handler
+) {
+    m_sketch.increment(request_path);
+    std::shared_ptr<FetchProgress> progress;
+    if (auto entry = get_entry(request_path)) {
+        // Finished in the meantime, stream the complete file
+        revalidate_if_stale(request_path, *entry);
+        entry->touch();
+        progress = FetchProgress::completed(get_cache_path(request_path), entry->size);
+    }
+    if (!progress) {
+        std::cout << "Cache miss for: " << request_path << ", streaming from upstream..." << std::endl;
+        progress = start_or_join_fetch(executor, request_path);
+    }
 
-            // Exponential backoff: 1s, 2s, 4s
-            int backoff_seconds = 1 << retry;
-            std::cerr << "Fetch failed (attempt " << (retry + 1) << "/" << MAX_RETRIES
-                      << "): " << e.what() << ", retrying in " << backoff_seconds << "s..." << std::endl;
-            std::this_thread::sleep_for(std::chrono::seconds(backoff_seconds));
+    progress->async_wait_started(executor, [progress, request_path, http_version, handler = std::move(handler)](bool started) {
+        if (!started) {
+            std::cerr << "Failed to fetch: " << request_path << std::endl;
+            handler(nullptr);
+            return;
+        }
 
-        } catch (const std::exception& e) {
-            std::cerr << "Error fetching from upstream: " << e.what() << std::endl;
-            return false;
+        auto response = std::make_shared<streaming_response>();
+        response->progress = progress;
+        response->header = {http::status::ok, http_version};
+        response->header.set(http::field::content_type, "application/octet-stream");
+        response->header.set(http::field::server, "pacPrism/0.1.0");
+
+        // Without an announced length the body is relayed with chunked encoding,
+        // or delimited by closing the connection for HTTP/1.0 clients
+        auto state = progress->snapshot();
+        response->generation = state.generation;
+        if (state.content_length) {
+            response->header.content_length(*state.content_length);
+        } else if (http_version >= 11) {
+            response->header.chunked(true);
+        } else {
+            response->header.keep_alive(false);
         }
+
+        handler(response);
+    });
+}
+
+void FileCache::async_ensure_cached(
+    net::any_io_executor executor,
+    const std::string& request_path,
+    fetch_handler handler
+) {
+    // Cache hit, complete right away
+    if (auto entry = get_entry(request_path)) {
+        revalidate_if_stale(request_path, *entry);
+        net::dispatch(executor, [handler = std::move(handler)]() { handler(true); });
+        return;
+    }
+
+    std::cout << "Cache miss for: " << request_path << ", fetching from upstream..." << std::endl;
+    async_fetch_from_upstream(executor, request_path, [request_path, handler = std::move(handler)](bool success) {
+        if (!success) {
+            std::cerr << "Failed to fetch: " << request_path << std::endl;
+        }
+        handler(success);
+    });
+}
+
+std::array<net::const_buffer, 3> file_hit_response::header_buffers() const {
+    static constexpr std::string_view status_1_0 = "HTTP/1.0 200 OK\r\n";
+    static constexpr std::string_view partial_1_1 = "HTTP/1.1 206 Partial Content\r\n";
+    static constexpr std::string_view partial_1_0 = "HTTP/1.0 206 Partial Content\r\n";
+
+    // Fields between the status line and Content-Length, shared by every response
+    std::string_view header = entry->header;
+    auto status_size = cache_entry::header_status.size();
+    auto fields = header.substr(status_size, entry->header_fields_end - status_size);
+
+    if (partial) {
+        auto status = http_version >= 11 ? partial_1_1 : partial_1_0;
+        return {net::buffer(status.data(), status.size()),
+                net::buffer(fields.data(), fields.size()),
+                net::buffer(range_fields)};
+    }
+    if (http_version >= 11) {
+        return {net::buffer(header.data(), header.size()), net::const_buffer(), net::const_buffer()};
     }
+    auto rest = header.substr(status_size);
+    return {net::buffer(status_1_0.data(), status_1_0.size()),
+            net::buffer(rest.data(), rest.size()),
+            net::const_buffer()};
+}
 
-    return false;
+std::shared_ptr<file_hit_response> FileCache::get_file_hit(
+    const std::string& request_path,
+    unsigned http_version,
+    const std::string& range_header
+) {
+    auto entry = ensure_entry(request_path);
+    if (!entry) {
+        return nullptr;
+    }
+
+    auto hit = std::make_shared<file_hit_response>();
+    std::string cache_path = get_cache_path(request_path);
+    beast::error_code ec;
+    hit->file.open(cache_path.c_str(), beast::file_mode::read, ec);
+    if (ec) {
+        std::cerr << "Failed to open cached file: " << cache_path << " - " << ec.message() << std::endl;
+        invalidate(request_path);
+        return nullptr;
+    }
+    // A refresh may have replaced mutable metadata since the lookup, describe the file we opened
+    struct stat st;
+    if (m_policy.ttl(request_path) && ::fstat(hit->file.native_handle(), &st) == 0 &&
+        (static_cast<std::uint64_t>(st.st_size) != entry->size || st.st_mtime != entry->mtime)) {
+        entry = std::make_shared<const cache_entry>(cache_entry::make(st.st_size, st.st_mtime));
+    }
+    hit->entry = entry;
+    hit->http_version = http_version;
+    hit->length = entry->size;
+
+    if (!range_header.empty()) {
+        RangeInfo range = parse_range_header(range_header, entry->size);
+        if (range.valid) {
+            hit->partial = true;
+            hit->offset = range.start;
+            hit->length = range.end - range.start + 1;
+            hit->range_fields = std::format("Accept-Ranges: bytes\r\nContent-Range: bytes {}-{}/{}\r\nContent-Length: {}\r\n\r\n",
+                                            range.start, range.end, range.file_size, hit->length);
+            std::cout << "Range request: " << request_path
+                      << " (" << range.start << "-" << range.end << "/" << range.file_size << ")" << std::endl;
+        }
+    }
+    return hit;
+}
+
+std::shared_ptr<const memory_object> FileCache::get_memory_object(const std::string& request_path, unsigned http_version) {
+    // Objects hold an HTTP/1.1 response, other versions take the file path
+    if (http_version != 11 || !m_memory.enabled()) {
+        return nullptr;
+    }
+    auto entry = get_entry(request_path);
+    if (!entry) {
+        return nullptr;
+    }
+
+    auto object = m_memory.lookup(request_path);
+    if (!object || object->etag != entry->etag) {
+        // Admit small files that were asked for often enough before
+        if (!m_memory.fits(entry->size) || m_sketch.estimate(request_path) < static_cast<unsigned>(m_memory_min_hits)) {
+            return nullptr;
+        }
+        object = load_memory_object(request_path, *entry);
+        if (!object) {
+            return nullptr;
+        }
+        m_memory.insert(request_path, object);
+    }
+
+    // Count the access like ensure_entry does
+    m_sketch.increment(request_path);
+    revalidate_if_stale(request_path, *entry);
+    entry->touch();
+    return object;
+}
+
+std::shared_ptr<const memory_object> FileCache::load_memory_object(const std::string& request_path, const cache_entry& entry) const {
+    std::ifstream in(get_cache_path(request_path), std::ios::binary);
+    if (!in) {
+        return nullptr;
+    }
+
+    // The entry's prepared header, then the body
+    auto object = std::make_shared<memory_object>();
+    object->etag = entry.etag;
+    object->wire = entry.header;
+
+    // The body must be exactly the indexed size, anything else means the file changed
+    std::size_t header_size = object->wire.size();
+    object->wire.resize(header_size + entry.size);
+    in.read(object->wire.data() + header_size, static_cast<std::streamsize>(entry.size));
+    if (!in || in.peek() != std::ifstream::traits_type::eof()) {
+        return nullptr;
+    }
+    return object;
 }
 
 std::shared_ptr<http::response<http::file_body>> FileCache::get_or_fetch(
@@ -297,12 +1299,9 @@ std::shared_ptr<http::response<http::file_body>> FileCache::get_or_fetch(
     unsigned http_version
 ) {
     // Check if file is cached
-    if (!is_cached(request_path)) {
-        std::cout << "Cache miss for: " << request_path << ", fetching from upstream..." << std::endl;
-        if (!fetch_from_upstream(request_path)) {
-            std::cerr << "Failed to fetch: " << request_path << std::endl;
-            return std::shared_ptr<http::response<http::file_body>>(nullptr);
-        }
+    auto entry = ensure_entry(request_path);
+    if (!entry) {
+        return std::shared_ptr<http::response<http::file_body>>(nullptr);
     }
 
     // Open file for response
@@ -317,14 +1316,15 @@ std::shared_ptr<http::response<http::file_body>> FileCache::get_or_fetch(
 
     if (ec) {
             std::cerr << "Failed to open cached file: " << cache_path << " - " << ec.message() << std::endl;
+            invalidate(request_path);
             return std::shared_ptr<http::response<http::file_body>>(nullptr);
     }
 
     // Set response headers
     response->set(http::field::content_type, "application/octet-stream");
     response->set(http::field::server, "pacPrism/0.1.0");
-    response->set(http::field::last_modified, get_last_modified(cache_path));
-    response->set(http::field::etag, generate_etag(cache_path));
+    response->set(http::field::last_modified, entry->last_modified);
+    response->set(http::field::etag, entry->etag);
     response->content_length(response->body().size());
 
     response->prepare_payload();
@@ -336,16 +1336,9 @@ std::shared_ptr<http::response<http::file_body>> FileCache::get_or_fetch(
 // Range Request Support
 //==============================================================================
 
-FileCache::RangeInfo FileCache::parse_range_header(const std::string& range_header, const std::string& cache_path) const {
+FileCache::RangeInfo FileCache::parse_range_header(const std::string& range_header, std::size_t file_size) const {
     RangeInfo info;
-
-    // Get file size
-    try {
-        info.file_size = fs::file_size(cache_path);
-    } catch (const std::exception& e) {
-        std::cerr << "Failed to get file size: " << e.what() << std::endl;
-        return info;
-    }
+    info.file_size = file_size;
 
     // Parse Range header: "bytes=start-end"
     // Example: "bytes=0-1023", "bytes=512-", "bytes=-256"
@@ -412,19 +1405,15 @@ std::shared_ptr<http::response<http::file_body>> FileCache::get_or_fetch_with_ra
     const std::string& range_header
 ) {
     // Ensure file is cached first
-    if (!is_cached(request_path)) {
-        std::cout << "Cache miss for: " << request_path << ", fetching from upstream..." << std::endl;
-        if (!fetch_from_upstream(request_path)) {
-            std::cerr << "Failed to fetch: " << request_path << std::endl;
-            return std::shared_ptr<http::response<http::file_body>>(nullptr);
-        }
-        std::cout << "Successfully cached: " << request_path << std::endl;
+    auto entry = ensure_entry(request_path);
+    if (!entry) {
+        return std::shared_ptr<http::response<http::file_body>>(nullptr);
     }
 
     std::string cache_path = get_cache_path(request_path);
 
     // Parse Range header
-    RangeInfo range = parse_range_header(range_header, cache_path);
+    RangeInfo range = parse_range_header(range_header, entry->size);
 
     // If no valid Range header, return normal response
     if (!range.valid || range_header.empty()) {
@@ -440,6 +1429,7 @@ std::shared_ptr<http::response<http::file_body>> FileCache::get_or_fetch_with_ra
     response->body().open(cache_path.c_str(), beast::file_mode::read, ec);
     if (ec) {
             std::cerr << "Failed to open cached file: " << cache_path << " - " << ec.message() << std::endl;
+            invalidate(request_path);
             return std::shared_ptr<http::response<http::file_body>>(nullptr);
     }
 
@@ -464,8 +1454,6 @@ std::shared_ptr<http::response<http::file_body>> FileCache::get_or_fetch_with_ra
         range.start, range.end, range.file_size);
     response->set(http::field::content_range, content_range);
 
-    response->prepare_payload();
-
     std::cout << "Range request: " << request_path
               << " (" << range.start << "-" << range.end << "/" << range.file_size << ")" << std::endl;
 
@@ -476,41 +1464,6 @@ std::shared_ptr<http::response<http::file_body>> FileCache::get_or_fetch_with_ra
 // Conditional Request Support
 //==============================================================================
 
-std::string FileCache::get_last_modified(const std::string& cache_path) const {
-    try {
-        auto ftime = fs::last_write_time(cache_path);
-        auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-            ftime - fs::file_time_type::clock::now() + std::chrono::system_clock::now());
-        std::time_t cftime = std::chrono::system_clock::to_time_t(sctp);
-
-        // Format as HTTP date (RFC 1123)
-        char buffer[80];
-        std::tm tm;
-        localtime_r(&cftime, &tm);
-        std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
-        return std::string(buffer);
-    } catch (const std::exception& e) {
-        std::cerr << "Failed to get last modified time: " << e.what() << std::endl;
-        return "";
-    }
-}
-
-std::string FileCache::generate_etag(const std::string& cache_path) const {
-    try {
-        // Simple ETag: "size-modtime"
-        auto ftime = fs::last_write_time(cache_path);
-        auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-            ftime - fs::file_time_type::clock::now() + std::chrono::system_clock::now());
-        std::time_t mod_time = std::chrono::system_clock::to_time_t(sctp);
-        std::size_t file_size = fs::file_size(cache_path);
-
-        return std::format("\"{}-{}\"", file_size, mod_time);
-    } catch (const std::exception& e) {
-        std::cerr << "Failed to generate ETag: " << e.what() << std::endl;
-        return "";
-    }
-}
-
 std::time_t FileCache::parse_http_date(const std::string& date_str) const {
     // Parse RFC 1123 date format: "Wed, 21 Oct 2015 07:28:00 GMT"
     std::tm tm = {};
@@ -522,31 +1475,22 @@ std::time_t FileCache::parse_http_date(const std::string& date_str) const {
         return 0;  // Parse failed
     }
 
-    return std::mktime(&tm);
+    // The date is in GMT, not in the local time zone
+    return timegm(&tm);
 }
 
-bool FileCache::check_modified_since(const std::string& if_modified_since, const std::string& cache_path) const {
+bool FileCache::check_modified_since(const std::string& if_modified_since, std::time_t file_mod_time) const {
     if (if_modified_since.empty()) {
         return true;  // No header, assume modified
     }
 
-    try {
-        auto ftime = fs::last_write_time(cache_path);
-        auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-            ftime - fs::file_time_type::clock::now() + std::chrono::system_clock::now());
-        std::time_t file_mod_time = std::chrono::system_clock::to_time_t(sctp);
-
-        std::time_t if_time = parse_http_date(if_modified_since);
-        if (if_time == 0) {
-            return true;  // Parse failed, assume modified
-        }
-
-        // File is modified if file_mod_time > if_time
-        return file_mod_time > if_time;
-    } catch (const std::exception& e) {
-        std::cerr << "Failed to check modified since: " << e.what() << std::endl;
-        return true;  // On error, assume modified
+    std::time_t if_time = parse_http_date(if_modified_since);
+    if (if_time == 0) {
+        return true;  // Parse failed, assume modified
     }
+
+    // File is modified if file_mod_time > if_time
+    return file_mod_time > if_time;
 }
 
 file_cache_response FileCache::get_or_fetch_with_conditional(
@@ -556,20 +1500,16 @@ file_cache_response FileCache::get_or_fetch_with_conditional(
     const std::string& if_none_match
 ) {
     // Ensure file is cached first
-    if (!is_cached(request_path)) {
-        std::cout << "Cache miss for: " << request_path << ", fetching from upstream..." << std::endl;
-        if (!fetch_from_upstream(request_path)) {
-            std::cerr << "Failed to fetch: " << request_path << std::endl;
-            return std::shared_ptr<http::response<http::file_body>>(nullptr);
-        }
-        std::cout << "Successfully cached: " << request_path << std::endl;
+    auto entry = ensure_entry(request_path);
+    if (!entry) {
+        return std::shared_ptr<http::response<http::file_body>>(nullptr);
     }
 
     std::string cache_path = get_cache_path(request_path);
 
     // Check If-Modified-Since
     if (!if_modified_since.empty()) {
-        bool is_modified = check_modified_since(if_modified_since, cache_path);
+        bool is_modified = check_modified_since(if_modified_since, entry->mtime);
 
         if (!is_modified) {
             // File not modified, return HTTP 304
@@ -577,8 +1517,8 @@ file_cache_response FileCache::get_or_fetch_with_conditional(
 
             auto response = std::make_shared<http::response<http::empty_body>>(http::status::not_modified, http_version);
             response->set(http::field::server, "pacPrism/0.1.0");
-            response->set(http::field::date, get_last_modified(cache_path));
-            response->set(http::field::etag, generate_etag(cache_path));
+            response->set(http::field::date, entry->last_modified);
+            response->set(http::field::etag, entry->etag);
             response->prepare_payload();
 
             return response;
@@ -587,14 +1527,14 @@ file_cache_response FileCache::get_or_fetch_with_conditional(
 
     // Check If-None-Match (ETag)
     if (!if_none_match.empty()) {
-        std::string current_etag = generate_etag(cache_path);
+        const std::string& current_etag = entry->etag;
         if (current_etag == if_none_match) {
             // ETag matches, return HTTP 304
             std::cout << "Conditional request: ETag match (304) for " << request_path << std::endl;
 
             auto response = std::make_shared<http::response<http::empty_body>>(http::status::not_modified, http_version);
             response->set(http::field::server, "pacPrism/0.1.0");
-            response->set(http::field::date, get_last_modified(cache_path));
+            response->set(http::field::date, entry->last_modified);
             response->set(http::field::etag, current_etag);
             response->prepare_payload();
 
@@ -611,13 +1551,14 @@ file_cache_response FileCache::get_or_fetch_with_conditional(
 
     if (ec) {
             std::cerr << "Failed to open cached file: " << cache_path << " - " << ec.message() << std::endl;
+            invalidate(request_path);
             return std::shared_ptr<http::response<http::file_body>>(nullptr);
     }
 
     response->set(http::field::content_type, "application/octet-stream");
     response->set(http::field::server, "pacPrism/0.1.0");
-    response->set(http::field::last_modified, get_last_modified(cache_path));
-    response->set(http::field::etag, generate_etag(cache_path));
+    response->set(http::field::last_modified, entry->last_modified);
+    response->set(http::field::etag, entry->etag);
     response->content_length(response->body().size());
 
     response->prepare_payload();
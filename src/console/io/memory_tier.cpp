@@ -0,0 +1,76 @@
+#include <mutex>
+#include <limits>
+
+#include <console/io/memory_tier.hpp>
+
+// MemoryTier implementation
+
+MemoryTier::MemoryTier(std::uint64_t max_bytes, std::uint64_t max_object_bytes)
+    : m_max_bytes(max_bytes), m_max_object_bytes(max_object_bytes) {}
+
+bool MemoryTier::fits(std::uint64_t size) const {
+    return enabled() && size <= m_max_object_bytes && size <= m_max_bytes;
+}
+
+std::shared_ptr<const memory_object> MemoryTier::lookup(const std::string& request_path) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto it = m_objects.find(request_path);
+    if (it == m_objects.end()) {
+        return nullptr;
+    }
+    it->second->last_use.store(m_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return it->second;
+}
+
+bool MemoryTier::insert(const std::string& request_path, std::shared_ptr<const memory_object> object) {
+    if (!enabled() || object->wire.size() > m_max_bytes) {
+        return false;
+    }
+    object->last_use.store(m_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    auto it = m_objects.find(request_path);
+    if (it != m_objects.end()) {
+        m_used_bytes -= it->second->wire.size();
+        m_objects.erase(it);
+    }
+
+    // Few and small objects, a linear scan for the oldest is cheaper than an LRU list
+    // that every hit would have to lock
+    while (m_used_bytes + object->wire.size() > m_max_bytes && !m_objects.empty()) {
+        auto oldest = m_objects.begin();
+        std::uint64_t oldest_use = std::numeric_limits<std::uint64_t>::max();
+        for (auto candidate = m_objects.begin(); candidate != m_objects.end(); ++candidate) {
+            auto use = candidate->second->last_use.load(std::memory_order_relaxed);
+            if (use < oldest_use) {
+                oldest_use = use;
+                oldest = candidate;
+            }
+        }
+        m_used_bytes -= oldest->second->wire.size();
+        m_objects.erase(oldest);
+    }
+
+    m_used_bytes += object->wire.size();
+    m_objects.emplace(request_path, std::move(object));
+    return true;
+}
+
+void MemoryTier::erase(const std::string& request_path) {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    auto it = m_objects.find(request_path);
+    if (it != m_objects.end()) {
+        m_used_bytes -= it->second->wire.size();
+        m_objects.erase(it);
+    }
+}
+
+std::uint64_t MemoryTier::used_bytes() const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_used_bytes;
+}
+
+std::size_t MemoryTier::size() const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_objects.size();
+}
@@ -0,0 +1,150 @@
+#include <chrono>
+#include <format>
+#include <filesystem>
+#include <mutex>
+
+#include <console/io/metadata_index.hpp>
+
+namespace fs = std::filesystem;
+
+// cache_entry implementation
+
+void cache_entry::touch() const {
+    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    access->last_access.store(now, std::memory_order_relaxed);
+    access->hit_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+cache_entry cache_entry::make(std::uint64_t size, std::time_t mtime, const std::string& sha256) {
+    cache_entry entry;
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.sha256 = sha256;
+    // Until the first hit, the file was last used when it was written
+    entry.access->last_access.store(mtime, std::memory_order_relaxed);
+
+    // Simple ETag: "size-modtime"
+    entry.etag = std::format("\"{}-{}\"", size, mtime);
+
+    entry.last_modified = http_date(mtime);
+
+    // Built once here, hits send it as is
+    entry.header = std::format("{}Content-Type: application/octet-stream\r\nServer: pacPrism/0.1.0\r\n"
+                               "Last-Modified: {}\r\nETag: {}\r\n",
+                               header_status, entry.last_modified, entry.etag);
+    entry.header_fields_end = entry.header.size();
+    entry.header += std::format("Content-Length: {}\r\n\r\n", size);
+    return entry;
+}
+
+std::string cache_entry::http_date(std::time_t time) {
+    char buffer[80];
+    std::tm tm;
+    gmtime_r(&time, &tm);
+    std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+std::optional<cache_entry> cache_entry::from_file(const std::string& file_path) {
+    std::error_code ec;
+    auto status = fs::status(file_path, ec);
+    if (ec || !fs::is_regular_file(status)) {
+        return std::nullopt;
+    }
+
+    auto size = fs::file_size(file_path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    auto ftime = fs::last_write_time(file_path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
+        ftime - fs::file_time_type::clock::now() + std::chrono::system_clock::now());
+    return make(size, std::chrono::system_clock::to_time_t(sctp));
+}
+
+// MetadataIndex implementation
+
+MetadataIndex::MetadataIndex(std::size_t shard_count) {
+    if (shard_count == 0) {
+        shard_count = 1;
+    }
+    for (std::size_t i = 0; i < shard_count; i++) {
+        m_shards.push_back(std::make_unique<shard>());
+    }
+}
+
+MetadataIndex::shard& MetadataIndex::shard_of(const std::string& request_path) const {
+    return *m_shards[std::hash<std::string>{}(request_path) % m_shards.size()];
+}
+
+std::shared_ptr<const cache_entry> MetadataIndex::lookup(const std::string& request_path) const {
+    auto& s = shard_of(request_path);
+    std::shared_lock<std::shared_mutex> lock(s.mutex);
+    auto it = s.entries.find(request_path);
+    if (it == s.entries.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+void MetadataIndex::insert(const std::string& request_path, cache_entry entry) {
+    auto snapshot = std::make_shared<const cache_entry>(std::move(entry));
+    auto& s = shard_of(request_path);
+    std::unique_lock<std::shared_mutex> lock(s.mutex);
+    auto& slot = s.entries[request_path];
+    if (slot) {
+        m_total_bytes -= slot->size;
+    } else {
+        m_count++;
+    }
+    m_total_bytes += snapshot->size;
+    slot = std::move(snapshot);
+}
+
+bool MetadataIndex::try_insert(const std::string& request_path, cache_entry entry) {
+    auto& s = shard_of(request_path);
+    std::unique_lock<std::shared_mutex> lock(s.mutex);
+    if (s.entries.contains(request_path)) {
+        return false;
+    }
+    m_total_bytes += entry.size;
+    m_count++;
+    s.entries.emplace(request_path, std::make_shared<const cache_entry>(std::move(entry)));
+    return true;
+}
+
+bool MetadataIndex::erase(const std::string& request_path) {
+    auto& s = shard_of(request_path);
+    std::unique_lock<std::shared_mutex> lock(s.mutex);
+    auto it = s.entries.find(request_path);
+    if (it == s.entries.end()) {
+        return false;
+    }
+    m_total_bytes -= it->second->size;
+    m_count--;
+    s.entries.erase(it);
+    return true;
+}
+
+void MetadataIndex::for_each(const std::function<void(const std::string&, const cache_entry&)>& visitor) const {
+    for (const auto& s : m_shards) {
+        std::shared_lock<std::shared_mutex> lock(s->mutex);
+        for (const auto& [path, entry] : s->entries) {
+            visitor(path, *entry);
+        }
+    }
+}
+
+void MetadataIndex::clear() {
+    for (auto& s : m_shards) {
+        std::unique_lock<std::shared_mutex> lock(s->mutex);
+        for (const auto& [path, entry] : s->entries) {
+            m_total_bytes -= entry->size;
+        }
+        m_count -= s->entries.size();
+        s->entries.clear();
+    }
+}
@@ -0,0 +1,203 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+
+#include <console/io/mirror_set.hpp>
+
+namespace beast = boost::beast;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+// MirrorSet implementation
+
+MirrorSet::MirrorSet(const std::string& hosts, std::chrono::seconds probe_interval)
+    : m_probe_interval(std::max(probe_interval, std::chrono::seconds(1))) {
+    for (const auto& host : parse_hosts(hosts)) {
+        mirror_stats mirror;
+        mirror.host = host;
+        m_mirrors.push_back(std::move(mirror));
+    }
+    // Never leave the cache without an upstream
+    if (m_mirrors.empty()) {
+        mirror_stats mirror;
+        mirror.host = hosts;
+        m_mirrors.push_back(std::move(mirror));
+    }
+}
+
+MirrorSet::~MirrorSet() {
+    stop();
+}
+
+std::vector<std::string> MirrorSet::parse_hosts(const std::string& hosts) {
+    std::string list = hosts;
+    std::replace(list.begin(), list.end(), ',', ' ');
+    std::istringstream fields(list);
+    std::vector<std::string> result;
+    std::string host;
+    while (fields >> host) {
+        result.push_back(host);
+    }
+    return result;
+}
+
+double MirrorSet::score(const mirror_stats& mirror) const {
+    if (mirror.fetches == 0) {
+        return 0;
+    }
+    double seconds = mirror.latency_ms / 1000.0;
+    if (mirror.throughput > 0) {
+        seconds += typical_bytes / mirror.throughput;
+    }
+    return seconds;
+}
+
+std::optional<std::size_t> MirrorSet::select(const std::vector<std::size_t>& tried, std::size_t rank) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::size_t> healthy;
+    std::optional<std::size_t> fallback;
+    for (std::size_t i = 0; i < m_mirrors.size(); i++) {
+        if (std::find(tried.begin(), tried.end(), i) != tried.end()) {
+            continue;
+        }
+        const auto& mirror = m_mirrors[i];
+        if (mirror.healthy) {
+            healthy.push_back(i);
+        } else if (!fallback || mirror.failed_at < m_mirrors[*fallback].failed_at) {
+            fallback = i;
+        }
+    }
+    if (healthy.empty()) {
+        return fallback;
+    }
+
+    // Configured order breaks ties
+    std::stable_sort(healthy.begin(), healthy.end(), [this](std::size_t a, std::size_t b) {
+        return score(m_mirrors[a]) < score(m_mirrors[b]);
+    });
+    return healthy[rank % healthy.size()];
+}
+
+void MirrorSet::report_success(std::size_t index,
+                               std::chrono::steady_clock::duration latency,
+                               std::uint64_t bytes,
+                               std::chrono::steady_clock::duration transfer) {
+    double latency_ms = std::chrono::duration<double, std::milli>(latency).count();
+    double transfer_seconds = std::chrono::duration<double>(transfer).count();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& mirror = m_mirrors[index];
+    mirror.latency_ms = mirror.fetches == 0 ? latency_ms
+                                            : ewma_alpha * latency_ms + (1 - ewma_alpha) * mirror.latency_ms;
+    // Small files say nothing about bandwidth
+    if (bytes >= min_throughput_bytes && transfer_seconds > 0) {
+        double throughput = bytes / transfer_seconds;
+        mirror.throughput = mirror.throughput == 0 ? throughput
+                                                   : ewma_alpha * throughput + (1 - ewma_alpha) * mirror.throughput;
+    }
+    mirror.fetches++;
+    mirror.healthy = true;
+}
+
+void MirrorSet::report_failure(std::size_t index) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& mirror = m_mirrors[index];
+    mirror.failures++;
+    mirror.failed_at = std::chrono::steady_clock::now();
+    if (mirror.healthy && m_mirrors.size() > 1) {
+        std::cerr << "Upstream mirror " << mirror.host << " marked down" << std::endl;
+    }
+    mirror.healthy = false;
+}
+
+std::size_t MirrorSet::probe_once(std::chrono::milliseconds timeout) {
+    std::vector<std::size_t> down;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (std::size_t i = 0; i < m_mirrors.size(); i++) {
+            if (!m_mirrors[i].healthy) {
+                down.push_back(i);
+            }
+        }
+    }
+
+    std::size_t restored = 0;
+    for (std::size_t index : down) {
+        std::string host = m_mirrors[index].host;
+        std::string port = "80";
+        size_t colon_pos = host.find(':');
+        if (colon_pos != std::string::npos) {
+            port = host.substr(colon_pos + 1);
+            host = host.substr(0, colon_pos);
+        }
+
+        // A completed TCP handshake is enough to let the mirror compete again
+        net::io_context io_context;
+        beast::tcp_stream stream(io_context);
+        tcp::resolver resolver(io_context);
+        bool reachable = false;
+        beast::error_code ec;
+        auto endpoints = resolver.resolve(host, port, ec);
+        if (!ec) {
+            stream.expires_after(timeout);
+            stream.async_connect(endpoints, [&reachable](const beast::error_code& ec, const tcp::endpoint&) {
+                reachable = !ec;
+            });
+            io_context.run();
+        }
+        if (!reachable) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_mirrors[index].healthy) {
+            m_mirrors[index].healthy = true;
+            restored++;
+            std::cout << "Upstream mirror " << m_mirrors[index].host << " is back" << std::endl;
+        }
+    }
+    return restored;
+}
+
+void MirrorSet::start() {
+    std::lock_guard<std::mutex> lock(m_thread_mutex);
+    if (m_thread.joinable() || m_mirrors.size() < 2) {
+        return;
+    }
+    m_stopping = false;
+    m_thread = std::thread([this]() { run(); });
+}
+
+void MirrorSet::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_thread_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void MirrorSet::run() {
+    std::unique_lock<std::mutex> lock(m_thread_mutex);
+    while (!m_stopping) {
+        m_cv.wait_for(lock, m_probe_interval, [this]() { return m_stopping; });
+        if (m_stopping) {
+            break;
+        }
+
+        // Probe without holding our lock, stop() can be requested meanwhile
+        lock.unlock();
+        probe_once(std::chrono::seconds(5));
+        lock.lock();
+    }
+}
+
+std::vector<mirror_stats> MirrorSet::snapshot() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_mirrors;
+}
@@ -0,0 +1,76 @@
+#include <console/io/negative_cache.hpp>
+
+// NegativeCache implementation
+
+NegativeCache::NegativeCache(std::size_t max_entries, std::chrono::seconds not_found_ttl, std::chrono::seconds error_ttl)
+    : m_max_entries(max_entries), m_not_found_ttl(not_found_ttl), m_error_ttl(error_ttl) {}
+
+bool NegativeCache::enabled() const {
+    return m_max_entries > 0 && (m_not_found_ttl.count() > 0 || m_error_ttl.count() > 0);
+}
+
+void NegativeCache::insert(const std::string& request_path, int status) {
+    auto ttl = status == 404 || status == 410 ? m_not_found_ttl : m_error_ttl;
+    if (m_max_entries == 0 || ttl.count() <= 0) {
+        return;
+    }
+    auto expires = std::chrono::steady_clock::now() + ttl;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(request_path);
+    if (it != m_entries.end()) {
+        m_order.erase(it->second.order);
+        m_entries.erase(it);
+    }
+    while (m_entries.size() >= m_max_entries) {
+        m_entries.erase(m_order.front());
+        m_order.pop_front();
+    }
+    m_order.push_back(request_path);
+    m_entries.emplace(request_path, entry{status, expires, std::prev(m_order.end())});
+}
+
+const NegativeCache::entry* NegativeCache::find(const std::string& request_path) const {
+    auto it = m_entries.find(request_path);
+    if (it == m_entries.end()) {
+        return nullptr;
+    }
+    if (it->second.expires <= std::chrono::steady_clock::now()) {
+        m_order.erase(it->second.order);
+        m_entries.erase(it);
+        return nullptr;
+    }
+    return &it->second;
+}
+
+std::optional<int> NegativeCache::lookup(const std::string& request_path) {
+    std::optional<int> status = peek(request_path);
+    if (status) {
+        m_hits++;
+    } else {
+        m_misses++;
+    }
+    return status;
+}
+
+std::optional<int> NegativeCache::peek(const std::string& request_path) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (auto found = find(request_path)) {
+        return found->status;
+    }
+    return std::nullopt;
+}
+
+void NegativeCache::erase(const std::string& request_path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(request_path);
+    if (it != m_entries.end()) {
+        m_order.erase(it->second.order);
+        m_entries.erase(it);
+    }
+}
+
+std::size_t NegativeCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <console/io/io.hpp>
+#include <console/io/scrubber.hpp>
+#include <node/validator/digest.hpp>
+
+// CacheScrubber implementation
+
+CacheScrubber::CacheScrubber(FileCache& cache, std::size_t threads, std::uint64_t rate, std::chrono::seconds interval)
+    : m_cache(cache),
+      m_threads(std::max<std::size_t>(threads, 1)),
+      m_rate(rate),
+      m_interval(std::max(interval, std::chrono::seconds(1))) {}
+
+CacheScrubber::~CacheScrubber() {
+    stop();
+}
+
+void CacheScrubber::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_thread.joinable()) {
+        return;
+    }
+    m_stopping = false;
+    m_thread = std::thread([this]() { run(); });
+}
+
+void CacheScrubber::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void CacheScrubber::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        m_cv.wait_for(lock, m_interval, [this]() { return m_stopping.load(); });
+        if (m_stopping) {
+            break;
+        }
+
+        // Workers throttle on our lock, scrub without holding it
+        lock.unlock();
+        run_once();
+        lock.lock();
+    }
+}
+
+std::size_t CacheScrubber::run_once() {
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t files_before = m_scrubbed_files.load();
+    std::uint64_t bytes_before = m_scrubbed_bytes.load();
+
+    // Snapshot the paths, files cached meanwhile are checked by the next pass
+    std::vector<std::string> paths;
+    m_cache.get_index().for_each([&paths](const std::string& request_path, const cache_entry&) {
+        paths.push_back(request_path);
+    });
+
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> corrupt{0};
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < paths.size() && !m_stopping; i = next++) {
+            corrupt += scrub(paths[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < std::min(m_threads, paths.size()); i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "Scrubbed " << m_scrubbed_files.load() - files_before << " files ("
+              << m_scrubbed_bytes.load() - bytes_before << " bytes) in " << elapsed.count() << "ms, "
+              << corrupt.load() << " corrupt" << std::endl;
+    return corrupt.load();
+}
+
+bool CacheScrubber::scrub(const std::string& request_path) {
+    auto entry = m_cache.get_index().lookup(request_path);
+    if (!entry) {
+        return false;
+    }
+
+    Digest digest;
+    std::uint64_t bytes = 0;
+    bool read = digest.update_file(m_cache.get_cache_path(request_path), std::numeric_limits<std::uint64_t>::max(),
+                                   [this, &bytes](std::size_t bytes_read) {
+                                       bytes += bytes_read;
+                                       return throttle(bytes_read);
+                                   });
+    m_scrubbed_bytes += bytes;
+    // Removed meanwhile, or we are stopping
+    if (!read) {
+        return false;
+    }
+    m_scrubbed_files++;
+
+    bool corrupt = m_cache.check_scrubbed(request_path, entry, digest.hex_digest());
+    m_corrupt_files += corrupt;
+    return corrupt;
+}
+
+bool CacheScrubber::throttle(std::uint64_t bytes) {
+    if (m_rate == 0) {
+        return !m_stopping;
+    }
+
+    // Every read books the next slot of the shared schedule and waits for its start
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto now = std::chrono::steady_clock::now();
+    auto slot = std::max(m_next_read, now);
+    m_next_read = slot + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(bytes) / m_rate));
+    m_cv.wait_until(lock, slot, [this]() { return m_stopping.load(); });
+    return !m_stopping;
+}
@@ -0,0 +1,1141 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <console/io/io.hpp>
+#include <console/io/upstream.hpp>
+
+// FetchProgress implementation
+
+std::shared_ptr<FetchProgress> FetchProgress::completed(const std::string& file_path, std::uint64_t size) {
+    auto progress = std::make_shared<FetchProgress>(file_path);
+    progress->m_state.started = true;
+    progress->m_state.done = true;
+    progress->m_state.success = true;
+    progress->m_state.content_length = size;
+    progress->m_state.bytes_on_disk = size;
+    return progress;
+}
+
+void FetchProgress::start(std::optional<std::uint64_t> content_length) {
+    // On a retry the file is rewritten from the start, possibly with a different body
+    // Readers that relayed part of the old one see the new generation and give up.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state.started = true;
+        m_state.generation++;
+        m_state.content_length = content_length;
+        m_state.bytes_on_disk = 0;
+    }
+    notify();
+}
+
+void FetchProgress::advance(std::uint64_t bytes_on_disk) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state.bytes_on_disk = bytes_on_disk;
+    }
+    notify();
+}
+
+void FetchProgress::set_status(int status) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_state.status = status;
+}
+
+void FetchProgress::set_sha256(const std::string& sha256) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_state.sha256 = sha256;
+}
+
+void FetchProgress::set_validators(const std::string& etag, const std::string& last_modified) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_state.etag = etag;
+    m_state.last_modified = last_modified;
+}
+
+void FetchProgress::finish(bool success) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state.done = true;
+        m_state.success = success;
+    }
+    notify();
+}
+
+void FetchProgress::reset() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state.generation++;
+        m_state.bytes_on_disk = 0;
+    }
+    notify();
+}
+
+void FetchProgress::relocate(const std::string& staging_path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file_path = staging_path;
+}
+
+// Helper: flush a file or directory to stable storage
+static bool sync_path(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+bool FetchProgress::commit(const std::string& final_path, bool sync) {
+    // The body is durable before its name is, so a crash never leaves a torn file under the cache path
+    std::string staging = file_path();
+    if (sync && !sync_path(staging)) {
+        std::cerr << "Failed to sync " << staging << std::endl;
+        return false;
+    }
+
+    {
+        // Renamed under the lock, so a reader opens either name while it is valid
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::error_code ec;
+        fs::rename(m_file_path, final_path, ec);
+        if (ec) {
+            std::cerr << "Failed to commit " << m_file_path << " - " << ec.message() << std::endl;
+            return false;
+        }
+        m_file_path = final_path;
+    }
+
+    // Persist the rename itself
+    if (sync) {
+        sync_path(fs::path(final_path).parent_path().string());
+    }
+    return true;
+}
+
+FetchProgress::state FetchProgress::snapshot() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_state;
+}
+
+std::string FetchProgress::file_path() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_file_path;
+}
+
+void FetchProgress::open(beast::file& file, beast::error_code& ec) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    file.open(m_file_path.c_str(), beast::file_mode::read, ec);
+}
+
+void FetchProgress::async_wait_started(net::any_io_executor executor, fetch_handler handler) {
+    add_waiter(wait_kind::started, 0, 0, executor, std::move(handler));
+}
+
+void FetchProgress::async_wait_done(net::any_io_executor executor, fetch_handler handler) {
+    add_waiter(wait_kind::done, 0, 0, executor, std::move(handler));
+}
+
+void FetchProgress::async_wait_progress(net::any_io_executor executor, std::uint64_t generation, std::uint64_t seen_bytes,
+                                        fetch_handler handler) {
+    add_waiter(wait_kind::progress, generation, seen_bytes, executor, std::move(handler));
+}
+
+void FetchProgress::add_waiter(wait_kind kind, std::uint64_t generation, std::uint64_t seen_bytes,
+                               net::any_io_executor executor, fetch_handler handler) {
+    // Track outstanding work so the waiter's context stays alive until it is notified
+    waiter w{kind, generation, seen_bytes, net::prefer(executor, net::execution::outstanding_work.tracked), std::move(handler)};
+    bool result;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!satisfied(w)) {
+            m_waiters.push_back(std::move(w));
+            return;
+        }
+        result = result_of(w);
+    }
+    net::post(w.executor, [handler = std::move(w.handler), result]() { handler(result); });
+}
+
+bool FetchProgress::satisfied(const waiter& w) const {
+    switch (w.kind) {
+        case wait_kind::started:
+            return m_state.started || m_state.done;
+        case wait_kind::done:
+            return m_state.done;
+        case wait_kind::progress:
+            return m_state.done || m_state.generation != w.generation || m_state.bytes_on_disk > w.seen_bytes;
+    }
+    return true;
+}
+
+bool FetchProgress::result_of(const waiter& w) const {
+    switch (w.kind) {
+        case wait_kind::started:
+            // False only if the fetch failed before a body began
+            return m_state.started && (!m_state.done || m_state.success);
+        case wait_kind::done:
+            return m_state.success;
+        case wait_kind::progress:
+            return true;
+    }
+    return false;
+}
+
+void FetchProgress::notify() {
+    std::vector<std::pair<waiter, bool>> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_waiters.begin();
+        while (it != m_waiters.end()) {
+            if (satisfied(*it)) {
+                bool result = result_of(*it);
+                ready.emplace_back(std::move(*it), result);
+                it = m_waiters.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Notify outside the lock, each waiter on its own executor
+    for (auto& [w, result] : ready) {
+        net::post(w.executor, [handler = std::move(w.handler), result]() { handler(result); });
+    }
+}
+
+// Helper: staging name of a file being assembled, hidden from the index rescan
+static std::string staging_path(const std::string& file_path) {
+    fs::path path(file_path);
+    return (path.parent_path() / (".pacprism-" + path.filename().string() + ".part")).string();
+}
+
+// Helper: validator and length of a partial download, kept beside its staging file
+static std::string resume_path(const std::string& file_path) {
+    fs::path path(file_path);
+    return (path.parent_path() / (".pacprism-" + path.filename().string() + ".resume")).string();
+}
+
+// Helper: parse "bytes <first>-<last>/<total>", false for unknown totals
+static bool parse_content_range(std::string_view value, std::uint64_t& first, std::uint64_t& total) {
+    if (!value.starts_with("bytes ")) {
+        return false;
+    }
+    std::string range(value.substr(6));
+    std::size_t dash = range.find('-');
+    std::size_t slash = range.find('/');
+    if (dash == std::string::npos || slash == std::string::npos || dash > slash) {
+        return false;
+    }
+    try {
+        first = std::stoull(range.substr(0, dash));
+        total = std::stoull(range.substr(slash + 1));
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+// UpstreamFetch implementation
+
+UpstreamFetch::UpstreamFetch(net::any_io_executor executor,
+                             net::any_io_executor disk_executor,
+                             const Config& config,
+                             UpstreamPool& pool,
+                             MirrorSet& mirrors,
+                             const std::string& request_path,
+                             std::shared_ptr<FetchProgress> progress,
+                             fetch_handler handler)
+    : m_executor(executor),
+      m_disk_executor(disk_executor),
+      m_pool(pool),
+      m_mirrors(mirrors),
+      m_stream(executor),
+      m_timer(executor),
+      m_buffer(config.get_fetch_buffer_size()),
+      m_chunk(config.get_fetch_buffer_size()),
+      m_progress(std::move(progress)),
+      m_hash(config.get_dedup() || config.get_scrub_interval() > 0),
+      m_config(config),
+      m_may_split(config.get_segment_threshold() > 0 && config.get_segment_parallelism() > 1),
+      m_segment_threshold(config.get_segment_threshold()),
+      m_request_path(request_path),
+      m_handler(std::move(handler)),
+      m_max_retries(config.get_max_retries()),
+      m_connect_timeout(config.get_connect_timeout()),
+      m_read_timeout(config.get_read_timeout()) {
+    // Build HTTP request, the Host field is set per mirror
+    std::string target = (request_path[0] == '/') ? request_path : "/" + request_path;
+    m_request = http::request<http::empty_body>{http::verb::get, target, 11};
+    m_request.set(http::field::user_agent, "pacPrism/0.1.0");
+}
+
+std::shared_ptr<UpstreamFetch> UpstreamFetch::create(net::any_io_executor executor,
+                                                     net::any_io_executor disk_executor,
+                                                     const Config& config,
+                                                     UpstreamPool& pool,
+                                                     MirrorSet& mirrors,
+                                                     const std::string& request_path,
+                                                     std::shared_ptr<FetchProgress> progress,
+                                                     fetch_handler handler) {
+    auto fetch = std::shared_ptr<UpstreamFetch>(new UpstreamFetch(
+        executor, disk_executor, config, pool, mirrors, request_path, std::move(progress), std::move(handler)));
+    fetch->m_final_path = fetch->m_progress->file_path();
+    fetch->m_progress->relocate(staging_path(fetch->m_final_path));
+    fetch->load_resume();
+    return fetch;
+}
+
+std::shared_ptr<UpstreamFetch> UpstreamFetch::create_revalidation(net::any_io_executor executor,
+                                                                 net::any_io_executor disk_executor,
+                                                                 const Config& config,
+                                                                 UpstreamPool& pool,
+                                                                 MirrorSet& mirrors,
+                                                                 const std::string& request_path,
+                                                                 std::shared_ptr<FetchProgress> progress,
+                                                                 const std::string& last_modified,
+                                                                 const std::string& etag,
+                                                                 fetch_handler handler) {
+    auto fetch = create(executor, disk_executor, config, pool, mirrors, request_path, std::move(progress),
+                        std::move(handler));
+    fetch->m_revalidation = true;
+    if (!last_modified.empty()) {
+        fetch->m_request.set(http::field::if_modified_since, last_modified);
+    }
+    if (!etag.empty()) {
+        fetch->m_request.set(http::field::if_none_match, etag);
+    }
+    // Revalidated metadata is small, never split it
+    fetch->m_may_split = false;
+    return fetch;
+}
+
+std::shared_ptr<UpstreamFetch> UpstreamFetch::create_segment(net::any_io_executor executor,
+                                                             net::any_io_executor disk_executor,
+                                                             const Config& config,
+                                                             UpstreamPool& pool,
+                                                             MirrorSet& mirrors,
+                                                             const std::string& request_path,
+                                                             std::shared_ptr<FetchProgress> progress,
+                                                             std::shared_ptr<SegmentedDownload> download,
+                                                             std::size_t segment) {
+    auto fetch = std::shared_ptr<UpstreamFetch>(new UpstreamFetch(
+        executor, disk_executor, config, pool, mirrors, request_path, std::move(progress), nullptr));
+    const auto& range = download->get_segment(segment);
+    fetch->m_download = std::move(download);
+    fetch->m_segment = segment;
+    fetch->m_range_begin = range.begin;
+    fetch->m_range_end = range.end;
+    fetch->m_rank = segment;
+    fetch->m_may_split = false;
+    return fetch;
+}
+
+void UpstreamFetch::expect_sha256(const std::string& sha256) {
+    m_expected_sha256 = sha256;
+    m_hash = true;
+}
+
+void UpstreamFetch::use_mirror(std::size_t index) {
+    // Parse upstream host and port
+    m_mirror = index;
+    m_host = m_mirrors.host(index);
+    m_port = "80";
+    size_t colon_pos = m_host.find(':');
+    if (colon_pos != std::string::npos) {
+        m_port = m_host.substr(colon_pos + 1);
+        m_host = m_host.substr(0, colon_pos);
+    }
+    m_pool_key = m_host + ":" + m_port;
+    m_request.set(http::field::host, m_host);
+}
+
+void UpstreamFetch::start() {
+    auto self = shared_from_this();
+
+    // Another segment failed for good meanwhile
+    if (m_download && m_download->failed()) {
+        finish(false);
+        return;
+    }
+
+    // Reset per-attempt state.
+    m_buffer.consume(m_buffer.size());
+    m_parser = std::make_unique<http::response_parser<http::buffer_body>>();
+    // Packages are far larger than the default 8MB parser limit
+    m_parser->body_limit(std::numeric_limits<std::uint64_t>::max());
+
+    // Best mirror that has not failed in this round
+    auto mirror = m_mirrors.select(m_tried, m_rank);
+    use_mirror(mirror ? *mirror : 0);
+    m_attempt_start = std::chrono::steady_clock::now();
+
+    // A segment asks for what it still misses, a partial body is continued if it did not
+    // change upstream, otherwise the whole file is asked for
+    m_resume_offset = 0;
+    m_request.erase(http::field::if_range);
+    if (m_download) {
+        m_request.set(http::field::range, "bytes=" + std::to_string(m_range_begin + m_received) + "-" +
+                                          std::to_string(m_range_end - 1));
+    } else if (!m_validator.empty() && m_bytes_written > 0) {
+        m_resume_offset = m_bytes_written;
+        m_request.set(http::field::range, "bytes=" + std::to_string(m_resume_offset) + "-");
+        m_request.set(http::field::if_range, m_validator);
+    } else {
+        m_request.erase(http::field::range);
+    }
+
+    // Resolve host, usually answered from the pool's DNS cache
+    m_pool.async_resolve(m_executor, m_host, m_port,
+        [self](const beast::error_code& ec, std::vector<tcp::endpoint> endpoints) {
+            self->on_resolve(ec, std::move(endpoints));
+        });
+}
+
+void UpstreamFetch::on_resolve(const beast::error_code& ec, std::vector<tcp::endpoint> endpoints) {
+    if (ec) {
+        retry_or_fail("resolve: " + ec.message());
+        return;
+    }
+
+    auto self = shared_from_this();
+    m_endpoints = std::move(endpoints);
+
+    // Wait for a connection slot of the host, warm if one is idle
+    m_pool.async_acquire(m_executor, m_pool_key, m_stream.socket(),
+        [self](bool reused) {
+            self->on_acquire(reused);
+        });
+}
+
+void UpstreamFetch::on_acquire(bool reused) {
+    m_leased = true;
+    m_reused = reused;
+    if (reused) {
+        on_connect({});
+        return;
+    }
+
+    auto self = shared_from_this();
+
+    // Set connect timeout
+    m_stream.expires_after(std::chrono::seconds(m_connect_timeout));
+
+    // Connect to host
+    m_stream.async_connect(m_endpoints,
+        [self](const beast::error_code& ec, const tcp::endpoint&) {
+            self->on_connect(ec);
+        });
+}
+
+void UpstreamFetch::on_connect(const beast::error_code& ec) {
+    if (ec) {
+        retry_or_fail("connect: " + ec.message());
+        return;
+    }
+
+    auto self = shared_from_this();
+
+    // Set read timeout (reset for every read from here on)
+    m_stream.expires_after(std::chrono::seconds(m_read_timeout));
+
+    // Send request
+    http::async_write(m_stream, m_request,
+        [self](const beast::error_code& ec, std::size_t) {
+            self->on_write(ec);
+        });
+}
+
+void UpstreamFetch::on_write(const beast::error_code& ec) {
+    if (ec) {
+        retry_or_fail("write: " + ec.message());
+        return;
+    }
+
+    auto self = shared_from_this();
+
+    // Receive response header first, the body goes to disk chunk by chunk
+    m_stream.expires_after(std::chrono::seconds(m_read_timeout));
+    http::async_read_header(m_stream, m_buffer, *m_parser,
+        [self](const beast::error_code& ec, std::size_t) {
+            self->on_header(ec);
+        });
+}
+
+void UpstreamFetch::on_header(const beast::error_code& ec) {
+    if (ec) {
+        retry_or_fail("read: " + ec.message());
+        return;
+    }
+
+    auto status = m_parser->get().result_int();
+    m_progress->set_status(status);
+    // Remembered with the file, the next revalidation sends them back as they are
+    if (!m_download && (status == 200 || status == 206)) {
+        m_progress->set_validators(std::string(m_parser->get()[http::field::etag]),
+                                   std::string(m_parser->get()[http::field::last_modified]));
+    }
+    std::uint64_t range_first = 0;
+    std::uint64_t range_total = 0;
+    bool has_range = status == 206 &&
+        parse_content_range(m_parser->get()[http::field::content_range], range_first, range_total);
+
+    // A segment needs exactly the bytes it asked for
+    if (m_download) {
+        if (!has_range || range_first != m_range_begin + m_received || range_total != m_download->total_size()) {
+            retry_or_fail("range not served (HTTP " + std::to_string(status) + ")");
+            return;
+        }
+        if (!open_segment_file()) {
+            finish(false);
+            return;
+        }
+        m_header_time = std::chrono::steady_clock::now();
+        read_body();
+        return;
+    }
+
+    // The cached copy is still current, readers joining meanwhile get it as it is
+    if (m_revalidation && status == 304) {
+        release_connection(m_parser->is_done() && m_parser->keep_alive() && m_buffer.size() == 0);
+        m_not_modified = true;
+        std::error_code fs_ec;
+        auto size = fs::file_size(m_final_path, fs_ec);
+        if (!fs_ec) {
+            m_progress->relocate(m_final_path);
+            m_progress->start(size);
+            m_progress->advance(size);
+        }
+        finish(!fs_ec);
+        return;
+    }
+
+    // A resumed download goes on where the staging file ends
+    if (m_resume_offset > 0) {
+        if (has_range && range_first == m_resume_offset && (!m_total || range_total == *m_total)) {
+            resume_body(range_total);
+            return;
+        }
+        if (status == 206 || status == 416) {
+            // The partial file does not fit upstream's copy, start over
+            discard_resume();
+            release_connection(false);
+            start();
+            return;
+        }
+        if (status == 200) {
+            // If-Range failed: the file changed upstream, the whole new body follows
+            std::cout << "Upstream copy of " << m_request_path << " changed, restarting download" << std::endl;
+            discard_resume();
+        }
+    }
+
+    // A large file that the mirror serves in ranges is split, this response carries the first segment
+    if (m_may_split && status == 200 && m_parser->content_length() &&
+        *m_parser->content_length() > m_segment_threshold &&
+        m_parser->get()[http::field::accept_ranges] == "bytes") {
+        become_segmented(*m_parser->content_length());
+        return;
+    }
+
+    // Check if response is OK
+    if (status != 200) {
+        std::cerr << "Upstream returned HTTP " << status
+                  << " for " << m_request_path << std::endl;
+        // Don't retry on client errors (4xx), but retry on server errors (5xx)
+        // A mirror that is not synced yet may lack the file, ask the others first.
+        if (status >= 400 && status < 500) {
+            release_connection(false);
+            m_tried.push_back(m_mirror);
+            if (m_mirrors.select(m_tried)) {
+                start();
+                return;
+            }
+            // Gone upstream, a partial body is of no use anymore
+            discard_resume();
+            finish(false);
+            return;
+        }
+        retry_or_fail("HTTP error: " + std::to_string(status));
+        return;
+    }
+
+    // Create parent directories
+    std::error_code fs_ec;
+    fs::create_directories(fs::path(m_progress->file_path()).parent_path(), fs_ec);
+
+    // Open the staging file as the body destination
+    beast::error_code open_ec;
+    if (m_file.is_open()) {
+        m_file.close(open_ec);
+    }
+    m_file.open(m_progress->file_path().c_str(), beast::file_mode::write, open_ec);
+    m_bytes_written = 0;
+    m_digest.reset();
+    m_hashed = 0;
+    if (open_ec) {
+        std::cerr << "Failed to create cache file: " << m_progress->file_path()
+                  << " - " << open_ec.message() << std::endl;
+        finish(false);
+        return;
+    }
+
+    // Readers may start streaming now
+    m_header_time = std::chrono::steady_clock::now();
+    std::optional<std::uint64_t> content_length;
+    if (m_parser->content_length()) {
+        content_length = *m_parser->content_length();
+    }
+    remember_validator(content_length);
+    m_progress->start(content_length);
+
+    read_body();
+}
+
+void UpstreamFetch::read_body() {
+    if (m_download) {
+        if (m_received == m_range_end - m_range_begin) {
+            beast::error_code ec;
+            m_file.close(ec);
+            m_mirrors.report_success(m_mirror, m_header_time - m_attempt_start, m_bytes_written,
+                                     std::chrono::steady_clock::now() - m_header_time);
+            // The first segment cuts an open ended response short, its connection is closed
+            release_connection(m_parser->is_done() && m_parser->keep_alive() && m_buffer.size() == 0);
+            finish(true);
+            return;
+        }
+        if (m_parser->is_done()) {
+            beast::error_code ec;
+            m_file.close(ec);
+            retry_or_fail("range ended early");
+            return;
+        }
+        if (m_download->failed()) {
+            beast::error_code ec;
+            m_file.close(ec);
+            finish(false);
+            return;
+        }
+    } else if (m_parser->is_done()) {
+        beast::error_code ec;
+        m_file.close(ec);
+        if (!verify_body()) {
+            retry_or_fail("checksum mismatch");
+            return;
+        }
+        m_progress->advance(m_bytes_written);
+        std::cout << "Successfully fetched: " << m_request_path << std::endl;
+        m_mirrors.report_success(m_mirror, m_header_time - m_attempt_start, m_bytes_written,
+                                 std::chrono::steady_clock::now() - m_header_time);
+        // The connection can carry the next fetch unless the server wants it closed
+        release_connection(m_parser->keep_alive() && m_buffer.size() == 0);
+        finish(true);
+        return;
+    }
+
+    auto self = shared_from_this();
+
+    // Let the parser fill the fixed chunk buffer
+    m_parser->get().body().data = m_chunk.data();
+    m_parser->get().body().size = m_chunk.size();
+
+    m_stream.expires_after(std::chrono::seconds(m_read_timeout));
+    http::async_read_some(m_stream, m_buffer, *m_parser,
+        [self](beast::error_code ec, std::size_t) {
+            // A full chunk buffer is not an error
+            if (ec == http::error::need_buffer) {
+                ec = {};
+            }
+            self->on_body(ec);
+        });
+}
+
+void UpstreamFetch::on_body(const beast::error_code& ec) {
+    if (ec) {
+        beast::error_code close_ec;
+        m_file.close(close_ec);
+        retry_or_fail("read: " + ec.message());
+        return;
+    }
+
+    // Flush the chunk to disk, a segment stops at the end of its range
+    std::size_t received = m_chunk.size() - m_parser->get().body().size;
+    if (m_download) {
+        received = std::min<std::uint64_t>(received, m_range_end - m_range_begin - m_received);
+    }
+    if (received > 0) {
+        beast::error_code write_ec;
+        m_file.write(m_chunk.data(), received, write_ec);
+        if (write_ec) {
+            std::cerr << "Failed to write cache file: " << m_progress->file_path()
+                      << " - " << write_ec.message() << std::endl;
+            m_file.close(write_ec);
+            finish(false);
+            return;
+        }
+        m_bytes_written += received;
+        if (m_hash && !m_download) {
+            m_digest.update(m_chunk.data(), received);
+            m_hashed += received;
+        }
+
+        // Publish how much of the body is on disk
+        // Until a known digest is checked readers get all but the latest chunk, so a corrupt body never completes for them
+        if (m_download) {
+            m_received += received;
+            m_download->segment_written(m_segment, m_received);
+        } else if (m_expected_sha256.empty()) {
+            m_progress->advance(m_bytes_written);
+        } else {
+            m_progress->advance(m_bytes_written - received);
+        }
+    }
+
+    read_body();
+}
+
+void UpstreamFetch::retry_or_fail(const std::string& reason) {
+    // Drop the connection of the failed attempt
+    bool stale = m_leased && m_reused && !m_parser->is_header_done();
+    release_connection(false);
+
+    // A pooled connection closed by the server while idle, not a failed attempt
+    if (stale) {
+        start();
+        return;
+    }
+
+    // Fail over to the next mirror without waiting
+    m_mirrors.report_failure(m_mirror);
+    m_tried.push_back(m_mirror);
+    auto next = m_mirrors.select(m_tried);
+    if (next) {
+        std::cerr << "Fetch from " << m_mirrors.host(m_mirror) << " failed: " << reason
+                  << ", trying " << m_mirrors.host(*next) << std::endl;
+        start();
+        return;
+    }
+    m_tried.clear();
+
+    m_attempt++;
+    if (m_attempt >= m_max_retries) {
+        std::cerr << "Failed to fetch " << m_request_path
+                  << " after " << m_max_retries << " attempts: " << reason << std::endl;
+        finish(false);
+        return;
+    }
+
+    // Exponential backoff: 1s, 2s, 4s
+    int backoff_seconds = 1 << (m_attempt - 1);
+    std::cerr << "Fetch failed (attempt " << m_attempt << "/" << m_max_retries
+              << "): " << reason << ", retrying in " << backoff_seconds << "s..." << std::endl;
+
+    auto self = shared_from_this();
+    m_timer.expires_after(std::chrono::seconds(backoff_seconds));
+    m_timer.async_wait([self](const beast::error_code& ec) {
+        if (ec) {
+            self->finish(false);
+            return;
+        }
+        self->start();
+    });
+}
+
+void UpstreamFetch::release_connection(bool reusable) {
+    m_stream.expires_never();
+    if (!m_leased) {
+        beast::error_code ec;
+        m_stream.socket().close(ec);
+        return;
+    }
+    m_leased = false;
+    m_pool.release(m_pool_key, m_stream.socket(), reusable);
+}
+
+void UpstreamFetch::become_segmented(std::uint64_t total) {
+    // Segments are not resumed across restarts, the staging file starts empty
+    discard_resume();
+    std::string final_path = m_final_path;
+    std::string staging = m_progress->file_path();
+    std::error_code fs_ec;
+    fs::create_directories(fs::path(final_path).parent_path(), fs_ec);
+
+    // Reserve the whole file up front, segments land at their offsets
+    beast::error_code ec;
+    if (m_file.is_open()) {
+        m_file.close(ec);
+    }
+    m_file.open(staging.c_str(), beast::file_mode::write, ec);
+    if (!ec && ::posix_fallocate(m_file.native_handle(), 0, static_cast<off_t>(total)) != 0 &&
+        ::ftruncate(m_file.native_handle(), static_cast<off_t>(total)) != 0) {
+        ec = beast::error_code(errno, boost::system::generic_category());
+    }
+    if (ec) {
+        std::cerr << "Failed to create staging file: " << staging << " - " << ec.message() << std::endl;
+        m_file.close(ec);
+        fs::remove(staging, fs_ec);
+        finish(false);
+        return;
+    }
+
+    // The rest of the download reports to the segmented download
+    m_download = SegmentedDownload::create(m_executor, m_disk_executor, m_config, m_pool, m_mirrors, m_request_path,
+                                           m_progress, final_path, total, std::move(m_handler));
+    m_handler = nullptr;
+    if (!m_expected_sha256.empty()) {
+        m_download->expect_sha256(m_expected_sha256);
+    }
+    m_segment = m_download->claim_first();
+    m_range_begin = m_download->get_segment(m_segment).begin;
+    m_range_end = m_download->get_segment(m_segment).end;
+    m_received = 0;
+    m_bytes_written = 0;
+    m_header_time = std::chrono::steady_clock::now();
+    std::cout << "Fetching " << m_request_path << " (" << total << " bytes) in "
+              << m_download->segment_count() << " segments" << std::endl;
+
+    m_progress->start(total);
+    m_download->start();
+    read_body();
+}
+
+void UpstreamFetch::load_resume() {
+    std::ifstream in(resume_path(m_final_path));
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.starts_with("validator ")) {
+            m_validator = line.substr(10);
+        } else if (line.starts_with("length ")) {
+            try {
+                m_total = std::stoull(line.substr(7));
+            } catch (...) {
+                m_total.reset();
+            }
+        }
+    }
+
+    std::error_code ec;
+    auto size = fs::file_size(m_progress->file_path(), ec);
+    if (m_validator.empty() || ec || size == 0 || (m_total && size >= *m_total)) {
+        m_validator.clear();
+        m_total.reset();
+        return;
+    }
+    m_bytes_written = size;
+    std::cout << "Found " << size << " bytes of " << m_request_path << " from an earlier download" << std::endl;
+}
+
+void UpstreamFetch::remember_validator(std::optional<std::uint64_t> content_length) {
+    // If-Range needs a strong ETag, Last-Modified is the fallback
+    const auto& response = m_parser->get();
+    std::string etag(response[http::field::etag]);
+    m_validator = !etag.empty() && !etag.starts_with("W/") ? etag : std::string(response[http::field::last_modified]);
+    m_total = content_length;
+
+    std::error_code fs_ec;
+    if (m_validator.empty()) {
+        fs::remove(resume_path(m_final_path), fs_ec);
+        return;
+    }
+    std::ofstream out(resume_path(m_final_path), std::ios::trunc);
+    out << "validator " << m_validator << "\n";
+    if (m_total) {
+        out << "length " << *m_total << "\n";
+    }
+}
+
+void UpstreamFetch::discard_resume() {
+    m_validator.clear();
+    m_total.reset();
+    m_bytes_written = 0;
+    std::error_code fs_ec;
+    fs::remove(resume_path(m_final_path), fs_ec);
+}
+
+void UpstreamFetch::resume_body(std::uint64_t total) {
+    beast::error_code ec;
+    if (m_file.is_open()) {
+        m_file.close(ec);
+    }
+    m_file.open(m_progress->file_path().c_str(), beast::file_mode::write_existing, ec);
+    if (!ec) {
+        m_file.seek(m_resume_offset, ec);
+    }
+    if (ec) {
+        std::cerr << "Failed to open staging file: " << m_progress->file_path()
+                  << " - " << ec.message() << std::endl;
+        discard_resume();
+        finish(false);
+        return;
+    }
+    m_total = total;
+
+    // A retry of this fetch hashed the prefix as it wrote it, the bytes of an earlier
+    // download are read back off the io thread (seconds for a large file)
+    if (m_hash && m_hashed != m_resume_offset) {
+        m_digest.reset();
+        m_hashed = 0;
+        auto executor = net::prefer(m_executor, net::execution::outstanding_work.tracked);
+        // The last reference goes back with the result, the fetch is never destroyed off its executor
+        net::post(m_disk_executor, [self = shared_from_this(), executor]() mutable {
+            bool hashed = self->m_digest.update_file(self->m_progress->file_path(), self->m_resume_offset);
+            net::post(executor, [self = std::move(self), hashed]() { self->continue_resume(hashed); });
+        });
+        return;
+    }
+    continue_resume(true);
+}
+
+void UpstreamFetch::continue_resume(bool hashed) {
+    if (!hashed) {
+        std::cerr << "Failed to read staging file: " << m_progress->file_path() << std::endl;
+        beast::error_code ec;
+        m_file.close(ec);
+        discard_resume();
+        finish(false);
+        return;
+    }
+    if (m_hash) {
+        m_hashed = m_resume_offset;
+    }
+
+    std::cout << "Resuming " << m_request_path << " at byte " << m_resume_offset << std::endl;
+    m_header_time = std::chrono::steady_clock::now();
+    // Readers already following this fetch keep their place
+    if (!m_progress->snapshot().started) {
+        m_progress->start(m_total);
+    }
+    m_progress->advance(m_bytes_written);
+    read_body();
+}
+
+bool UpstreamFetch::open_segment_file() {
+    beast::error_code ec;
+    if (m_file.is_open()) {
+        m_file.close(ec);
+    }
+    m_file.open(m_progress->file_path().c_str(), beast::file_mode::write_existing, ec);
+    if (!ec) {
+        m_file.seek(m_range_begin + m_received, ec);
+    }
+    if (ec) {
+        std::cerr << "Failed to open staging file: " << m_progress->file_path()
+                  << " - " << ec.message() << std::endl;
+        return false;
+    }
+    m_bytes_written = 0;
+    return true;
+}
+
+bool UpstreamFetch::verify_body() {
+    if (!m_hash) {
+        return true;
+    }
+    std::string sha256 = m_digest.hex_digest();
+    m_hashed = 0;
+    if (m_expected_sha256.empty() || sha256 == m_expected_sha256) {
+        m_progress->set_sha256(sha256);
+        return true;
+    }
+
+    std::cerr << "Checksum mismatch for " << m_request_path << " from " << m_mirrors.host(m_mirror)
+              << ": expected " << m_expected_sha256 << ", got " << sha256 << std::endl;
+    // Neither commit nor resume a corrupt body, nor let readers finish relaying it
+    discard_resume();
+    std::error_code fs_ec;
+    fs::remove(m_progress->file_path(), fs_ec);
+    m_progress->reset();
+    return false;
+}
+
+void UpstreamFetch::finish(bool success) {
+    // Close the connection unless it went back to the pool already
+    release_connection(false);
+
+    // A segment leaves the file and the handler to its download
+    if (m_download) {
+        auto download = std::move(m_download);
+        download->segment_finished(m_segment, success);
+        return;
+    }
+
+    // Publish the complete file under its cache path, the fsyncs can take long on a busy disk
+    if (success && !m_not_modified) {
+        auto executor = net::prefer(m_executor, net::execution::outstanding_work.tracked);
+        net::post(m_disk_executor, [self = shared_from_this(), executor]() mutable {
+            bool committed = self->m_progress->commit(self->m_final_path, self->m_config.get_commit_fsync());
+            net::post(executor, [self = std::move(self), committed]() { self->conclude(committed); });
+        });
+        return;
+    }
+    conclude(success);
+}
+
+void UpstreamFetch::conclude(bool success) {
+    std::error_code fs_ec;
+    if (!success && !m_validator.empty() && m_bytes_written > 0) {
+        // The next fetch of the path continues from here, even after a restart
+        std::cerr << "Keeping " << m_bytes_written << " bytes of " << m_request_path
+                  << " to resume later" << std::endl;
+    } else {
+        // Never leave a partial body behind
+        if (!success) {
+            fs::remove(m_progress->file_path(), fs_ec);
+        }
+        fs::remove(resume_path(m_final_path), fs_ec);
+    }
+
+    if (m_handler) {
+        auto handler = std::move(m_handler);
+        m_handler = nullptr;
+        handler(success);
+    }
+}
+
+// SegmentedDownload implementation
+
+SegmentedDownload::SegmentedDownload(net::any_io_executor executor,
+                                     net::any_io_executor disk_executor,
+                                     const Config& config,
+                                     UpstreamPool& pool,
+                                     MirrorSet& mirrors,
+                                     const std::string& request_path,
+                                     std::shared_ptr<FetchProgress> progress,
+                                     const std::string& final_path,
+                                     std::uint64_t total,
+                                     fetch_handler handler)
+    : m_executor(executor),
+      m_disk_executor(disk_executor),
+      m_config(config),
+      m_pool(pool),
+      m_mirrors(mirrors),
+      m_request_path(request_path),
+      m_progress(std::move(progress)),
+      m_final_path(final_path),
+      m_total(total),
+      m_handler(std::move(handler)),
+      m_parallelism(config.get_segment_parallelism()) {
+    std::uint64_t segment_size = config.get_segment_size();
+    for (std::uint64_t begin = 0; begin < total; begin += segment_size) {
+        m_segments.push_back({begin, std::min(begin + segment_size, total)});
+    }
+}
+
+std::size_t SegmentedDownload::claim_first() {
+    m_segments[0].state = segment::status::active;
+    m_active++;
+    return 0;
+}
+
+void SegmentedDownload::start() {
+    spawn();
+}
+
+void SegmentedDownload::spawn() {
+    auto self = shared_from_this();
+    for (std::size_t i = 0; i < m_segments.size() && m_active < m_parallelism; i++) {
+        if (m_segments[i].state != segment::status::pending) {
+            continue;
+        }
+        m_segments[i].state = segment::status::active;
+        m_active++;
+        UpstreamFetch::create_segment(m_executor, m_disk_executor, m_config, m_pool, m_mirrors, m_request_path,
+                                      m_progress, self, i)->start();
+    }
+}
+
+void SegmentedDownload::segment_written(std::size_t index, std::uint64_t received) {
+    m_segments[index].received = received;
+
+    // Readers follow the bytes on disk without a gap from offset 0
+    std::uint64_t prefix = 0;
+    for (const auto& range : m_segments) {
+        prefix = range.begin + range.received;
+        if (range.received < range.end - range.begin) {
+            break;
+        }
+    }
+    // The last chunk waits for the digest check, as with a single fetch
+    if (!m_expected_sha256.empty()) {
+        prefix = std::min(prefix, m_total - std::min<std::uint64_t>(m_total, m_config.get_fetch_buffer_size()));
+    }
+    if (prefix > m_prefix) {
+        m_prefix = prefix;
+        m_progress->advance(prefix);
+    }
+}
+
+void SegmentedDownload::segment_finished(std::size_t index, bool success) {
+    m_active--;
+    if (success) {
+        m_segments[index].state = segment::status::done;
+    } else {
+        m_failed = true;
+    }
+
+    if (!m_failed) {
+        spawn();
+    }
+    if (m_active == 0) {
+        complete();
+    }
+}
+
+void SegmentedDownload::complete() {
+    if (!m_handler) {
+        return;
+    }
+    auto handler = std::move(m_handler);
+    m_handler = nullptr;
+
+    bool success = !m_failed && std::all_of(m_segments.begin(), m_segments.end(), [](const segment& range) {
+        return range.state == segment::status::done;
+    });
+    if (!success) {
+        std::error_code fs_ec;
+        fs::remove(m_progress->file_path(), fs_ec);
+        std::cerr << "Failed to fetch " << m_request_path << " in segments" << std::endl;
+        handler(false);
+        return;
+    }
+
+    // Reading back a file of several GB blocks for seconds, readers wait until it is committed
+    bool hash = m_config.get_dedup() || m_config.get_scrub_interval() > 0 || !m_expected_sha256.empty();
+    auto executor = net::prefer(m_executor, net::execution::outstanding_work.tracked);
+    net::post(m_disk_executor, [self = shared_from_this(), executor, hash, handler = std::move(handler)]() mutable {
+        bool committed = self->verify_and_commit(hash);
+        net::post(executor, [self = std::move(self), handler = std::move(handler), committed]() { handler(committed); });
+    });
+}
+
+bool SegmentedDownload::verify_and_commit(bool hash) {
+    bool success = true;
+    if (hash) {
+        Digest digest;
+        std::string sha256 = digest.update_file(m_progress->file_path(), m_total) ? digest.hex_digest() : "";
+        if (!m_expected_sha256.empty() && sha256 != m_expected_sha256) {
+            std::cerr << "Checksum mismatch for " << m_request_path << ": expected " << m_expected_sha256
+                      << ", got " << sha256 << std::endl;
+            success = false;
+        } else {
+            m_progress->set_sha256(sha256);
+            m_progress->advance(m_total);
+        }
+    }
+    if (success) {
+        success = m_progress->commit(m_final_path, m_config.get_commit_fsync());
+    }
+    if (!success) {
+        std::error_code fs_ec;
+        fs::remove(m_progress->file_path(), fs_ec);
+        std::cerr << "Failed to fetch " << m_request_path << " in segments" << std::endl;
+    }
+    return success;
+}
@@ -0,0 +1,160 @@
+#include <memory>
+#include <optional>
+#include <algorithm>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <console/io/upstream_pool.hpp>
+
+// UpstreamPool implementation
+
+UpstreamPool::UpstreamPool(std::size_t max_per_host,
+                           std::chrono::seconds idle_timeout,
+                           std::chrono::seconds dns_ttl,
+                           bool keep_alive)
+    : m_max_per_host(std::max<std::size_t>(max_per_host, 1)),
+      m_idle_timeout(idle_timeout),
+      m_dns_ttl(dns_ttl),
+      m_keep_alive(keep_alive) {}
+
+UpstreamPool::~UpstreamPool() {
+    for (auto& [key, host] : m_hosts) {
+        for (auto& connection : host.idle) {
+            ::close(connection.fd);
+        }
+    }
+}
+
+void UpstreamPool::async_resolve(net::any_io_executor executor, const std::string& host, const std::string& port,
+                                 resolve_handler handler) {
+    std::string key = host + ":" + port;
+    if (m_dns_ttl.count() > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_dns.find(key);
+        if (it != m_dns.end() && it->second.expires > std::chrono::steady_clock::now()) {
+            m_dns_hits++;
+            net::post(executor, [handler = std::move(handler), endpoints = it->second.endpoints]() mutable {
+                handler({}, std::move(endpoints));
+            });
+            return;
+        }
+    }
+
+    auto resolver = std::make_shared<tcp::resolver>(executor);
+    resolver->async_resolve(host, port,
+        [this, resolver, key, handler = std::move(handler)](const beast::error_code& ec, tcp::resolver::results_type results) {
+            std::vector<tcp::endpoint> endpoints;
+            for (const auto& result : results) {
+                endpoints.push_back(result.endpoint());
+            }
+            // Failures are not cached, the next fetch asks again
+            if (!ec && !endpoints.empty() && m_dns_ttl.count() > 0) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_dns[key] = {endpoints, std::chrono::steady_clock::now() + m_dns_ttl};
+            }
+            handler(ec, std::move(endpoints));
+        });
+}
+
+bool UpstreamPool::take_idle(host_state& host, idle_connection& connection) {
+    auto now = std::chrono::steady_clock::now();
+    while (!host.idle.empty()) {
+        connection = host.idle.back();
+        host.idle.pop_back();
+
+        // An idle HTTP connection has nothing to read; readable means the server closed it
+        pollfd pfd{connection.fd, POLLIN, 0};
+        bool expired = now - connection.since > m_idle_timeout;
+        if (!expired && ::poll(&pfd, 1, 0) == 0) {
+            return true;
+        }
+        ::close(connection.fd);
+        host.open--;
+    }
+    return false;
+}
+
+void UpstreamPool::grant(waiter w, const idle_connection* connection) {
+    // Keep the waiter's context running until the handler ran
+    auto executor = net::prefer(w.executor, net::execution::outstanding_work.tracked);
+    bool reused = connection != nullptr;
+    int fd = reused ? connection->fd : -1;
+    bool v6 = reused && connection->v6;
+    if (reused) {
+        m_reused++;
+    }
+
+    net::post(executor, [w = std::move(w), fd, v6, reused]() {
+        if (reused) {
+            beast::error_code ec;
+            w.socket->assign(v6 ? tcp::v6() : tcp::v4(), fd, ec);
+            if (ec) {
+                // Handled like a stale connection: the first write fails and the fetch reconnects
+                ::close(fd);
+            }
+        }
+        w.handler(reused);
+    });
+}
+
+void UpstreamPool::async_acquire(net::any_io_executor executor, const std::string& host_key, tcp::socket& socket,
+                                 acquire_handler handler) {
+    waiter w{executor, &socket, std::move(handler)};
+    idle_connection connection;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& host = m_hosts[host_key];
+        if (!take_idle(host, connection)) {
+            if (host.open >= m_max_per_host) {
+                // Tracked, so a synchronous caller's io_context does not run out of work meanwhile
+                w.executor = net::prefer(w.executor, net::execution::outstanding_work.tracked);
+                host.waiters.push_back(std::move(w));
+                return;
+            }
+            host.open++;
+            grant(std::move(w), nullptr);
+            return;
+        }
+    }
+    grant(std::move(w), &connection);
+}
+
+void UpstreamPool::release(const std::string& host_key, tcp::socket& socket, bool reusable) {
+    beast::error_code ec;
+    std::optional<idle_connection> connection;
+    if (reusable && m_keep_alive && socket.is_open()) {
+        bool v6 = socket.local_endpoint(ec).address().is_v6();
+        int fd = ec ? -1 : socket.release(ec);
+        if (!ec && fd >= 0) {
+            connection = idle_connection{fd, v6, std::chrono::steady_clock::now()};
+        }
+    }
+    if (!connection) {
+        socket.shutdown(tcp::socket::shutdown_both, ec);
+        socket.close(ec);
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto& host = m_hosts[host_key];
+    if (host.waiters.empty()) {
+        if (connection) {
+            host.idle.push_back(*connection);
+        } else {
+            host.open--;
+        }
+        return;
+    }
+
+    // The slot (and the connection, if kept) goes straight to the next waiting fetch
+    waiter next = std::move(host.waiters.front());
+    host.waiters.pop_front();
+    lock.unlock();
+    grant(std::move(next), connection ? &*connection : nullptr);
+}
+
+std::size_t UpstreamPool::idle_count(const std::string& host_key) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_hosts.find(host_key);
+    return it == m_hosts.end() ? 0 : it->second.idle.size();
+}
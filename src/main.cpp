@@ -28,7 +28,22 @@ int main(int argc, char* argv[]) {
     std::string upstream = config.get_upstream();
     std::string cache_dir = config.get_cache_dir();
     std::cout << "Upstream: " << upstream << std::endl;
+    if (MirrorSet::parse_hosts(upstream).size() > 1) {
+        std::cout << "Upstream mirrors: " << MirrorSet::parse_hosts(upstream).size()
+                  << ", probed every " << config.get_mirror_probe_interval() << "s when down" << std::endl;
+    }
     std::cout << "Cache directory: " << cache_dir << std::endl;
+    if (config.get_cache_max_bytes() > 0) {
+        std::cout << "Cache budget: " << config.get_cache_max_bytes() << " bytes" << std::endl;
+    }
+    if (config.get_memory_tier_bytes() > 0) {
+        std::cout << "Memory tier: " << config.get_memory_tier_bytes() << " bytes, files up to "
+                  << config.get_memory_tier_max_object() << " bytes" << std::endl;
+    }
+    std::cout << "Upstream connections: " << config.get_upstream_max_connections() << " per host"
+              << (config.get_upstream_keep_alive() ? ", keep-alive" : "") << std::endl;
+    std::size_t worker_threads = config.get_worker_threads();
+    std::cout << "Worker threads: " << worker_threads << std::endl;
 
     // Init DHT.
     std::cout << "Initing DHT..." << std::endl;
@@ -49,24 +64,42 @@ int main(int argc, char* argv[]) {
     // Init server.
     std::cout << "Starting HTTP server..." << std::endl;
     try {
-        // Create IO context
-        boost::asio::io_context io_context;
+        // Create IO context pool, one event loop per worker thread
+        IoContextPool pool(worker_threads);
 
         // Create server instance
-        auto server = ServerTrans::create(io_context, router);
+        auto server = ServerTrans::create(pool, router, config.get_reuse_port());
+        server->set_zero_copy(config.get_zero_copy());
+        if (config.get_io_engine() == "io_uring") {
+            if (server->set_io_engine(io_engine::io_uring)) {
+                std::cout << "I/O engine: io_uring" << std::endl;
+            } else {
+                std::cerr << "io_uring engine not available in this build, using epoll" << std::endl;
+            }
+        }
 
         // Sing up exit process.
-        boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
+        boost::asio::signal_set signals(pool.get_io_context(0), SIGINT, SIGTERM);
         signals.async_wait([&](auto, auto) {
             std::cout << "Shutting down pacPrism..." << std::endl;
-            io_context.stop();
+            pool.stop();
         });
 
         // Start server on 0.0.0.0 with specified port
         server->start_server(boost::asio::ip::make_address("0.0.0.0"), parser.get_port());
 
-        // Run the IO context
-        io_context.run();
+        // Run the IO contexts
+        pool.run();
+
+        // Fetches still committing report back to the IO contexts, let them finish first
+        cache.wait_for_disk_work();
+
+        // Show how evenly connections were spread over the acceptors
+        std::cout << "Accepted connections per acceptor:";
+        for (auto count : server->get_accept_counts()) {
+            std::cout << " " << count;
+        }
+        std::cout << std::endl;
     } catch (const std::exception& e) {
         std::cerr << "Server error: " << e.what() << std::endl;
         return 1;
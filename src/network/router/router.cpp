@@ -12,6 +12,9 @@
 
 using json = nlohmann::json;
 
+// Server header value, formatted once
+static const std::string server_header = std::format("pacPrism/{}", pacprism::getVersionFull());
+
 Router::Router(DHT_operation& dht, Validator& validator, FileCache& cache)
     : m_dht(dht), m_validator(validator), m_cache(cache) {};
 
@@ -118,7 +121,7 @@ router_response Router::node_response_router(const http::request<http::string_bo
                 }
 
                 if (!shard_id.empty()) {
-                    const std::set<std::string>* node_ids = m_dht.query_node_ids_by_shard_id(shard_id);
+                    auto node_ids = m_dht.query_node_ids_by_shard_id(shard_id);
                     if (node_ids != nullptr) {
                         response_json = {
                             {"operation", "query"},
@@ -169,6 +172,35 @@ router_response Router::node_response_router(const http::request<http::string_bo
                 };
                 status_code = http::status::not_found;
             }
+        } else if (target == "/api/cache/stats" && request.method() == http::verb::get) {
+            // GET /api/cache/stats
+            auto& negative = m_cache.get_negative_cache();
+            std::uint64_t lookups = negative.get_hits() + negative.get_misses();
+            auto blobs = m_cache.get_blob_store().get_stats();
+            auto* scrubber = m_cache.get_scrubber();
+            response_json = {
+                {"cached_bytes", m_cache.get_cached_bytes()},
+                {"cached_files", m_cache.get_index().size()},
+                {"negative_cache", {
+                    {"entries", negative.size()},
+                    {"hits", negative.get_hits()},
+                    {"misses", negative.get_misses()},
+                    {"hit_rate", lookups > 0 ? static_cast<double>(negative.get_hits()) / lookups : 0.0}
+                }},
+                {"scrub", {
+                    {"files", scrubber ? scrubber->get_scrubbed_files() : 0},
+                    {"bytes", scrubber ? scrubber->get_scrubbed_bytes() : 0},
+                    {"corrupt", scrubber ? scrubber->get_corrupt_files() : 0}
+                }},
+                {"dedup", {
+                    {"blobs", blobs.blobs},
+                    {"stored_bytes", blobs.stored_bytes},
+                    {"linked_bytes", blobs.linked_bytes},
+                    {"saved_bytes", blobs.linked_bytes - blobs.stored_bytes},
+                    {"ratio", blobs.stored_bytes > 0 ? static_cast<double>(blobs.linked_bytes) / blobs.stored_bytes : 1.0}
+                }}
+            };
+            status_code = http::status::ok;
         } else {
             response_json = {
                 {"status", "error"},
@@ -187,19 +219,68 @@ router_response Router::node_response_router(const http::request<http::string_bo
     // Build JSON response
     auto response = std::make_shared<http::response<http::string_body>>(status_code, request.version());
     response->set(http::field::content_type, "application/json");
-    response->set("server", std::format("pacPrism/{}", pacprism::getVersionFull()));
+    response->set(http::field::server, server_header);
     response->body() = response_json.dump(4); // Pretty print with 4-space indent
     response->prepare_payload();
 
     return response;
 }
 
-router_response Router::plain_response_router(const http::request<http::string_body>& request) {
+void Router::async_global_router(const http::request<http::string_body>& request,
+                                 net::any_io_executor executor,
+                                 router_handler handler) {
+    // Only file requests from plain clients may need to wait on upstream
+    std::string file_path;
+    if (m_validator.validate_request(request) == RequestType::PlainClient) {
+        file_path = extract_file_path(request);
+    }
+
+    if (file_path.empty()) {
+        handler(global_router(request));
+        return;
+    }
+
+    // Plain downloads of a missing file are streamed while upstream sends it
+    bool plain_download = request.find(http::field::range) == request.end() &&
+                          request.find(http::field::if_modified_since) == request.end() &&
+                          request.find(http::field::if_none_match) == request.end();
+    // Small hot files are answered straight from memory
+    if (plain_download) {
+        if (auto object = m_cache.get_memory_object(file_path, request.version())) {
+            handler(object);
+            return;
+        }
+    }
+    if (plain_download && !m_cache.is_cached(file_path)) {
+        auto version = request.version();
+        m_cache.async_fetch_streaming(executor, file_path, version,
+            [this, file_path, version, handler = std::move(handler)](std::shared_ptr<streaming_response> response) {
+                if (!response) {
+                    handler(upstream_failure_response(file_path, version));
+                    return;
+                }
+                handler(response);
+            });
+        return;
+    }
+
+    // Complete the response once the file is cached, other connections keep being served meanwhile
+    auto shared_request = std::make_shared<http::request<http::string_body>>(request);
+    m_cache.async_ensure_cached(executor, file_path,
+        [this, file_path, shared_request, handler = std::move(handler)](bool cached) {
+            if (!cached) {
+                handler(upstream_failure_response(file_path, shared_request->version()));
+                return;
+            }
+            handler(plain_response_router(*shared_request));
+        });
+}
+
+std::string Router::extract_file_path(const http::request<http::string_body>& request) const {
     // Get the request target (path + query)
     std::string request_target = request.target();
 
     // Check if request has 'target' parameter in query string
-    std::string target;
     auto target_pos = request_target.find('?');
     if (target_pos != std::string::npos) {
         // Parse query string for target parameter
@@ -208,14 +289,38 @@ router_response Router::plain_response_router(const http::request<http::string_b
         if (target_start != std::string::npos) {
             target_start += 7; // Skip "target="
             size_t target_end = query_string.find('&', target_start);
+            std::string target;
             if (target_end == std::string::npos) {
                 target = query_string.substr(target_start);
             } else {
                 target = query_string.substr(target_start, target_end - target_start);
             }
+            if (!target.empty()) {
+                // Request has target parameter (e.g., /?target=/debian/pool/...)
+                return (target[0] == '/') ? target : "/" + target;
+            }
         }
     }
 
+    // No target parameter in query string
+    // Check if the request path is not just "/" (i.e., it's a file request)
+    std::string path = (target_pos != std::string::npos) ? request_target.substr(0, target_pos) : request_target;
+    if (path != "/") {
+        // This is a direct file path request (e.g., /debian/pool/main/...)
+        return path;
+    }
+
+    return "";
+}
+
+router_response Router::plain_response_router(const http::request<http::string_body>& request) {
+    std::string path = extract_file_path(request);
+
+    // Request is just "/" with no target parameter - return hello message
+    if (path.empty()) {
+        return default_response_builder("Hello from pacPrism!", request.version(), http::status::ok);
+    }
+
     // Check for Range header
     std::string range_header;
     auto range_it = request.find(http::field::range);
@@ -237,79 +342,40 @@ router_response Router::plain_response_router(const http::request<http::string_b
     // Determine if we have conditional headers
     bool has_conditional = !if_modified_since.empty() || !if_none_match.empty();
 
-    // If target parameter exists, try to serve from cache
-    if (!target.empty()) {
-        // Request has target parameter (e.g., /?target=/debian/pool/...)
-        std::string target_path = (target[0] == '/') ? target : "/" + target;
-
-        std::shared_ptr<http::response<http::file_body>> file_response;
-
-        // Priority: Range > Conditional > Normal
-        if (!range_header.empty()) {
-            // Range request takes priority
-            file_response = m_cache.get_or_fetch_with_range(target_path, request.version(), range_header);
-        } else if (has_conditional) {
-            // Conditional request - returns variant
-            auto cache_response = m_cache.get_or_fetch_with_conditional(target_path, request.version(), if_modified_since, if_none_match);
-            // Convert variant to router_response
-            if (std::holds_alternative<std::shared_ptr<http::response<http::file_body>>>(cache_response)) {
-                return std::get<std::shared_ptr<http::response<http::file_body>>>(cache_response);
-            } else {
-                return std::get<std::shared_ptr<http::response<http::empty_body>>>(cache_response);
-            }
-        } else {
-            // Normal request
-            file_response = m_cache.get_or_fetch(target_path, request.version());
+    // Priority: Range > Conditional > Normal
+    if (has_conditional && range_header.empty()) {
+        // Conditional request - returns variant
+        auto cache_response = m_cache.get_or_fetch_with_conditional(path, request.version(), if_modified_since, if_none_match);
+        // Convert variant to router_response
+        if (std::holds_alternative<std::shared_ptr<http::response<http::empty_body>>>(cache_response)) {
+            return std::get<std::shared_ptr<http::response<http::empty_body>>>(cache_response);
         }
-
-        if (file_response) {
+        if (auto file_response = std::get<std::shared_ptr<http::response<http::file_body>>>(cache_response)) {
             return file_response;
         }
-        return default_response_builder("Failed to fetch file from upstream.", request.version(), http::status::bad_gateway);
+    } else if (auto object = range_header.empty() ? m_cache.get_memory_object(path, request.version()) : nullptr) {
+        // Normal request for a small hot file
+        return object;
+    } else if (auto hit = m_cache.get_file_hit(path, request.version(), range_header)) {
+        // Range or normal request, the header comes prepared from the index
+        return hit;
     }
+    return upstream_failure_response(path, request.version());
+}
 
-    // No target parameter in query string
-    // Check if the request path is not just "/" (i.e., it's a file request)
-    std::string path = (target_pos != std::string::npos) ? request_target.substr(0, target_pos) : request_target;
-
-    if (path != "/" && !path.empty()) {
-        // This is a direct file path request (e.g., /debian/pool/main/...)
-        // Try to serve from cache
-
-        std::shared_ptr<http::response<http::file_body>> file_response;
-
-        // Priority: Range > Conditional > Normal
-        if (!range_header.empty()) {
-            // Range request takes priority
-            file_response = m_cache.get_or_fetch_with_range(path, request.version(), range_header);
-        } else if (has_conditional) {
-            // Conditional request - returns variant
-            auto cache_response = m_cache.get_or_fetch_with_conditional(path, request.version(), if_modified_since, if_none_match);
-            // Convert variant to router_response
-            if (std::holds_alternative<std::shared_ptr<http::response<http::file_body>>>(cache_response)) {
-                return std::get<std::shared_ptr<http::response<http::file_body>>>(cache_response);
-            } else {
-                return std::get<std::shared_ptr<http::response<http::empty_body>>>(cache_response);
-            }
-        } else {
-            // Normal request
-            file_response = m_cache.get_or_fetch(path, request.version());
-        }
-
-        if (file_response) {
-            return file_response;
-        }
-        return default_response_builder("Failed to fetch file from upstream.", request.version(), http::status::bad_gateway);
+router_response Router::upstream_failure_response(const std::string& file_path, std::size_t version) {
+    // Files upstream does not have are reported as missing, anything else as a gateway error
+    auto status = m_cache.get_negative_cache().peek(file_path);
+    if (status == 404 || status == 410) {
+        return default_response_builder("File not found upstream.", version, static_cast<http::status>(*status));
     }
-
-    // Request is just "/" with no target parameter - return hello message
-    return default_response_builder("Hello from pacPrism!", request.version(), http::status::ok);
+    return default_response_builder("Failed to fetch file from upstream.", version, http::status::bad_gateway);
 }
 
 router_response Router::default_response_builder(const std::string& body_string, size_t version, http::status status) {
     auto response = std::make_shared<http::response<http::string_body>>(status, version);
     response->body() = body_string;
-    response->set("server", std::format("pacPrism/{}", pacprism::getVersionFull()));
+    response->set(http::field::server, server_header);
     response->prepare_payload();
     return response;
 }
@@ -3,6 +3,15 @@
 #include <memory>
 #include <array>
 #include <variant>
+#include <thread>
+#include <algorithm>
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
 
 #include <boost/beast.hpp>
 #include <boost/asio.hpp>
@@ -11,37 +20,144 @@
 #include <pacPrism/version.h>
 #include <network/router/router.hpp>
 
+// IoContextPool implementation
+IoContextPool::IoContextPool(std::size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    for (std::size_t i = 0; i < size; i++) {
+        m_io_contexts.push_back(std::make_unique<worker_context>(1));
+        // Keep contexts running while they have no connections.
+        m_work_guards.push_back(net::make_work_guard(*m_io_contexts.back()));
+    }
+}
+
+IoContextPool::~IoContextPool() {
+    // Pending handlers may own sockets of another worker, destroy all of them
+    // while every context is still alive.
+    m_work_guards.clear();
+    for (auto& io_context : m_io_contexts) {
+        io_context->shutdown();
+    }
+}
+
+net::io_context& IoContextPool::get_io_context() {
+    return *m_io_contexts[m_next++ % m_io_contexts.size()];
+}
+
+net::io_context& IoContextPool::get_io_context(std::size_t index) {
+    return *m_io_contexts[index % m_io_contexts.size()];
+}
+
+void IoContextPool::run() {
+    std::vector<std::thread> threads;
+    for (auto& io_context : m_io_contexts) {
+        threads.emplace_back([&io_context]() { io_context->run(); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void IoContextPool::stop() {
+    for (auto& io_context : m_io_contexts) {
+        io_context->stop();
+    }
+}
+
 // ServerTrans implementation
 ServerTrans::ServerTrans(net::io_context& io_context, Router& router)
     : m_io_context(io_context), m_router(router) {}
 
+ServerTrans::ServerTrans(IoContextPool& pool, Router& router, bool reuse_port)
+    : m_io_context(pool.get_io_context(0)), m_pool(&pool), m_reuse_port(reuse_port), m_router(router) {}
+
 void ServerTrans::start_server(const net::ip::address& address, unsigned short port) {
     using tcp = net::ip::tcp;
 
     auto self = shared_from_this();
 
+    // sendfile has no MSG_NOSIGNAL, a client hanging up must not kill the process.
+    if (m_zero_copy) {
+        std::signal(SIGPIPE, SIG_IGN);
+    }
+
     // Create an endpoint.
     tcp::endpoint endpoint(address, port);
-    // Create an acceptor.
-    m_acceptor = std::make_unique<tcp::acceptor> (m_io_context, endpoint);
+    // One acceptor per worker with SO_REUSEPORT, otherwise a single one.
+    bool sharded = m_pool && m_reuse_port;
+    std::size_t shards = sharded ? m_pool->size() : 1;
+    for (std::size_t i = 0; i < shards; i++) {
+        // Create an acceptor on its worker's context.
+        auto& io_context = sharded ? m_pool->get_io_context(i) : m_io_context;
+        auto shard = std::make_unique<acceptor_shard>();
+        shard->acceptor = std::make_unique<tcp::acceptor>(io_context);
+        shard->acceptor->open(endpoint.protocol());
+        shard->acceptor->set_option(tcp::acceptor::reuse_address(true));
+        if (sharded) {
+            int enable = 1;
+            if (::setsockopt(shard->acceptor->native_handle(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0) {
+                throw boost::system::system_error(errno, boost::system::system_category(), "SO_REUSEPORT");
+            }
+        }
+        shard->acceptor->bind(endpoint);
+        shard->acceptor->listen();
+        m_acceptors.push_back(std::move(shard));
+    }
     // Print message.
-    std::cout << "Server started, listening on port " << port << std::endl;
+    std::cout << "Server started, listening on port " << port;
+    if (sharded) {
+        std::cout << " with " << shards << " SO_REUSEPORT acceptors";
+    }
+    std::cout << std::endl;
     // Start accepting.
-    self->start_accept();
+    for (std::size_t i = 0; i < m_acceptors.size(); i++) {
+        self->start_accept(i);
+    }
+}
+
+bool ServerTrans::set_io_engine(io_engine engine) {
+    if (engine == io_engine::io_uring && !io_uring_available()) {
+        return false;
+    }
+    m_io_engine = engine;
+    return true;
+}
+
+bool ServerTrans::io_uring_available() {
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::vector<std::uint64_t> ServerTrans::get_accept_counts() const {
+    std::vector<std::uint64_t> counts;
+    for (const auto& shard : m_acceptors) {
+        counts.push_back(shard->accepted.load());
+    }
+    return counts;
 }
 
-void ServerTrans::start_accept() {
+void ServerTrans::start_accept(std::size_t index) {
     auto self = shared_from_this();
-    auto socket = std::make_shared<tcp::socket>(m_io_context);
+    auto& shard = *m_acceptors[index];
+    // Bind the connection to a worker, it stays there for its whole life.
+    // Sharded acceptors keep connections on their own worker, otherwise round-robin.
+    auto& io_context = (m_pool && !m_reuse_port) ? m_pool->get_io_context()
+                                                : static_cast<net::io_context&>(shard.acceptor->get_executor().context());
+    auto socket = std::make_shared<tcp::socket>(io_context);
 
     // Accept a connection.
-    m_acceptor->async_accept(*socket, [self, socket](const boost::system::error_code& error) {
+    shard.acceptor->async_accept(*socket, [self, socket, index](const boost::system::error_code& error) {
         // Prepare varibles.
         auto buffer = std::make_shared<beast::flat_buffer>();
         auto req_parser = std::make_shared<http::request_parser<http::string_body>>();
         if (!error) {
+            self->m_acceptors[index]->accepted++;
             self->read_from_connection(socket, buffer, req_parser);
-            self->start_accept();
+            self->start_accept(index);
         } else {
             std::cerr << "Accept error: " << error.message() << std::endl;
         }
@@ -58,7 +174,7 @@ void ServerTrans::read_from_connection(std::shared_ptr<tcp::socket> socket,
     req_parser->body_limit(1024 * 1024);
 
     http::async_read(*socket, *buffer, *req_parser,
-        [self, socket, buffer, req_parser](const boost::system::error_code& error, size_t bytes_transferred) {
+        [self, socket, buffer, req_parser](const boost::system::error_code& error, size_t) {
             if (!error) {
                 // Request parsing complete, process it
                 auto request = req_parser->release();
@@ -76,34 +192,437 @@ void ServerTrans::read_from_connection(std::shared_ptr<tcp::socket> socket,
 void ServerTrans::response_builder(std::shared_ptr<tcp::socket> socket, const http::request<http::string_body>& request) {
     auto self = shared_from_this();
 
-    // Route.
-    auto response = m_router.global_router(request);
-
-    // Send the response.
-    self->response_sender(socket, response);
+    // Route, cache misses complete later without holding up other connections.
+    m_router.async_global_router(request, socket->get_executor(),
+        [self, socket](router_response response) {
+            // Send the response.
+            self->response_sender(socket, response);
+        });
 }
 
 void ServerTrans::response_sender(std::shared_ptr<tcp::socket> socket, router_response response) {
     auto self = shared_from_this();
 
     std::visit([self, socket](auto&& concrete_response) {
+        using response_type = std::decay_t<decltype(concrete_response)>;
+        if constexpr (std::is_same_v<response_type, std::shared_ptr<streaming_response>>) {
+            // Body is still arriving from upstream.
+            self->stream_sender(socket, concrete_response);
+        } else if constexpr (std::is_same_v<response_type, std::shared_ptr<file_hit_response>>) {
+            // Cache hit with the header prepared in the index entry.
+            self->hit_sender(socket, concrete_response);
+        } else if constexpr (std::is_same_v<response_type, std::shared_ptr<const memory_object>>) {
+            // Prepared header and body in one buffer, a single write.
+            net::async_write(*socket, net::buffer(concrete_response->wire),
+                [self, socket, concrete_response](const boost::system::error_code& error, size_t) {
+                    if (error) return;
+                    self->finish_response(socket, true);
+                });
+        } else if constexpr (std::is_same_v<response_type, std::shared_ptr<http::response<http::file_body>>>) {
+#if defined(BOOST_ASIO_HAS_IO_URING)
+            if (self->m_io_engine == io_engine::io_uring) {
+                self->uring_sender(socket, concrete_response);
+                return;
+            }
+#endif
+            // Cached file, let the kernel copy it straight to the socket.
+            if (self->m_zero_copy) {
+                self->sendfile_sender(socket, concrete_response);
+                return;
+            }
+            http::async_write(*socket, *concrete_response,
+                [self, socket, concrete_response](const boost::system::error_code& error, size_t) {
+                    if (error) return;
+                    self->finish_response(socket, concrete_response->keep_alive());
+                });
+        } else {
             http::async_write(*socket, *concrete_response,
-        [self, socket, concrete_response](const boost::system::error_code& error, size_t bytes_transferred) {
+                [self, socket, concrete_response](const boost::system::error_code& error, size_t) {
+                    if (error) return;
+                    self->finish_response(socket, concrete_response->keep_alive());
+                });
+        }
+    }, response);
+}
+
+void ServerTrans::finish_response(std::shared_ptr<tcp::socket> socket, bool keep_alive) {
+    // Whether to keep alive.
+    if (keep_alive) {
+        auto new_buffer = std::make_shared<beast::flat_buffer>();
+        auto new_parser = std::make_shared<http::request_parser<http::string_body>>();
+        read_from_connection(socket, new_buffer, new_parser);
+    } else {
+        // Shutdown connection if there is no need to keep alive.
+        boost::system::error_code ec;
+        socket->shutdown(tcp::socket::shutdown_send, ec);
+        socket->close();
+    }
+}
+
+// Body relay state of a streamed response.
+struct stream_state {
+    beast::file file;
+    std::uint64_t generation = 0;
+    std::uint64_t sent = 0;
+    std::array<char, 64 * 1024> buffer;
+    std::unique_ptr<http::response_serializer<http::empty_body>> serializer;
+};
+
+void ServerTrans::stream_sender(std::shared_ptr<tcp::socket> socket, std::shared_ptr<streaming_response> response) {
+    auto self = shared_from_this();
+    auto state = std::make_shared<stream_state>();
+    state->generation = response->generation;
+
+    // The download already created the file, follow it from the first byte.
+    beast::error_code ec;
+    response->progress->open(state->file, ec);
+    if (ec) {
+        std::cerr << "Failed to open streamed file: " << response->progress->file_path() << " - " << ec.message() << std::endl;
+        socket->close(ec);
+        return;
+    }
+
+    // Send the header now, the body follows as it lands on disk.
+    state->serializer = std::make_unique<http::response_serializer<http::empty_body>>(response->header);
+    http::async_write_header(*socket, *state->serializer,
+        [self, socket, response, state](const boost::system::error_code& error, size_t) {
             if (error) return;
+            self->stream_body(socket, response, state);
+        });
+}
 
-            // Whether to keep alive.
-            if (concrete_response->keep_alive()) {
-                auto new_buffer = std::make_shared<beast::flat_buffer>();
-                auto new_parser = std::make_shared<http::request_parser<http::string_body>>();
-                self->read_from_connection(socket, new_buffer, new_parser);
-            } else {
-                // Shutdown connection if there is no need to keep alive.
+void ServerTrans::stream_body(std::shared_ptr<tcp::socket> socket,
+                              std::shared_ptr<streaming_response> response,
+                              std::shared_ptr<stream_state> state) {
+    auto self = shared_from_this();
+    auto progress = response->progress->snapshot();
+    bool chunked = response->header.chunked();
+
+    // The download restarted from byte 0, maybe with another body (new upstream copy, other mirror).
+    if (progress.generation != state->generation) {
+        auto announced = response->header.find(http::field::content_length);
+        bool fits = announced == response->header.end() ||
+                    (progress.content_length && announced->value() == std::to_string(*progress.content_length));
+        beast::error_code ec;
+        // Bytes already relayed cannot be taken back, end the response short instead of splicing two bodies.
+        if (state->sent > 0 || !fits) {
+            socket->close(ec);
+            return;
+        }
+        // Nothing sent yet, follow the new body from its own file once it has bytes (a voided one is removed).
+        state->file.close(ec);
+        state->generation = progress.generation;
+    }
+
+    // Relay whatever is on disk beyond what was sent.
+    if (progress.bytes_on_disk > state->sent) {
+        std::size_t want = std::min<std::uint64_t>(state->buffer.size(), progress.bytes_on_disk - state->sent);
+        beast::error_code ec;
+        if (!state->file.is_open()) {
+            response->progress->open(state->file, ec);
+        }
+        if (!ec) {
+            state->file.seek(state->sent, ec);
+        }
+        std::size_t got = ec ? 0 : state->file.read(state->buffer.data(), want, ec);
+        if (ec || got == 0) {
+            socket->close(ec);
+            return;
+        }
+
+        auto on_write = [self, socket, response, state, got](const boost::system::error_code& error, size_t) {
+            if (error) return;
+            state->sent += got;
+            self->stream_body(socket, response, state);
+        };
+        if (chunked) {
+            net::async_write(*socket, http::make_chunk(net::buffer(state->buffer.data(), got)), on_write);
+        } else {
+            net::async_write(*socket, net::buffer(state->buffer.data(), got), on_write);
+        }
+        return;
+    }
+
+    if (progress.done) {
+        if (!progress.success) {
+            // Upstream failed mid-body, a truncated response is all we can do.
+            boost::system::error_code ec;
+            socket->close(ec);
+            return;
+        }
+        if (chunked) {
+            net::async_write(*socket, http::make_chunk_last(),
+                [self, socket, response](const boost::system::error_code& error, size_t) {
+                    if (error) return;
+                    self->finish_response(socket, response->header.keep_alive());
+                });
+            return;
+        }
+        finish_response(socket, response->header.keep_alive());
+        return;
+    }
+
+    // Caught up with the download, wait for more data.
+    response->progress->async_wait_progress(socket->get_executor(), state->generation, state->sent,
+        [self, socket, response, state](bool) {
+            self->stream_body(socket, response, state);
+        });
+}
+
+// Body state of a zero-copy (or buffered) file response.
+struct sendfile_state {
+    http::response<http::empty_body> header;
+    std::unique_ptr<http::response_serializer<http::empty_body>> serializer;
+    std::shared_ptr<const void> source;   // Response owning the file descriptor
+    int fd = -1;
+    off_t offset = 0;
+    std::uint64_t remaining = 0;
+    bool keep_alive = true;
+    std::vector<char> buffer;             // Only used by buffered sends
+};
+
+// Bytes pushed per handler run before yielding to other connections on the worker.
+static constexpr std::uint64_t sendfile_turn_bytes = 4 * 1024 * 1024;
+
+void ServerTrans::sendfile_sender(std::shared_ptr<tcp::socket> socket,
+                                  std::shared_ptr<http::response<http::file_body>> response) {
+    auto self = shared_from_this();
+    auto state = std::make_shared<sendfile_state>();
+
+    // The body starts at the file position (range start for 206) and spans Content-Length.
+    beast::error_code ec;
+    state->offset = static_cast<off_t>(response->body().file().pos(ec));
+    if (!ec) {
+        auto content_length = response->find(http::field::content_length);
+        if (content_length != response->end()) {
+            state->remaining = std::stoull(std::string(content_length->value()));
+        } else {
+            state->remaining = response->body().size() - state->offset;
+            response->content_length(state->remaining);
+        }
+    }
+    if (ec) {
+        std::cerr << "Failed to prepare file response: " << ec.message() << std::endl;
+        socket->close(ec);
+        return;
+    }
+
+    state->source = response;
+    state->fd = response->body().file().native_handle();
+    state->keep_alive = response->keep_alive();
+
+    // Send the header, the file descriptor goes to sendfile afterwards.
+    state->header = http::response<http::empty_body>(response->base());
+    state->serializer = std::make_unique<http::response_serializer<http::empty_body>>(state->header);
+    http::async_write_header(*socket, *state->serializer,
+        [self, socket, state](const boost::system::error_code& error, size_t) {
+            if (error) return;
+            self->sendfile_body(socket, state);
+        });
+}
+
+void ServerTrans::sendfile_body(std::shared_ptr<tcp::socket> socket, std::shared_ptr<sendfile_state> state) {
+    auto self = shared_from_this();
+    boost::system::error_code ec;
+
+    // sendfile must not block the worker, a full socket buffer returns EAGAIN instead.
+    socket->native_non_blocking(true, ec);
+    if (ec) {
+        socket->close(ec);
+        return;
+    }
+
+    std::uint64_t budget = sendfile_turn_bytes;
+    while (state->remaining > 0) {
+        if (budget == 0) {
+            // Let other connections on this worker run, then continue.
+            net::post(socket->get_executor(), [self, socket, state]() {
+                self->sendfile_body(socket, state);
+            });
+            return;
+        }
+
+        std::size_t want = std::min(state->remaining, budget);
+        ssize_t sent = ::sendfile(socket->native_handle(), state->fd, &state->offset, want);
+        if (sent > 0) {
+            state->remaining -= sent;
+            budget -= std::min<std::uint64_t>(budget, sent);
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Socket buffer is full, resume once it drains.
+            socket->async_wait(tcp::socket::wait_write,
+                [self, socket, state](const boost::system::error_code& error) {
+                    if (error) return;
+                    self->sendfile_body(socket, state);
+                });
+            return;
+        }
+
+        // Peer went away or the file is shorter than announced.
+        if (sent < 0 && errno != EPIPE && errno != ECONNRESET) {
+            std::cerr << "sendfile failed: " << std::strerror(errno) << std::endl;
+        }
+        socket->close(ec);
+        return;
+    }
+
+    finish_response(socket, state->keep_alive);
+}
+
+#if defined(BOOST_ASIO_HAS_IO_URING)
+// Body state of a file response read through io_uring.
+struct uring_state {
+    http::response<http::empty_body> header;
+    std::unique_ptr<http::response_serializer<http::empty_body>> serializer;
+    std::shared_ptr<const void> source;   // Response the body belongs to
+    bool keep_alive = true;
+    std::unique_ptr<net::random_access_file> file;
+    std::uint64_t offset = 0;
+    std::uint64_t remaining = 0;
+    std::array<char, 256 * 1024> buffer;
+};
+
+void ServerTrans::uring_sender(std::shared_ptr<tcp::socket> socket,
+                               std::shared_ptr<http::response<http::file_body>> response) {
+    auto self = shared_from_this();
+    auto state = std::make_shared<uring_state>();
+
+    // Same body window as the sendfile path: file position plus Content-Length.
+    beast::error_code ec;
+    state->offset = response->body().file().pos(ec);
+    if (!ec) {
+        auto content_length = response->find(http::field::content_length);
+        if (content_length != response->end()) {
+            state->remaining = std::stoull(std::string(content_length->value()));
+        } else {
+            state->remaining = response->body().size() - state->offset;
+            response->content_length(state->remaining);
+        }
+    }
+
+    // The ring gets its own descriptor, the file_body keeps owning the original.
+    int fd = ec ? -1 : ::dup(response->body().file().native_handle());
+    if (fd < 0) {
+        std::cerr << "Failed to prepare file response for io_uring" << std::endl;
+        socket->close(ec);
+        return;
+    }
+    state->file = std::make_unique<net::random_access_file>(socket->get_executor(), fd);
+    state->source = response;
+    state->keep_alive = response->keep_alive();
+
+    state->header = http::response<http::empty_body>(response->base());
+    state->serializer = std::make_unique<http::response_serializer<http::empty_body>>(state->header);
+    http::async_write_header(*socket, *state->serializer,
+        [self, socket, state](const boost::system::error_code& error, size_t) {
+            if (error) return;
+            self->uring_body(socket, state);
+        });
+}
+
+void ServerTrans::uring_body(std::shared_ptr<tcp::socket> socket, std::shared_ptr<uring_state> state) {
+    auto self = shared_from_this();
+
+    if (state->remaining == 0) {
+        finish_response(socket, state->keep_alive);
+        return;
+    }
+
+    // Read a chunk at the current offset, the ring completes it without blocking the loop.
+    std::size_t want = std::min<std::uint64_t>(state->buffer.size(), state->remaining);
+    state->file->async_read_some_at(state->offset, net::buffer(state->buffer.data(), want),
+        [self, socket, state](const boost::system::error_code& error, std::size_t got) {
+            if (error || got == 0) {
+                // File is shorter than announced.
                 boost::system::error_code ec;
-                socket->shutdown(tcp::socket::shutdown_send, ec);
-                socket->close();
+                socket->close(ec);
+                return;
             }
+            net::async_write(*socket, net::buffer(state->buffer.data(), got),
+                [self, socket, state, got](const boost::system::error_code& error, std::size_t) {
+                    if (error) return;
+                    state->offset += got;
+                    state->remaining -= got;
+                    self->uring_body(socket, state);
+                });
+        });
+}
+#endif
+
+void ServerTrans::hit_sender(std::shared_ptr<tcp::socket> socket, std::shared_ptr<file_hit_response> hit) {
+    auto self = shared_from_this();
+
+#if defined(BOOST_ASIO_HAS_IO_URING)
+    if (m_io_engine == io_engine::io_uring) {
+        auto state = std::make_shared<uring_state>();
+        state->source = hit;
+        state->keep_alive = hit->keep_alive();
+        state->offset = hit->offset;
+        state->remaining = hit->length;
+        int fd = ::dup(hit->file.native_handle());
+        if (fd < 0) {
+            std::cerr << "Failed to prepare file response for io_uring" << std::endl;
+            boost::system::error_code ec;
+            socket->close(ec);
+            return;
+        }
+        state->file = std::make_unique<net::random_access_file>(socket->get_executor(), fd);
+        net::async_write(*socket, hit->header_buffers(),
+            [self, socket, state](const boost::system::error_code& error, size_t) {
+                if (error) return;
+                self->uring_body(socket, state);
+            });
+        return;
+    }
+#endif
+
+    auto state = std::make_shared<sendfile_state>();
+    state->source = hit;
+    state->fd = hit->file.native_handle();
+    state->offset = static_cast<off_t>(hit->offset);
+    state->remaining = hit->length;
+    state->keep_alive = hit->keep_alive();
+
+    // The header is the entry's prepared block, no serializer involved.
+    net::async_write(*socket, hit->header_buffers(),
+        [self, socket, state](const boost::system::error_code& error, size_t) {
+            if (error) return;
+            if (self->m_zero_copy) {
+                self->sendfile_body(socket, state);
+            } else {
+                state->buffer.resize(64 * 1024);
+                self->buffered_body(socket, state);
+            }
+        });
+}
+
+void ServerTrans::buffered_body(std::shared_ptr<tcp::socket> socket, std::shared_ptr<sendfile_state> state) {
+    auto self = shared_from_this();
+
+    if (state->remaining == 0) {
+        finish_response(socket, state->keep_alive);
+        return;
+    }
+
+    std::size_t want = std::min<std::uint64_t>(state->buffer.size(), state->remaining);
+    ssize_t got = ::pread(state->fd, state->buffer.data(), want, state->offset);
+    if (got <= 0) {
+        // File is shorter than announced.
+        boost::system::error_code ec;
+        socket->close(ec);
+        return;
+    }
+    net::async_write(*socket, net::buffer(state->buffer.data(), got),
+        [self, socket, state, got](const boost::system::error_code& error, std::size_t) {
+            if (error) return;
+            state->offset += got;
+            state->remaining -= got;
+            self->buffered_body(socket, state);
         });
-    }, response);
 }
 
 // ClientTrans implementation
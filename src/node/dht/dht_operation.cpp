@@ -1,17 +1,25 @@
 #include <vector>
 #include <chrono>
 #include <optional>
+#include <mutex>
 
 #include <node/dht/dht_operation.hpp>
 
 bool DHT_operation::verify_entry(std::string node_id) {
+    std::shared_lock lock(m_mutex);
+    return contains_entry(node_id);
+}
+
+bool DHT_operation::contains_entry(const std::string& node_id) const {
     if (node_id_to_generation_timestamp_entries.contains(node_id)) return true;
     return false;
 }
 
 void DHT_operation::store_entry(dht_entry entry) {
+    std::unique_lock lock(m_mutex);
+
     // Check if the entry exist. If recieved a new one or newer one, store it.
-    if (verify_entry(entry.node_id)) {
+    if (contains_entry(entry.node_id)) {
         if (node_id_to_generation_timestamp_entries[entry.node_id] < entry.generation_timestamp) this->remove_entry(entry.node_id);
         else return;
     }
@@ -30,16 +38,20 @@ void DHT_operation::store_entry(dht_entry entry) {
     node_id_to_liveness_entries[entry.node_id] = 0;
 }
 
-const std::set<std::string>* DHT_operation::query_node_ids_by_shard_id(std::string shard_id_querying) {
-    if (shard_id_to_node_ids_entries.contains(shard_id_querying)) {
-        return &shard_id_to_node_ids_entries[shard_id_querying];
+std::shared_ptr<const std::set<std::string>> DHT_operation::query_node_ids_by_shard_id(std::string shard_id_querying) {
+    std::shared_lock lock(m_mutex);
+
+    // Copy under the lock, the set may change once it is released.
+    auto it = shard_id_to_node_ids_entries.find(shard_id_querying);
+    if (it != shard_id_to_node_ids_entries.end()) {
+        return std::make_shared<const std::set<std::string>>(it->second);
     }
     return nullptr;
 }
 
 void DHT_operation::remove_entry(const std::string& node_id) {
     // Make sure the entry to remove exists.
-    if (verify_entry(node_id) == false) return;
+    if (contains_entry(node_id) == false) return;
 
     // Make sure that a new node with IP that used by old node will not be removed.
     const std::string& node_ip = node_id_to_node_ip_entries[node_id];
@@ -61,6 +73,8 @@ void DHT_operation::remove_entry(const std::string& node_id) {
 }
 
 void DHT_operation::clean_by_expiry_time() {
+    std::unique_lock lock(m_mutex);
+
     // Get current timestamp
     auto now_sec = std::chrono::duration_cast<std::chrono::seconds>(
         std::chrono::system_clock::now().time_since_epoch()
@@ -0,0 +1,253 @@
+#include <node/package/package_index.hpp>
+
+#include <vector>
+#include <mutex>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <streambuf>
+
+#include <zlib.h>
+#include <lzma.h>
+
+namespace {
+
+// Compression of an index file, told by its first bytes
+enum class compression { none, gzip, xz };
+
+compression sniff(std::istream& in) {
+    unsigned char magic[6] = {};
+    in.read(reinterpret_cast<char*>(magic), sizeof(magic));
+    std::streamsize read = in.gcount();
+    in.clear();
+    in.seekg(0);
+    if (read >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return compression::gzip;
+    }
+    static const unsigned char xz_magic[6] = {0xfd, '7', 'z', 'X', 'Z', 0x00};
+    if (read == 6 && std::memcmp(magic, xz_magic, sizeof(xz_magic)) == 0) {
+        return compression::xz;
+    }
+    return compression::none;
+}
+
+// Decompressed bytes of a gzip or xz stream, a block at a time
+class decompressing_buf : public std::streambuf {
+public:
+    decompressing_buf(std::istream& in, compression format) : m_in(in), m_format(format) {
+        if (m_format == compression::gzip) {
+            // 16 + window bits: gzip header and trailer
+            m_ok = inflateInit2(&m_zlib, 16 + MAX_WBITS) == Z_OK;
+        } else {
+            m_ok = lzma_stream_decoder(&m_lzma, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+        }
+    }
+
+    ~decompressing_buf() override {
+        if (m_format == compression::gzip) {
+            inflateEnd(&m_zlib);
+        } else {
+            lzma_end(&m_lzma);
+        }
+    }
+
+    decompressing_buf(const decompressing_buf&) = delete;
+    decompressing_buf& operator=(const decompressing_buf&) = delete;
+
+    // Whether the stream decompressed to its end, false if truncated or corrupt
+    bool complete() const { return m_ok && m_done; }
+
+protected:
+    int_type underflow() override {
+        while (m_ok && !m_done) {
+            std::size_t produced = m_format == compression::gzip ? inflate_block() : unxz_block();
+            if (produced > 0) {
+                setg(m_output, m_output, m_output + produced);
+                return traits_type::to_int_type(m_output[0]);
+            }
+        }
+        return traits_type::eof();
+    }
+
+private:
+    std::size_t refill() {
+        m_in.read(m_input, sizeof(m_input));
+        return static_cast<std::size_t>(m_in.gcount());
+    }
+
+    std::size_t inflate_block() {
+        if (m_zlib.avail_in == 0) {
+            m_zlib.next_in = reinterpret_cast<Bytef*>(m_input);
+            m_zlib.avail_in = static_cast<uInt>(refill());
+        }
+        m_zlib.next_out = reinterpret_cast<Bytef*>(m_output);
+        m_zlib.avail_out = sizeof(m_output);
+        int ret = inflate(&m_zlib, Z_NO_FLUSH);
+        std::size_t produced = sizeof(m_output) - m_zlib.avail_out;
+        if (ret == Z_STREAM_END) {
+            // Another gzip member may follow
+            if (m_zlib.avail_in == 0) {
+                m_zlib.next_in = reinterpret_cast<Bytef*>(m_input);
+                m_zlib.avail_in = static_cast<uInt>(refill());
+            }
+            if (m_zlib.avail_in == 0) {
+                m_done = true;
+            } else if (inflateReset(&m_zlib) != Z_OK) {
+                m_ok = false;
+            }
+        } else if (ret == Z_BUF_ERROR ? produced == 0 : ret != Z_OK) {
+            // No progress without more input: truncated
+            m_ok = false;
+        }
+        return produced;
+    }
+
+    std::size_t unxz_block() {
+        lzma_action action = LZMA_RUN;
+        if (m_lzma.avail_in == 0) {
+            m_lzma.next_in = reinterpret_cast<const std::uint8_t*>(m_input);
+            m_lzma.avail_in = refill();
+            if (m_lzma.avail_in == 0) {
+                action = LZMA_FINISH;
+            }
+        }
+        m_lzma.next_out = reinterpret_cast<std::uint8_t*>(m_output);
+        m_lzma.avail_out = sizeof(m_output);
+        lzma_ret ret = lzma_code(&m_lzma, action);
+        if (ret == LZMA_STREAM_END) {
+            m_done = true;
+        } else if (ret != LZMA_OK) {
+            m_ok = false;
+        }
+        return sizeof(m_output) - m_lzma.avail_out;
+    }
+
+    std::istream& m_in;
+    compression m_format;
+    z_stream m_zlib = {};
+    lzma_stream m_lzma = LZMA_STREAM_INIT;
+    bool m_ok = false;
+    bool m_done = false;
+    char m_input[64 * 1024];
+    char m_output[64 * 1024];
+};
+
+}  // namespace
+
+std::optional<std::string> PackageIndex::repository_root(const std::string& index_path) {
+    size_t dists = index_path.find("/dists/");
+    if (dists == std::string::npos) {
+        return std::nullopt;
+    }
+    return index_path.substr(0, dists);
+}
+
+bool PackageIndex::is_index(const std::string& request_path) {
+    size_t slash = request_path.rfind('/');
+    if (slash == std::string::npos) {
+        return false;
+    }
+    std::string name = request_path.substr(slash + 1);
+    if (name == "Packages" || name == "Packages.xz" || name == "Packages.gz") {
+        return true;
+    }
+    // Fetched by digest when the Release file offers it: .../binary-amd64/by-hash/SHA256/<sha256>
+    const std::string by_hash = "/by-hash/SHA256/";
+    if (slash + 1 < by_hash.size() || request_path.compare(slash + 1 - by_hash.size(), by_hash.size(), by_hash) != 0) {
+        return false;
+    }
+    size_t directory = slash + 1 - by_hash.size();
+    if (directory == 0) {
+        return false;
+    }
+    size_t parent = request_path.rfind('/', directory - 1);
+    return parent != std::string::npos && request_path.compare(parent + 1, 7, "binary-") == 0;
+}
+
+std::size_t PackageIndex::load(const std::string& root, std::istream& packages) {
+    return add(parse(root, packages));
+}
+
+std::size_t PackageIndex::load_file(const std::string& root, const std::filesystem::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        return 0;
+    }
+    compression format = sniff(in);
+    if (format == compression::none) {
+        return load(root, in);
+    }
+    decompressing_buf buffer(in, format);
+    std::istream packages(&buffer);
+    file_list files = parse(root, packages);
+    if (!buffer.complete()) {
+        return 0;
+    }
+    return add(std::move(files));
+}
+
+PackageIndex::file_list PackageIndex::parse(const std::string& root, std::istream& packages) {
+    file_list files;
+    std::string filename;
+    package_digest digest;
+
+    // Stanzas end at a blank line (or the end of the index)
+    auto end_stanza = [&]() {
+        if (!filename.empty() && digest.sha256.size() == 64) {
+            files.emplace_back(root + "/" + filename, digest);
+        }
+        filename.clear();
+        digest = {};
+    };
+
+    std::string line;
+    while (std::getline(packages, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            end_stanza();
+        } else if (line.starts_with("Filename: ")) {
+            filename = line.substr(10);
+            // Relative to the root, without "./"
+            if (filename.starts_with("./")) {
+                filename = filename.substr(2);
+            }
+        } else if (line.starts_with("SHA256: ")) {
+            digest.sha256 = line.substr(8);
+            std::transform(digest.sha256.begin(), digest.sha256.end(), digest.sha256.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+        } else if (line.starts_with("Size: ")) {
+            try {
+                digest.size = std::stoull(line.substr(6));
+            } catch (...) {
+                digest.size = 0;
+            }
+        }
+    }
+    end_stanza();
+    return files;
+}
+
+std::size_t PackageIndex::add(file_list files) {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    for (auto& [path, file] : files) {
+        m_files.insert_or_assign(std::move(path), std::move(file));
+    }
+    return files.size();
+}
+
+std::optional<package_digest> PackageIndex::lookup(const std::string& request_path) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto it = m_files.find(request_path);
+    if (it == m_files.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::size_t PackageIndex::size() const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    return m_files.size();
+}
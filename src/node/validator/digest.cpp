@@ -0,0 +1,100 @@
+#include <node/validator/digest.hpp>
+#include <openssl/evp.h>
+
+#include <memory>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Readahead and aligned buffers work in whole pages
+static constexpr std::size_t page_size = 4096;
+
+Digest::Digest(const std::string& algorithm)
+    : m_md(EVP_get_digestbyname(algorithm.c_str())), m_ctx(EVP_MD_CTX_new()) {
+    if (!m_md || !m_ctx) {
+        EVP_MD_CTX_free(m_ctx);
+        throw std::invalid_argument("Unsupported digest: " + algorithm);
+    }
+    reset();
+}
+
+Digest::~Digest() {
+    EVP_MD_CTX_free(m_ctx);
+}
+
+void Digest::update(const void* data, std::size_t size) {
+    EVP_DigestUpdate(m_ctx, data, size);
+}
+
+bool Digest::update_file(const std::string& file_path, std::uint64_t length,
+                         const std::function<bool(std::size_t)>& on_read) {
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Small files get a small buffer, large ones read a megabyte per call
+    std::size_t buffer_size = std::clamp<std::uint64_t>(std::min<std::uint64_t>(st.st_size, length),
+                                                        page_size, read_buffer_size);
+    buffer_size = (buffer_size + page_size - 1) / page_size * page_size;
+    std::unique_ptr<char, decltype(&std::free)> buffer(
+        static_cast<char*>(std::aligned_alloc(page_size, buffer_size)), &std::free);
+    if (!buffer) {
+        ::close(fd);
+        return false;
+    }
+
+    bool whole = length == std::numeric_limits<std::uint64_t>::max();
+    bool failed = false;
+    while (length > 0) {
+        ssize_t bytes_read = ::read(fd, buffer.get(), std::min<std::uint64_t>(buffer_size, length));
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            failed = bytes_read < 0;
+            break;
+        }
+        update(buffer.get(), static_cast<std::size_t>(bytes_read));
+        length -= static_cast<std::uint64_t>(bytes_read);
+        if (on_read && !on_read(static_cast<std::size_t>(bytes_read))) {
+            failed = true;
+            break;
+        }
+    }
+    ::close(fd);
+    return whole ? !failed : length == 0;
+}
+
+std::string Digest::hex_digest() {
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hash_size = 0;
+    EVP_DigestFinal_ex(m_ctx, hash, &hash_size);
+    reset();
+    return to_hex(hash, hash_size);
+}
+
+std::string Digest::to_hex(const unsigned char* data, std::size_t size) {
+    static constexpr char hex[] = "0123456789abcdef";
+    std::string result(size * 2, '0');
+    for (std::size_t i = 0; i < size; i++) {
+        result[2 * i] = hex[data[i] >> 4];
+        result[2 * i + 1] = hex[data[i] & 0xf];
+    }
+    return result;
+}
+
+void Digest::reset() {
+    EVP_DigestInit_ex(m_ctx, m_md, nullptr);
+}
@@ -1,9 +1,6 @@
 #include <node/validator/validator.hpp>
-#include <openssl/sha.h>
+#include <node/validator/digest.hpp>
 
-#include <fstream>
-#include <sstream>
-#include <iomanip>
 #include <cctype>
 #include <iostream>
 
@@ -42,44 +39,12 @@ bool Validator::verify_node_identity(const std::string& node_id,
 }
 
 std::string Validator::calculate_sha256(const std::string& file_path) const {
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file) {
+    Digest digest("sha256");
+    if (!digest.update_file(file_path)) {
         std::cerr << "Failed to open file: " << file_path << std::endl;
         return "";
     }
-
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-
-    const size_t BUFFER_SIZE = 8192;
-    char* buffer = new char[BUFFER_SIZE];
-
-    while (file.read(buffer, BUFFER_SIZE)) {
-        size_t bytes_read = file.gcount();
-        if (bytes_read > 0) {
-            SHA256_Update(&sha256, buffer, bytes_read);
-        }
-    }
-
-    // Handle last partial read
-    size_t bytes_read = file.gcount();
-    if (bytes_read > 0) {
-        SHA256_Update(&sha256, buffer, bytes_read);
-    }
-
-    delete[] buffer;
-    file.close();
-
-    SHA256_Final(hash, &sha256);
-
-    // Convert to hex string
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    }
-
-    return ss.str();
+    return digest.hex_digest();
 }
 
 bool Validator::verify_sha256(const std::string& file_path, const std::string& expected_hash) const {
@@ -1,6 +1,20 @@
 #include "../../common.hpp"
+#include "../../mock_upstream.hpp"
 #include <console/io/io.hpp>
 #include <sstream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <zlib.h>
+#include <lzma.h>
+
+// Test helper: read a whole file into a string
+static std::string read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
 
 // Test: Config initialization
 bool test_config_initialization() {
@@ -35,6 +49,1729 @@ bool test_config_has_key() {
     return true;
 }
 
+// Test: Fetch buffer size has a default and a floor
+bool test_config_fetch_buffer_size() {
+    Config config;
+    ASSERT_EQ(65536, config.get_fetch_buffer_size());
+    config.set("fetch_buffer_size", "1024");
+    ASSERT_EQ(8192, config.get_fetch_buffer_size());
+    config.set("fetch_buffer_size", "1048576");
+    ASSERT_EQ(1048576, config.get_fetch_buffer_size());
+    return true;
+}
+
+// Test: I/O engine defaults to epoll and rejects unknown names
+bool test_config_io_engine() {
+    Config config;
+    ASSERT_STREQ("epoll", config.get_io_engine());
+    config.set("io_engine", "io_uring");
+    ASSERT_STREQ("io_uring", config.get_io_engine());
+    config.set("io_engine", "kqueue");
+    ASSERT_STREQ("epoll", config.get_io_engine());
+    return true;
+}
+
+// Test: Bodies far larger than the fetch buffer arrive intact
+bool test_cache_bounded_buffer_fetch() {
+    std::string body;
+    for (int i = 0; i < 200000; i++) {
+        body += static_cast<char>('a' + (i * 7) % 26);
+    }
+    test::MockUpstream upstream;
+    upstream.set_file("/debian/pool/main/l/linux/linux-image_6.1_amd64.deb", body);
+
+    Config config;
+    config.set("fetch_buffer_size", "8192");
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    bool cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), "/debian/pool/main/l/linux/linux-image_6.1_amd64.deb",
+        [&cached](bool success) { cached = success; });
+    io_context.run();
+
+    ASSERT_TRUE(cached);
+    ASSERT_TRUE(read_file(cache.get_cache_path("/debian/pool/main/l/linux/linux-image_6.1_amd64.deb")) == body);
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Asynchronous fetch stores the upstream body in the cache
+bool test_cache_async_fetch() {
+    test::MockUpstream upstream;
+    upstream.set_file("/debian/pool/main/h/hello/hello_1.0_amd64.deb", "hello package");
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    bool cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), "/debian/pool/main/h/hello/hello_1.0_amd64.deb",
+        [&cached](bool success) { cached = success; });
+    io_context.run();
+
+    ASSERT_TRUE(cached);
+    ASSERT_TRUE(cache.is_cached("/debian/pool/main/h/hello/hello_1.0_amd64.deb"));
+    ASSERT_STREQ("hello package", read_file(cache.get_cache_path("/debian/pool/main/h/hello/hello_1.0_amd64.deb")));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Upstream 404 fails without retrying
+bool test_cache_async_fetch_not_found() {
+    test::MockUpstream upstream;
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    bool cached = true;
+    cache.async_ensure_cached(io_context.get_executor(), "/debian/missing.deb",
+        [&cached](bool success) { cached = success; });
+    io_context.run();
+
+    ASSERT_FALSE(cached);
+    ASSERT_EQ(1, upstream.request_count("/debian/missing.deb"));
+    ASSERT_FALSE(cache.is_cached("/debian/missing.deb"));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: A slow miss does not hold up a cache hit on the same context
+bool test_cache_async_miss_does_not_block_hit() {
+    test::MockUpstream upstream;
+    upstream.set_file("/slow.deb", "slow");
+    upstream.set_file("/fast.deb", "fast");
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+    ASSERT_TRUE(cache.get_or_fetch("/fast.deb", 11) != nullptr);
+
+    upstream.set_delay(std::chrono::milliseconds(300));
+
+    net::io_context io_context;
+    std::vector<std::string> order;
+    cache.async_ensure_cached(io_context.get_executor(), "/slow.deb",
+        [&order](bool) { order.push_back("slow"); });
+    cache.async_ensure_cached(io_context.get_executor(), "/fast.deb",
+        [&order](bool) { order.push_back("fast"); });
+    io_context.run();
+
+    ASSERT_EQ(2, order.size());
+    ASSERT_STREQ("fast", order[0]);
+    ASSERT_STREQ("slow", order[1]);
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Concurrent misses for one path share a single upstream download
+bool test_cache_single_flight() {
+    test::MockUpstream upstream;
+    upstream.set_file("/debian/pool/main/g/glibc/libc6_2.36_amd64.deb", "libc6");
+    upstream.set_delay(std::chrono::milliseconds(100));
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    int completed = 0;
+    for (int i = 0; i < 5; i++) {
+        cache.async_ensure_cached(io_context.get_executor(), "/debian/pool/main/g/glibc/libc6_2.36_amd64.deb",
+            [&completed](bool success) { if (success) completed++; });
+    }
+    ASSERT_FALSE(cache.is_cached("/debian/pool/main/g/glibc/libc6_2.36_amd64.deb"));
+    io_context.run();
+
+    ASSERT_EQ(5, completed);
+    ASSERT_EQ(1, upstream.request_count("/debian/pool/main/g/glibc/libc6_2.36_amd64.deb"));
+    ASSERT_TRUE(cache.is_cached("/debian/pool/main/g/glibc/libc6_2.36_amd64.deb"));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Streaming clients share the in-flight download and see its length up front
+bool test_cache_streaming_join() {
+    test::MockUpstream upstream;
+    upstream.set_file("/debian/pool/main/f/firefox-esr/firefox-esr_115_amd64.deb", std::string(100000, 'f'));
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    std::vector<std::shared_ptr<streaming_response>> responses;
+    for (int i = 0; i < 2; i++) {
+        cache.async_fetch_streaming(io_context.get_executor(), "/debian/pool/main/f/firefox-esr/firefox-esr_115_amd64.deb", 11,
+            [&responses](std::shared_ptr<streaming_response> response) { responses.push_back(response); });
+    }
+    io_context.run();
+
+    ASSERT_EQ(2, responses.size());
+    ASSERT_TRUE(responses[0] != nullptr);
+    ASSERT_TRUE(responses[0]->progress == responses[1]->progress);
+    ASSERT_STREQ("100000", std::string(responses[0]->header[http::field::content_length]));
+    ASSERT_TRUE(responses[0]->progress->snapshot().success);
+    ASSERT_EQ(100000, responses[0]->progress->snapshot().bytes_on_disk);
+    ASSERT_EQ(1, upstream.request_count("/debian/pool/main/f/firefox-esr/firefox-esr_115_amd64.deb"));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Index entries can be inserted, replaced, looked up and erased
+bool test_index_insert_lookup_erase() {
+    MetadataIndex index(4);
+    ASSERT_TRUE(index.lookup("/a") == nullptr);
+
+    index.insert("/a", cache_entry::make(10, 1000));
+    index.insert("/b", cache_entry::make(20, 2000));
+    ASSERT_EQ(2, index.size());
+    ASSERT_EQ(10, index.lookup("/a")->size);
+    ASSERT_STREQ("\"10-1000\"", index.lookup("/a")->etag);
+
+    // Readers keep their snapshot when the entry is replaced
+    auto old_entry = index.lookup("/a");
+    index.insert("/a", cache_entry::make(11, 1001));
+    ASSERT_EQ(10, old_entry->size);
+    ASSERT_EQ(11, index.lookup("/a")->size);
+
+    ASSERT_TRUE(index.erase("/a"));
+    ASSERT_FALSE(index.erase("/a"));
+    ASSERT_TRUE(index.lookup("/a") == nullptr);
+    ASSERT_EQ(1, index.size());
+
+    // The count follows every kind of change
+    ASSERT_TRUE(index.try_insert("/c", cache_entry::make(30, 3000)));
+    ASSERT_FALSE(index.try_insert("/c", cache_entry::make(31, 3001)));
+    ASSERT_EQ(2, index.size());
+    index.clear();
+    ASSERT_EQ(0, index.size());
+    ASSERT_EQ(0, index.total_bytes());
+    return true;
+}
+
+// Test: Completed fetches are indexed and hits are answered from the index
+bool test_cache_index_hit() {
+    test::MockUpstream upstream;
+    upstream.set_file("/debian/pool/main/i/index/index_1.0_amd64.deb", "indexed body");
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    cache.async_ensure_cached(io_context.get_executor(), "/debian/pool/main/i/index/index_1.0_amd64.deb", [](bool) {});
+    io_context.run();
+
+    auto entry = cache.get_index().lookup("/debian/pool/main/i/index/index_1.0_amd64.deb");
+    ASSERT_TRUE(entry != nullptr);
+    ASSERT_EQ(12, entry->size);
+
+    // Grow the file behind the cache's back, headers still come from the index
+    std::ofstream(cache.get_cache_path("/debian/pool/main/i/index/index_1.0_amd64.deb"), std::ios::app) << "!";
+    auto response = cache.get_or_fetch("/debian/pool/main/i/index/index_1.0_amd64.deb", 11);
+    ASSERT_TRUE(response != nullptr);
+    ASSERT_STREQ(entry->etag, std::string((*response)[http::field::etag]));
+    ASSERT_STREQ(entry->last_modified, std::string((*response)[http::field::last_modified]));
+
+    // 304 on the indexed ETag
+    auto conditional = cache.get_or_fetch_with_conditional("/debian/pool/main/i/index/index_1.0_amd64.deb", 11, "", entry->etag);
+    ASSERT_EQ(1, conditional.index());
+    ASSERT_EQ(304, std::get<1>(conditional)->result_int());
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Files cached by an earlier run are indexed on first lookup
+bool test_cache_index_lazy_fill() {
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", "127.0.0.1:1");
+
+    cache.wait_for_index();
+
+    std::string path = "/debian/dists/stable/Release";
+    fs::create_directories(fs::path(cache.get_cache_path(path)).parent_path());
+    std::ofstream(cache.get_cache_path(path), std::ios::binary) << "release";
+
+    ASSERT_EQ(0, cache.get_index().size());
+    ASSERT_TRUE(cache.is_cached(path));
+    ASSERT_EQ(1, cache.get_index().size());
+    ASSERT_EQ(7, cache.get_entry(path)->size);
+
+    cache.invalidate(path);
+    ASSERT_EQ(0, cache.get_index().size());
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: The index log replays puts and erases, and keeps access statistics
+bool test_index_log_round_trip() {
+    fs::remove_all("./test_index_log");
+    fs::create_directories("./test_index_log");
+    std::string log_path = "./test_index_log/.pacprism-index";
+    {
+        IndexLog log(log_path);
+        auto entry = cache_entry::make(100, 1700000000, "abcd");
+        entry.upstream_etag = "\"5f3a-61b2\"";
+        entry.upstream_mtime = 1690000000;
+        entry.touch();
+        entry.touch();
+        log.append_put("/debian/pool/a.deb", entry);
+        log.append_put("/debian/pool/b b.deb", cache_entry::make(200, 1700000001));
+        log.append_put("/debian/pool/c.deb", cache_entry::make(300, 1700000002));
+        log.append_erase("/debian/pool/c.deb");
+    }
+
+    MetadataIndex index;
+    IndexLog log(log_path);
+    ASSERT_TRUE(log.load(index));
+    ASSERT_EQ(2, index.size());
+    auto a = index.lookup("/debian/pool/a.deb");
+    ASSERT_TRUE(a != nullptr);
+    ASSERT_EQ(100, a->size);
+    ASSERT_STREQ("abcd", a->sha256);
+    ASSERT_EQ(2, a->access->hit_count.load());
+    ASSERT_STREQ("\"5f3a-61b2\"", a->upstream_etag);
+    ASSERT_EQ(1690000000, a->upstream_mtime);
+    ASSERT_FALSE(a->verified);
+    ASSERT_EQ(200, index.lookup("/debian/pool/b b.deb")->size);
+    ASSERT_TRUE(index.lookup("/debian/pool/b b.deb")->upstream_etag.empty());
+    ASSERT_TRUE(index.lookup("/debian/pool/c.deb") == nullptr);
+
+    // Compaction keeps only the live entries
+    ASSERT_TRUE(log.compact(index));
+    MetadataIndex reloaded;
+    IndexLog compacted(log_path);
+    ASSERT_TRUE(compacted.load(reloaded));
+    ASSERT_EQ(2, reloaded.size());
+    std::string content = read_file(log_path);
+    ASSERT_EQ(3, std::count(content.begin(), content.end(), '\n'));
+
+    // A log of the first format is loaded and rewritten in the current one
+    std::ofstream(log_path, std::ios::trunc) << "pacprism-index 1\n+ 100 1700000000 1700000000 3 - /debian/pool/a.deb\n";
+    MetadataIndex upgraded;
+    IndexLog old_log(log_path);
+    ASSERT_TRUE(old_log.load(upgraded));
+    ASSERT_EQ(3, upgraded.lookup("/debian/pool/a.deb")->access->hit_count.load());
+    ASSERT_TRUE(read_file(log_path).starts_with("pacprism-index 2\n"));
+
+    fs::remove_all("./test_index_log");
+    return true;
+}
+
+// Test: Records appended while a compaction walks the index end up in the new log
+bool test_index_log_compact_concurrent() {
+    fs::remove_all("./test_index_log");
+    fs::create_directories("./test_index_log");
+    std::string log_path = "./test_index_log/.pacprism-index";
+    MetadataIndex index;
+    IndexLog log(log_path);
+    for (int i = 0; i < 100000; i++) {
+        index.insert("/debian/pool/old" + std::to_string(i) + ".deb", cache_entry::make(1, 1700000000));
+    }
+
+    std::thread compaction([&]() { log.compact(index); });
+    // Indexed first, then logged, like FileCache::index_put
+    for (int i = 0; i < 1000; i++) {
+        std::string path = "/debian/pool/new" + std::to_string(i) + ".deb";
+        auto entry = cache_entry::make(2, 1700000000);
+        index.insert(path, entry);
+        log.append_put(path, entry);
+        std::string old = "/debian/pool/old" + std::to_string(i) + ".deb";
+        if (index.erase(old)) {
+            log.append_erase(old);
+        }
+    }
+    compaction.join();
+
+    MetadataIndex reloaded;
+    IndexLog replayed(log_path);
+    ASSERT_TRUE(replayed.load(reloaded));
+    ASSERT_EQ(100000, reloaded.size());
+    ASSERT_TRUE(reloaded.lookup("/debian/pool/new999.deb") != nullptr);
+    ASSERT_TRUE(reloaded.lookup("/debian/pool/old999.deb") == nullptr);
+    ASSERT_TRUE(reloaded.lookup("/debian/pool/old1000.deb") != nullptr);
+
+    fs::remove_all("./test_index_log");
+    return true;
+}
+
+// Test: A torn last record is dropped, a corrupt log is rejected
+bool test_index_log_torn_and_corrupt() {
+    fs::remove_all("./test_index_log");
+    fs::create_directories("./test_index_log");
+    std::string log_path = "./test_index_log/.pacprism-index";
+    {
+        IndexLog log(log_path);
+        log.append_put("/debian/pool/a.deb", cache_entry::make(100, 1700000000));
+    }
+    std::ofstream(log_path, std::ios::app) << "+ 200 17000";
+
+    {
+        MetadataIndex index;
+        IndexLog log(log_path);
+        ASSERT_TRUE(log.load(index));
+        ASSERT_EQ(1, index.size());
+        // New records start on a fresh line
+        log.append_put("/debian/pool/b.deb", cache_entry::make(200, 1700000001));
+    }
+    {
+        MetadataIndex index;
+        IndexLog log(log_path);
+        ASSERT_TRUE(log.load(index));
+        ASSERT_EQ(2, index.size());
+    }
+
+    std::ofstream(log_path, std::ios::app) << "? garbage\n";
+    MetadataIndex index;
+    IndexLog log(log_path);
+    ASSERT_FALSE(log.load(index));
+    ASSERT_EQ(0, index.size());
+
+    MetadataIndex missing;
+    IndexLog none("./test_index_log/none");
+    ASSERT_FALSE(none.load(missing));
+
+    fs::remove_all("./test_index_log");
+    return true;
+}
+
+// Test: A parallel rescan indexes every file of the tree but the log itself
+bool test_index_rescan() {
+    fs::remove_all("./test_index_log");
+    for (int d = 0; d < 5; d++) {
+        for (int f = 0; f < 4; f++) {
+            std::string dir = "./test_index_log/debian/pool/main/p" + std::to_string(d) + "/sub";
+            fs::create_directories(dir);
+            std::ofstream(dir + "/file" + std::to_string(f) + ".deb") << std::string(d + f, 'x');
+        }
+    }
+    std::ofstream("./test_index_log/.pacprism-index") << "pacprism-index 1\n";
+
+    MetadataIndex index;
+    ASSERT_EQ(20, IndexLog::rescan("./test_index_log", index, 4));
+    ASSERT_EQ(20, index.size());
+    auto entry = index.lookup("/debian/pool/main/p3/sub/file2.deb");
+    ASSERT_TRUE(entry != nullptr);
+    ASSERT_EQ(5, entry->size);
+    ASSERT_TRUE(entry->verified);
+
+    fs::remove_all("./test_index_log");
+    return true;
+}
+
+// Test: The index survives a restart and is checked lazily against the files
+bool test_cache_index_restart() {
+    test::MockUpstream upstream;
+    upstream.set_file("/debian/pool/main/r/restart/restart_1.0_amd64.deb", "restart body");
+    upstream.set_file("/debian/pool/main/r/restart/gone_1.0_amd64.deb", "gone body");
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        cache.wait_for_index();
+        ASSERT_TRUE(cache.get_or_fetch("/debian/pool/main/r/restart/restart_1.0_amd64.deb", 11) != nullptr);
+        ASSERT_TRUE(cache.get_or_fetch("/debian/pool/main/r/restart/restart_1.0_amd64.deb", 11) != nullptr);
+        ASSERT_TRUE(cache.get_or_fetch("/debian/pool/main/r/restart/gone_1.0_amd64.deb", 11) != nullptr);
+    }
+    fs::remove("./test_cache_async/debian/pool/main/r/restart/gone_1.0_amd64.deb");
+
+    FileCache cache(config, "./test_cache_async", upstream.host());
+    ASSERT_EQ(2, cache.get_index().size());
+    ASSERT_FALSE(cache.get_index().lookup("/debian/pool/main/r/restart/restart_1.0_amd64.deb")->verified);
+
+    auto entry = cache.get_entry("/debian/pool/main/r/restart/restart_1.0_amd64.deb");
+    ASSERT_TRUE(entry != nullptr);
+    ASSERT_TRUE(entry->verified);
+    ASSERT_EQ(12, entry->size);
+    ASSERT_EQ(2, entry->access->hit_count.load());
+
+    ASSERT_TRUE(cache.get_entry("/debian/pool/main/r/restart/gone_1.0_amd64.deb") == nullptr);
+    ASSERT_EQ(1, cache.get_index().size());
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: A cache without a log is rescanned in the background
+bool test_cache_index_rescan_on_start() {
+    Config config;
+    fs::remove_all("./test_cache_async");
+    fs::create_directories("./test_cache_async/debian/dists/stable");
+    std::ofstream("./test_cache_async/debian/dists/stable/InRelease") << "inrelease";
+    std::ofstream("./test_cache_async/debian/dists/stable/Release") << "release";
+
+    {
+        FileCache cache(config, "./test_cache_async", "127.0.0.1:1");
+        cache.wait_for_index();
+        ASSERT_EQ(2, cache.get_index().size());
+        ASSERT_EQ(9, cache.get_index().lookup("/debian/dists/stable/InRelease")->size);
+    }
+    ASSERT_TRUE(fs::exists("./test_cache_async/.pacprism-index"));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Cache budget parses unit suffixes and watermarks stay ordered
+bool test_config_cache_budget() {
+    Config config;
+    ASSERT_EQ(0, config.get_cache_max_bytes());
+    config.set("cache_max_bytes", "4T");
+    ASSERT_EQ(4ULL << 40, config.get_cache_max_bytes());
+    config.set("cache_max_bytes", "512M");
+    ASSERT_EQ(512ULL << 20, config.get_cache_max_bytes());
+    config.set("cache_max_bytes", "1000");
+    ASSERT_EQ(1000, config.get_cache_max_bytes());
+
+    ASSERT_EQ(64ULL << 20, config.get_memory_tier_bytes());
+    ASSERT_EQ(1ULL << 20, config.get_memory_tier_max_object());
+    ASSERT_EQ(2, config.get_memory_tier_min_hits());
+    config.set("memory_tier_bytes", "0");
+    ASSERT_EQ(0, config.get_memory_tier_bytes());
+
+    config.set("cache_high_watermark", "0.7");
+    config.set("cache_low_watermark", "0.9");
+    ASSERT_TRUE(config.get_cache_low_watermark() <= config.get_cache_high_watermark());
+    ASSERT_TRUE(config.get_eviction_policy() == eviction_policy::tinylfu);
+    config.set("eviction_policy", "lru");
+    ASSERT_TRUE(config.get_eviction_policy() == eviction_policy::lru);
+    config.set("eviction_policy", "slru");
+    ASSERT_TRUE(config.get_eviction_policy() == eviction_policy::slru);
+    return true;
+}
+
+// Test: LRU evicts the oldest, SLRU evicts one-hit files before repeatedly hit ones
+bool test_eviction_order() {
+    std::vector<eviction_candidate> candidates = {
+        {"/hot-old", 100, 10, 5},
+        {"/once-new", 100, 40, 1},
+        {"/once-old", 100, 20, 1},
+        {"/hot-new", 100, 30, 3},
+    };
+
+    auto lru = order_victims(candidates, eviction_policy::lru, 0);
+    ASSERT_STREQ("/hot-old", lru[0].request_path);
+    ASSERT_STREQ("/once-old", lru[1].request_path);
+    ASSERT_STREQ("/hot-new", lru[2].request_path);
+    ASSERT_STREQ("/once-new", lru[3].request_path);
+
+    auto slru = order_victims(candidates, eviction_policy::slru, 1000);
+    ASSERT_STREQ("/once-old", slru[0].request_path);
+    ASSERT_STREQ("/once-new", slru[1].request_path);
+    ASSERT_STREQ("/hot-old", slru[2].request_path);
+    ASSERT_STREQ("/hot-new", slru[3].request_path);
+
+    // A full protected segment demotes its oldest file to probation
+    auto capped = order_victims(candidates, eviction_policy::slru, 100);
+    ASSERT_STREQ("/hot-old", capped[0].request_path);
+    ASSERT_STREQ("/hot-new", capped[3].request_path);
+    return true;
+}
+
+// Test: The sketch counts, saturates at 15 and halves its counters as it ages
+bool test_frequency_sketch() {
+    FrequencySketch sketch(1024);
+    ASSERT_EQ(0, sketch.estimate("/never"));
+    for (int i = 0; i < 3; i++) {
+        sketch.increment("/three");
+    }
+    ASSERT_EQ(3, sketch.estimate("/three"));
+    for (int i = 0; i < 100; i++) {
+        sketch.increment("/hot");
+    }
+    ASSERT_EQ(15, sketch.estimate("/hot"));
+
+    // Ten increments per counter of a row trigger aging
+    for (std::size_t i = 0; i < 10 * sketch.width(); i++) {
+        sketch.increment("/scan/" + std::to_string(i));
+    }
+    ASSERT_TRUE(sketch.estimate("/hot") < 15);
+    ASSERT_TRUE(sketch.estimate("/hot") >= 7);
+    return true;
+}
+
+// Test: W-TinyLFU keeps the window, then evicts whichever of newcomer and resident is less popular
+bool test_tinylfu_order() {
+    FrequencySketch sketch(1024);
+    auto access = [&sketch](const std::string& path, int times) {
+        for (int i = 0; i < times; i++) {
+            sketch.increment(path);
+        }
+    };
+    access("/popular-new", 5);
+    access("/scan-new", 1);
+    access("/scan-newest", 1);
+    access("/resident-cold", 2);
+    access("/resident-warm", 4);
+
+    std::vector<eviction_candidate> candidates = {
+        {"/resident-cold", 100, 10, 2},
+        {"/resident-warm", 100, 20, 4},
+        {"/scan-new", 100, 30, 1},
+        {"/popular-new", 100, 40, 1},
+        {"/scan-newest", 100, 50, 1},
+    };
+
+    auto victims = order_victims_tinylfu(candidates, sketch, 100, 1000);
+    ASSERT_EQ(5, victims.size());
+    // The one-off scan loses to the residents, the popular newcomer beats both of them
+    ASSERT_STREQ("/scan-new", victims[0].request_path);
+    ASSERT_STREQ("/resident-cold", victims[1].request_path);
+    ASSERT_STREQ("/resident-warm", victims[2].request_path);
+    ASSERT_STREQ("/popular-new", victims[3].request_path);
+    // The window goes last
+    ASSERT_STREQ("/scan-newest", victims[4].request_path);
+
+    // A resident more popular than every newcomer outlives them all
+    access("/resident-cold", 10);
+    victims = order_victims_tinylfu(candidates, sketch, 100, 1000);
+    ASSERT_STREQ("/scan-new", victims[0].request_path);
+    ASSERT_STREQ("/popular-new", victims[1].request_path);
+    ASSERT_STREQ("/resident-cold", victims[2].request_path);
+    return true;
+}
+
+// Test: The memory tier stays within its budget by dropping the least recently used object
+bool test_memory_tier_budget() {
+    MemoryTier tier(100, 60);
+    ASSERT_TRUE(tier.fits(60));
+    ASSERT_FALSE(tier.fits(61));
+
+    auto object = [](std::size_t size) {
+        auto created = std::make_shared<memory_object>();
+        created->wire.assign(size, 'm');
+        return created;
+    };
+    ASSERT_TRUE(tier.insert("/a", object(40)));
+    ASSERT_TRUE(tier.insert("/b", object(40)));
+    ASSERT_TRUE(tier.lookup("/a") != nullptr);
+    ASSERT_TRUE(tier.insert("/c", object(40)));
+    ASSERT_EQ(2, tier.size());
+    ASSERT_EQ(80, tier.used_bytes());
+    ASSERT_TRUE(tier.lookup("/b") == nullptr);
+    ASSERT_TRUE(tier.lookup("/a") != nullptr);
+
+    tier.erase("/a");
+    ASSERT_EQ(40, tier.used_bytes());
+    ASSERT_FALSE(MemoryTier(0, 60).insert("/d", object(10)));
+    return true;
+}
+
+// Test: Files requested often enough are served from memory until their entry changes
+bool test_memory_tier_admission() {
+    Config config;
+    config.set("memory_tier_min_hits", "2");
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", "127.0.0.1:1");
+    cache.wait_for_index();
+
+    std::string path = "/debian/dists/stable/InRelease";
+    fs::create_directories(fs::path(cache.get_cache_path(path)).parent_path());
+    std::ofstream(cache.get_cache_path(path), std::ios::binary) << "release v1";
+
+    // Not admitted before two earlier requests
+    ASSERT_TRUE(cache.get_memory_object(path, 11) == nullptr);
+    ASSERT_TRUE(cache.get_or_fetch(path, 11) != nullptr);
+    ASSERT_TRUE(cache.get_memory_object(path, 11) == nullptr);
+    ASSERT_TRUE(cache.get_or_fetch(path, 11) != nullptr);
+
+    auto object = cache.get_memory_object(path, 11);
+    ASSERT_TRUE(object != nullptr);
+    ASSERT_TRUE(object->wire.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_TRUE(object->wire.ends_with("\r\n\r\nrelease v1"));
+    ASSERT_TRUE(object->wire.find("Content-Length: 10\r\n") != std::string::npos);
+    ASSERT_TRUE(cache.get_memory_object(path, 11) == object);
+    ASSERT_TRUE(cache.get_memory_object(path, 10) == nullptr);
+
+    // A replaced file is reloaded, senders of the old object keep their copy
+    std::ofstream(cache.get_cache_path(path), std::ios::binary) << "release v2 longer";
+    cache.invalidate(path);
+    auto reloaded = cache.get_memory_object(path, 11);
+    ASSERT_TRUE(reloaded != nullptr);
+    ASSERT_TRUE(reloaded->wire.ends_with("\r\n\r\nrelease v2 longer"));
+    ASSERT_TRUE(object->wire.ends_with("release v1"));
+    ASSERT_EQ(1, cache.get_memory_tier().size());
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test helper: concatenate the header buffers of a hit
+static std::string hit_header(const file_hit_response& hit) {
+    std::string header;
+    for (const auto& buffer : hit.header_buffers()) {
+        header.append(static_cast<const char*>(buffer.data()), buffer.size());
+    }
+    return header;
+}
+
+// Test: Hits send the header prepared in the index entry, patched for 206 and HTTP/1.0
+bool test_prepared_hit_header() {
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", "127.0.0.1:1");
+    cache.wait_for_index();
+
+    std::string path = "/debian/pool/main/h/hit/hit_1.0_amd64.deb";
+    fs::create_directories(fs::path(cache.get_cache_path(path)).parent_path());
+    std::ofstream(cache.get_cache_path(path), std::ios::binary) << "0123456789";
+
+    auto hit = cache.get_file_hit(path, 11);
+    ASSERT_TRUE(hit != nullptr);
+    ASSERT_STREQ(hit->entry->header, hit_header(*hit));
+    ASSERT_TRUE(hit->entry->header.starts_with("HTTP/1.1 200 OK\r\n"));
+    ASSERT_TRUE(hit->entry->header.find("ETag: " + hit->entry->etag + "\r\n") != std::string::npos);
+    ASSERT_TRUE(hit->entry->header.ends_with("Content-Length: 10\r\n\r\n"));
+    ASSERT_EQ(0, hit->offset);
+    ASSERT_EQ(10, hit->length);
+
+    auto partial = cache.get_file_hit(path, 11, "bytes=2-5");
+    ASSERT_TRUE(partial != nullptr);
+    std::string header = hit_header(*partial);
+    ASSERT_TRUE(header.starts_with("HTTP/1.1 206 Partial Content\r\n"));
+    ASSERT_TRUE(header.find("Content-Range: bytes 2-5/10\r\n") != std::string::npos);
+    ASSERT_TRUE(header.ends_with("Content-Length: 4\r\n\r\n"));
+    ASSERT_TRUE(header.find("Content-Length: 10") == std::string::npos);
+    ASSERT_EQ(2, partial->offset);
+    ASSERT_EQ(4, partial->length);
+
+    auto old_client = cache.get_file_hit(path, 10, "bytes=20-30");
+    ASSERT_TRUE(old_client != nullptr);
+    header = hit_header(*old_client);
+    ASSERT_TRUE(header.starts_with("HTTP/1.0 200 OK\r\n"));
+    ASSERT_TRUE(header.ends_with("Content-Length: 10\r\n\r\n"));
+    ASSERT_FALSE(old_client->keep_alive());
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: A pass above the high watermark evicts down to the low watermark, hot files stay
+bool test_eviction_watermarks() {
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", "127.0.0.1:1");
+    cache.wait_for_index();
+
+    for (int i = 0; i < 10; i++) {
+        std::string path = "/debian/pool/main/e/evict/file" + std::to_string(i) + ".deb";
+        fs::create_directories(fs::path(cache.get_cache_path(path)).parent_path());
+        std::ofstream(cache.get_cache_path(path), std::ios::binary) << std::string(100, 'e');
+        ASSERT_TRUE(cache.get_entry(path) != nullptr);
+    }
+    ASSERT_EQ(1000, cache.get_cached_bytes());
+
+    // Files 7-9 are hit twice, the rest are never hit
+    for (int i = 7; i < 10; i++) {
+        auto entry = cache.get_entry("/debian/pool/main/e/evict/file" + std::to_string(i) + ".deb");
+        entry->touch();
+        entry->touch();
+    }
+
+    CacheEvictor evictor(cache, 1000, 0.9, 0.5, eviction_policy::slru, std::chrono::seconds(60));
+    ASSERT_EQ(5, evictor.run_once());
+    ASSERT_EQ(500, cache.get_cached_bytes());
+    ASSERT_EQ(500, evictor.get_evicted_bytes());
+    for (int i = 7; i < 10; i++) {
+        ASSERT_TRUE(cache.is_cached("/debian/pool/main/e/evict/file" + std::to_string(i) + ".deb"));
+    }
+    ASSERT_FALSE(fs::exists(cache.get_cache_path("/debian/pool/main/e/evict/file0.deb")));
+
+    // Under the high watermark nothing happens
+    ASSERT_EQ(0, evictor.run_once());
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Sequential misses share one keep-alive upstream connection, or not if disabled
+bool test_upstream_keep_alive() {
+    for (bool keep_alive : {true, false}) {
+        test::MockUpstream upstream;
+        for (int i = 0; i < 4; i++) {
+            upstream.set_file("/debian/pool/main/k/keep/file" + std::to_string(i) + ".deb", "keep" + std::to_string(i));
+        }
+
+        Config config;
+        config.set("upstream_keep_alive", keep_alive ? "true" : "false");
+        fs::remove_all("./test_cache_async");
+        FileCache cache(config, "./test_cache_async", upstream.host());
+
+        net::io_context io_context;
+        int completed = 0;
+        for (int i = 0; i < 4; i++) {
+            cache.async_ensure_cached(io_context.get_executor(), "/debian/pool/main/k/keep/file" + std::to_string(i) + ".deb",
+                [&completed](bool success) { if (success) completed++; });
+            io_context.run();
+            io_context.restart();
+        }
+
+        ASSERT_EQ(4, completed);
+        ASSERT_EQ(keep_alive ? 1 : 4, upstream.connection_count());
+        ASSERT_EQ(keep_alive ? 3 : 0, cache.get_upstream_pool().get_reused_connections());
+        ASSERT_EQ(3, cache.get_upstream_pool().get_dns_cache_hits());
+        ASSERT_EQ(keep_alive ? 1 : 0, cache.get_upstream_pool().idle_count(upstream.host()));
+
+        fs::remove_all("./test_cache_async");
+    }
+    return true;
+}
+
+// Test: Concurrent misses beyond the per-host limit queue for a connection
+bool test_upstream_connection_limit() {
+    test::MockUpstream upstream;
+    for (int i = 0; i < 6; i++) {
+        upstream.set_file("/debian/pool/main/l/limit/file" + std::to_string(i) + ".deb", "limit");
+    }
+    upstream.set_delay(std::chrono::milliseconds(20));
+
+    Config config;
+    config.set("upstream_max_connections", "2");
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    int completed = 0;
+    for (int i = 0; i < 6; i++) {
+        cache.async_ensure_cached(io_context.get_executor(), "/debian/pool/main/l/limit/file" + std::to_string(i) + ".deb",
+            [&completed](bool success) { if (success) completed++; });
+    }
+    io_context.run();
+
+    ASSERT_EQ(6, completed);
+    ASSERT_EQ(2, upstream.connection_count());
+    ASSERT_EQ(2, cache.get_upstream_pool().idle_count(upstream.host()));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: A pooled connection closed by the server is replaced without a failed attempt
+bool test_upstream_stale_connection() {
+    test::MockUpstream upstream;
+    upstream.set_file("/first.deb", "first");
+    upstream.set_file("/second.deb", "second");
+
+    Config config;
+    config.set("max_retries", "1");
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    bool cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), "/first.deb", [&cached](bool success) { cached = success; });
+    io_context.run();
+    io_context.restart();
+    ASSERT_TRUE(cached);
+    ASSERT_EQ(1, cache.get_upstream_pool().idle_count(upstream.host()));
+
+    upstream.drop_connections();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), "/second.deb", [&cached](bool success) { cached = success; });
+    io_context.run();
+
+    ASSERT_TRUE(cached);
+    ASSERT_EQ(2, upstream.connection_count());
+    ASSERT_STREQ("second", read_file(cache.get_cache_path("/second.deb")));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Mirrors are explored in order, then ranked by latency and throughput, failed ones last
+bool test_mirror_selection() {
+    MirrorSet mirrors("a.example:80, b.example:80,c.example:8080", std::chrono::seconds(30));
+    ASSERT_EQ(3, mirrors.size());
+    ASSERT_STREQ("c.example:8080", mirrors.host(2));
+
+    using std::chrono::milliseconds;
+    ASSERT_EQ(0, *mirrors.select());
+    mirrors.report_success(0, milliseconds(100), 1024 * 1024, milliseconds(1000));
+    ASSERT_EQ(1, *mirrors.select());
+    mirrors.report_success(1, milliseconds(10), 1024 * 1024, milliseconds(100));
+    ASSERT_EQ(2, *mirrors.select());
+    mirrors.report_success(2, milliseconds(500), 1024 * 1024, milliseconds(100));
+    ASSERT_EQ(1, *mirrors.select());
+
+    // A failed mirror only comes back as the last resort
+    mirrors.report_failure(1);
+    ASSERT_EQ(2, *mirrors.select());
+    ASSERT_EQ(0, *mirrors.select({2}));
+    ASSERT_EQ(1, *mirrors.select({0, 2}));
+    ASSERT_FALSE(mirrors.select({0, 1, 2}).has_value());
+
+    auto stats = mirrors.snapshot();
+    ASSERT_FALSE(stats[1].healthy);
+    ASSERT_EQ(1, stats[1].failures);
+    ASSERT_EQ(1, stats[0].fetches);
+    return true;
+}
+
+// Test: A dead mirror is skipped without backoff and a missing file is asked of the others
+bool test_mirror_failover() {
+    test::MockUpstream behind;
+    test::MockUpstream upstream;
+    upstream.set_file("/debian/pool/main/f/failover/a.deb", "failover a");
+    upstream.set_file("/debian/pool/main/f/failover/b.deb", "failover b");
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", "127.0.0.1:1," + behind.host() + "," + upstream.host());
+
+    auto start = std::chrono::steady_clock::now();
+    net::io_context io_context;
+    bool cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), "/debian/pool/main/f/failover/a.deb",
+        [&cached](bool success) { cached = success; });
+    io_context.run();
+    io_context.restart();
+
+    ASSERT_TRUE(cached);
+    ASSERT_TRUE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(900));
+    ASSERT_EQ(1, behind.request_count("/debian/pool/main/f/failover/a.deb"));
+    ASSERT_EQ(1, upstream.request_count("/debian/pool/main/f/failover/a.deb"));
+
+    // The dead mirror is down now, a 404 does not take a mirror out
+    auto stats = cache.get_mirrors().snapshot();
+    ASSERT_FALSE(stats[0].healthy);
+    ASSERT_TRUE(stats[1].healthy);
+    ASSERT_EQ(1, stats[2].fetches);
+
+    cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), "/debian/pool/main/f/failover/b.deb",
+        [&cached](bool success) { cached = success; });
+    io_context.run();
+    ASSERT_TRUE(cached);
+    ASSERT_EQ(1, cache.get_mirrors().snapshot()[0].failures);
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: A probe lets a reachable mirror back in
+bool test_mirror_probe() {
+    test::MockUpstream upstream;
+    MirrorSet mirrors("127.0.0.1:1," + upstream.host(), std::chrono::seconds(30));
+    mirrors.report_failure(0);
+    mirrors.report_failure(1);
+
+    ASSERT_EQ(1, mirrors.probe_once(std::chrono::milliseconds(500)));
+    auto stats = mirrors.snapshot();
+    ASSERT_FALSE(stats[0].healthy);
+    ASSERT_TRUE(stats[1].healthy);
+    ASSERT_EQ(1, *mirrors.select());
+    return true;
+}
+
+// Test helper: whether a staging file is left in a directory tree
+static bool has_staging_file(const std::string& dir) {
+    for (const auto& file : fs::recursive_directory_iterator(dir)) {
+        if (file.path().filename().string().starts_with(".pacprism-") &&
+            file.path().filename().string().ends_with(".part")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Test: Large misses are fetched as parallel ranges and committed in one piece
+bool test_segmented_fetch() {
+    std::string body;
+    for (int i = 0; i < 300000; i++) {
+        body += static_cast<char>('a' + (i * 13) % 26);
+    }
+    const std::string path = "/debian/pool/main/t/texlive-base/texlive-base_2022_all.deb";
+    test::MockUpstream upstream;
+    upstream.set_range_support(true);
+    upstream.set_file(path, body);
+    upstream.set_file("/debian/pool/main/s/small/small_1.0_all.deb", std::string(50000, 's'));
+
+    Config config;
+    config.set("segment_threshold", "100K");
+    config.set("segment_size", "64K");
+    config.set("segment_parallelism", "3");
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    std::shared_ptr<streaming_response> response;
+    cache.async_fetch_streaming(io_context.get_executor(), path, 11,
+        [&response](std::shared_ptr<streaming_response> result) { response = result; });
+    bool small = false;
+    cache.async_ensure_cached(io_context.get_executor(), "/debian/pool/main/s/small/small_1.0_all.deb",
+        [&small](bool success) { small = success; });
+    io_context.run();
+
+    // The plain GET carries the first 64K segment, ranges fetch the four others; readers see the full length up front
+    ASSERT_TRUE(response != nullptr);
+    ASSERT_STREQ("300000", std::string(response->header[http::field::content_length]));
+    ASSERT_TRUE(response->progress->snapshot().success);
+    ASSERT_EQ(300000, response->progress->snapshot().bytes_on_disk);
+    ASSERT_EQ(5, upstream.request_count(path));
+    ASSERT_TRUE(read_file(cache.get_cache_path(path)) == body);
+    ASSERT_EQ(300000, cache.get_entry(path)->size);
+    ASSERT_FALSE(has_staging_file("./test_cache_async"));
+
+    // Below the threshold the file comes in one plain GET, as without segmenting
+    ASSERT_TRUE(small);
+    ASSERT_EQ(1, upstream.request_count("/debian/pool/main/s/small/small_1.0_all.deb"));
+    ASSERT_STREQ("", upstream.last_range("/debian/pool/main/s/small/small_1.0_all.deb"));
+    ASSERT_EQ(50000, cache.get_entry("/debian/pool/main/s/small/small_1.0_all.deb")->size);
+
+    // A mirror that does not announce range support sends the large file whole
+    test::MockUpstream plain;
+    plain.set_file(path, body);
+    fs::remove_all("./test_cache_plain");
+    {
+        FileCache plain_cache(config, "./test_cache_plain", plain.host());
+        net::io_context plain_context;
+        bool cached = false;
+        plain_cache.async_ensure_cached(plain_context.get_executor(), path, [&cached](bool success) { cached = success; });
+        plain_context.run();
+        ASSERT_TRUE(cached);
+        ASSERT_EQ(1, plain.request_count(path));
+        ASSERT_STREQ("", plain.last_range(path));
+        ASSERT_TRUE(read_file(plain_cache.get_cache_path(path)) == body);
+    }
+    fs::remove_all("./test_cache_plain");
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Segments are spread over mirrors, a failed segment discards the staging file
+bool test_segmented_fetch_mirrors() {
+    std::string body(400000, 'm');
+    for (std::size_t i = 0; i < body.size(); i += 1000) {
+        body[i] = static_cast<char>('0' + (i / 1000) % 10);
+    }
+    const std::string path = "/debian/pool/main/l/llvm-toolchain/clang_16_amd64.deb";
+    test::MockUpstream first;
+    test::MockUpstream second;
+    for (auto* mirror : {&first, &second}) {
+        mirror->set_range_support(true);
+        mirror->set_file(path, body);
+    }
+
+    Config config;
+    config.set("segment_threshold", "64K");
+    config.set("segment_size", "64K");
+    config.set("segment_parallelism", "4");
+    fs::remove_all("./test_cache_async");
+    {
+        FileCache cache(config, "./test_cache_async", first.host() + "," + second.host());
+        net::io_context io_context;
+        bool cached = false;
+        cache.async_ensure_cached(io_context.get_executor(), path, [&cached](bool success) { cached = success; });
+        io_context.run();
+
+        ASSERT_TRUE(cached);
+        ASSERT_TRUE(read_file(cache.get_cache_path(path)) == body);
+        ASSERT_TRUE(first.request_count(path) > 1);
+        ASSERT_TRUE(second.request_count(path) > 1);
+        ASSERT_EQ(7, first.request_count(path) + second.request_count(path));
+    }
+
+    // A segment that keeps failing fails the download and discards the staging file
+    test::MockUpstream broken;
+    broken.set_range_support(true);
+    broken.set_range_limit(1);
+    broken.set_file(path, body);
+    config.set("max_retries", "1");
+    fs::remove_all("./test_cache_async");
+    {
+        FileCache cache(config, "./test_cache_async", broken.host());
+        net::io_context io_context;
+        bool cached = true;
+        cache.async_ensure_cached(io_context.get_executor(), path, [&cached](bool success) { cached = success; });
+        io_context.run();
+
+        ASSERT_FALSE(cached);
+        ASSERT_FALSE(cache.is_cached(path));
+        ASSERT_FALSE(fs::exists(cache.get_cache_path(path)));
+        ASSERT_FALSE(has_staging_file("./test_cache_async"));
+    }
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test helper: whether a resume sidecar is left in a directory tree
+static bool has_resume_file(const std::string& dir) {
+    for (const auto& file : fs::recursive_directory_iterator(dir)) {
+        if (file.path().filename().string().ends_with(".resume")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Test: A cut off download continues with a range request on the next attempt
+bool test_resume_fetch() {
+    std::string body;
+    for (int i = 0; i < 200000; i++) {
+        body += static_cast<char>('a' + (i * 7) % 26);
+    }
+    const std::string path = "/debian/pool/main/g/gcc-12/cpp-12_12.2.0_amd64.deb";
+    test::MockUpstream upstream;
+    upstream.set_range_support(true);
+    upstream.set_file(path, body);
+    upstream.set_truncate_once(path, 50000);
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    bool cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), path, [&cached](bool success) { cached = success; });
+    io_context.run();
+
+    ASSERT_TRUE(cached);
+    ASSERT_EQ(2, upstream.request_count(path));
+    ASSERT_STREQ("bytes=50000-", upstream.last_range(path));
+    ASSERT_TRUE(read_file(cache.get_cache_path(path)) == body);
+    // The digest covers the bytes of both attempts
+    Digest digest;
+    digest.update(body.data(), body.size());
+    ASSERT_STREQ(digest.hex_digest(), cache.get_entry(path)->sha256);
+    ASSERT_FALSE(has_staging_file("./test_cache_async"));
+    ASSERT_FALSE(has_resume_file("./test_cache_async"));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: A partial file survives a restart and is continued, unless upstream changed it
+bool test_resume_fetch_restart() {
+    std::string body(200000, 'r');
+    for (std::size_t i = 0; i < body.size(); i += 100) {
+        body[i] = static_cast<char>('0' + (i / 100) % 10);
+    }
+    const std::string path = "/debian/pool/main/p/perl/perl-modules-5.36_5.36.0_all.deb";
+    test::MockUpstream upstream;
+    upstream.set_range_support(true);
+    upstream.set_file(path, body);
+    upstream.set_truncate_once(path, 80000);
+
+    Config config;
+    config.set("max_retries", "1");
+    fs::remove_all("./test_cache_async");
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        net::io_context io_context;
+        bool cached = true;
+        cache.async_ensure_cached(io_context.get_executor(), path, [&cached](bool success) { cached = success; });
+        io_context.run();
+
+        ASSERT_FALSE(cached);
+        ASSERT_FALSE(fs::exists(cache.get_cache_path(path)));
+        ASSERT_TRUE(has_staging_file("./test_cache_async"));
+        ASSERT_TRUE(has_resume_file("./test_cache_async"));
+    }
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        net::io_context io_context;
+        bool cached = false;
+        cache.async_ensure_cached(io_context.get_executor(), path, [&cached](bool success) { cached = success; });
+        io_context.run();
+
+        ASSERT_TRUE(cached);
+        ASSERT_EQ(2, upstream.request_count(path));
+        ASSERT_STREQ("bytes=80000-", upstream.last_range(path));
+        ASSERT_TRUE(read_file(cache.get_cache_path(path)) == body);
+        // The partial file of the first run was read back into the digest
+        Digest digest;
+        digest.update(body.data(), body.size());
+        ASSERT_STREQ(digest.hex_digest(), cache.get_entry(path)->sha256);
+        ASSERT_FALSE(has_staging_file("./test_cache_async"));
+        ASSERT_FALSE(has_resume_file("./test_cache_async"));
+    }
+
+    // The file changed upstream meanwhile: If-Range fails and the new file is fetched whole
+    const std::string changed = std::string(150000, 'n');
+    upstream.set_file(path, body);
+    upstream.set_truncate_once(path, 80000);
+    fs::remove_all("./test_cache_async");
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        net::io_context io_context;
+        cache.async_ensure_cached(io_context.get_executor(), path, [](bool) {});
+        io_context.run();
+        ASSERT_TRUE(has_resume_file("./test_cache_async"));
+    }
+    upstream.set_file(path, changed);
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        net::io_context io_context;
+        bool cached = false;
+        cache.async_ensure_cached(io_context.get_executor(), path, [&cached](bool success) { cached = success; });
+        io_context.run();
+
+        ASSERT_TRUE(cached);
+        ASSERT_TRUE(read_file(cache.get_cache_path(path)) == changed);
+        ASSERT_FALSE(has_resume_file("./test_cache_async"));
+    }
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Startup removes unfinished downloads, keeping fresh resumable ones
+bool test_staging_cleanup() {
+    const std::string dir = "./test_cache_async/debian/pool/main/c/cleanup";
+    fs::remove_all("./test_cache_async");
+    fs::create_directories(dir);
+    for (const char* name : {".pacprism-orphan.deb.part",
+                             ".pacprism-resumable.deb.part", ".pacprism-resumable.deb.resume",
+                             ".pacprism-stale.deb.part", ".pacprism-stale.deb.resume",
+                             ".pacprism-lonely.deb.resume", "cached.deb"}) {
+        std::ofstream(dir + "/" + name) << "partial";
+    }
+    fs::last_write_time(dir + "/.pacprism-stale.deb.part",
+                        fs::file_time_type::clock::now() - std::chrono::hours(48));
+
+    Config config;
+    config.set("resume_max_age", "86400");
+    {
+        FileCache cache(config, "./test_cache_async", "127.0.0.1:1");
+        cache.wait_for_index();
+    }
+
+    ASSERT_FALSE(fs::exists(dir + "/.pacprism-orphan.deb.part"));
+    ASSERT_TRUE(fs::exists(dir + "/.pacprism-resumable.deb.part"));
+    ASSERT_TRUE(fs::exists(dir + "/.pacprism-resumable.deb.resume"));
+    ASSERT_FALSE(fs::exists(dir + "/.pacprism-stale.deb.part"));
+    ASSERT_FALSE(fs::exists(dir + "/.pacprism-stale.deb.resume"));
+    ASSERT_FALSE(fs::exists(dir + "/.pacprism-lonely.deb.resume"));
+    ASSERT_TRUE(fs::exists(dir + "/cached.deb"));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Negative cache remembers failures by TTL within its bound
+bool test_negative_cache() {
+    NegativeCache negative(2, std::chrono::seconds(60), std::chrono::seconds(0));
+    negative.insert("/debian/pool/main/a/a.deb", 404);
+    negative.insert("/debian/pool/main/b/b.deb", 503);
+
+    // A zero error TTL remembers no 5xx
+    ASSERT_EQ(404, negative.lookup("/debian/pool/main/a/a.deb").value_or(0));
+    ASSERT_FALSE(negative.lookup("/debian/pool/main/b/b.deb").has_value());
+
+    // The oldest path makes room
+    negative.insert("/debian/pool/main/c/c.deb", 410);
+    negative.insert("/debian/pool/main/d/d.deb", 404);
+    ASSERT_EQ(2, negative.size());
+    ASSERT_FALSE(negative.lookup("/debian/pool/main/a/a.deb").has_value());
+    ASSERT_EQ(410, negative.peek("/debian/pool/main/c/c.deb").value_or(0));
+    ASSERT_EQ(1, negative.get_hits());
+    ASSERT_EQ(2, negative.get_misses());
+
+    negative.erase("/debian/pool/main/c/c.deb");
+    ASSERT_FALSE(negative.peek("/debian/pool/main/c/c.deb").has_value());
+    return true;
+}
+
+// Test: Repeated misses of a path upstream lacks are not sent upstream again
+bool test_negative_cache_fetch() {
+    const std::string path = "/debian/pool/main/g/gone/gone_1.0_all.deb";
+    test::MockUpstream upstream;
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    int failed = 0;
+    for (int i = 0; i < 3; i++) {
+        cache.async_ensure_cached(io_context.get_executor(), path, [&failed](bool success) { failed += !success; });
+        io_context.run();
+        io_context.restart();
+    }
+    ASSERT_EQ(3, failed);
+    ASSERT_EQ(1, upstream.request_count(path));
+    ASSERT_EQ(404, cache.get_negative_cache().peek(path).value_or(0));
+
+    // Invalidating the path asks upstream again, which has it by now
+    upstream.set_file(path, "arrived");
+    cache.invalidate(path);
+    bool cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), path, [&cached](bool success) { cached = success; });
+    io_context.run();
+    ASSERT_TRUE(cached);
+    ASSERT_EQ(2, upstream.request_count(path));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Path classes decide which files are revalidated and when
+bool test_cache_policy() {
+    CachePolicy policy("*/dists/*/InRelease:60, */dists/* *.db", std::chrono::seconds(300));
+    ASSERT_TRUE(policy.enabled());
+    ASSERT_EQ(60, policy.ttl("/debian/dists/bookworm/InRelease").value_or(std::chrono::seconds(0)).count());
+    ASSERT_EQ(300, policy.ttl("/debian/dists/bookworm/main/binary-amd64/Packages.xz").value_or(std::chrono::seconds(0)).count());
+    ASSERT_EQ(300, policy.ttl("/archlinux/core/os/x86_64/core.db").value_or(std::chrono::seconds(0)).count());
+    ASSERT_FALSE(policy.ttl("/debian/pool/main/h/hello/hello_2.10-3_amd64.deb").has_value());
+
+    // A zero TTL keeps everything immutable
+    CachePolicy immutable("*/dists/*", std::chrono::seconds(0));
+    ASSERT_FALSE(immutable.enabled());
+    ASSERT_FALSE(immutable.ttl("/debian/dists/bookworm/InRelease").has_value());
+    return true;
+}
+
+// Test helper: wait until a file has the expected content
+static bool wait_for_content(const std::string& path, const std::string& content) {
+    for (int i = 0; i < 200 && read_file(path) != content; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return read_file(path) == content;
+}
+
+// Test: Stale metadata is served at once while one background request revalidates it
+bool test_cache_revalidation() {
+    const std::string path = "/debian/dists/bookworm/InRelease";
+    const std::string pool_path = "/debian/pool/main/h/hello/hello_2.10-3_amd64.deb";
+    test::MockUpstream upstream;
+    upstream.set_file(path, "release v1");
+    upstream.set_file(pool_path, "hello");
+
+    Config config;
+    config.set("metadata_ttl", "1");
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+
+    net::io_context io_context;
+    auto ensure = [&](const std::string& request_path) {
+        bool cached = false;
+        cache.async_ensure_cached(io_context.get_executor(), request_path, [&cached](bool success) { cached = success; });
+        io_context.run();
+        io_context.restart();
+        return cached;
+    };
+    ASSERT_TRUE(ensure(path));
+    ASSERT_TRUE(ensure(pool_path));
+
+    // Changed upstream after the TTL: hits get the old copy until the refresh replaced it
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    upstream.set_file(path, "release v2");
+    upstream.set_file(pool_path, "changed");
+    for (int i = 0; i < 5; i++) {
+        ASSERT_TRUE(ensure(path));
+        ASSERT_TRUE(ensure(pool_path));
+    }
+    ASSERT_TRUE(wait_for_content(cache.get_cache_path(path), "release v2"));
+    ASSERT_EQ(2, upstream.request_count(path));
+    ASSERT_EQ(0, upstream.not_modified_count(path));
+    ASSERT_TRUE(cache.is_cached(path));
+    // Upstream's own validators are kept for the next revalidation, not the local mtime
+    for (int i = 0; i < 200 && cache.get_entry(path)->upstream_etag.empty(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_FALSE(cache.get_entry(path)->upstream_etag.empty());
+    ASSERT_TRUE(cache.get_entry(path)->upstream_mtime > 0);
+
+    // Pool files are immutable
+    ASSERT_EQ(1, upstream.request_count(pool_path));
+    ASSERT_TRUE(read_file(cache.get_cache_path(pool_path)) == "hello");
+
+    // Unchanged upstream: a 304 keeps the copy
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    ASSERT_TRUE(ensure(path));
+    for (int i = 0; i < 200 && upstream.request_count(path) < 3; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(3, upstream.request_count(path));
+    // Sent back exactly, so even an exact-match origin answers 304
+    for (int i = 0; i < 200 && upstream.not_modified_count(path) < 1; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(1, upstream.not_modified_count(path));
+    cache.wait_for_index();
+    ASSERT_TRUE(read_file(cache.get_cache_path(path)) == "release v2");
+    ASSERT_TRUE(cache.is_cached(path));
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test helper: wait until a file has the expected number of hardlinks
+static bool wait_for_links(const std::string& path, std::uintmax_t links) {
+    std::error_code ec;
+    for (int i = 0; i < 200 && fs::hard_link_count(path, ec) != links; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return fs::hard_link_count(path, ec) == links;
+}
+
+// Test: Identical files under several paths share one blob until the last path goes
+bool test_cache_dedup() {
+    const std::string path = "/debian/pool/main/h/hello/hello_2.10-3_amd64.deb";
+    const std::string copy = "/debian/dists/bookworm/main/binary-amd64/by-hash/hello.deb";
+    const std::string other = "/debian/pool/main/o/other/other_1.0_all.deb";
+    const std::string body(10000, 'h');
+    test::MockUpstream upstream;
+    upstream.set_file(path, body);
+    upstream.set_file(copy, body);
+    upstream.set_file(other, "other");
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        net::io_context io_context;
+        for (const auto& request_path : {path, copy, other}) {
+            cache.async_ensure_cached(io_context.get_executor(), request_path, [](bool) {});
+            io_context.run();
+            io_context.restart();
+        }
+
+        // Blob plus both paths
+        ASSERT_TRUE(wait_for_links(cache.get_cache_path(path), 3));
+        ASSERT_TRUE(fs::equivalent(cache.get_cache_path(path), cache.get_cache_path(copy)));
+        ASSERT_TRUE(wait_for_links(cache.get_cache_path(other), 2));
+        ASSERT_TRUE(read_file(cache.get_cache_path(copy)) == body);
+
+        auto entry = cache.get_entry(copy);
+        ASSERT_TRUE(entry != nullptr);
+        ASSERT_EQ(64, entry->sha256.size());
+        auto blob = cache.get_blob_store().blob_path(entry->sha256);
+        auto stats = cache.get_blob_store().get_stats();
+        ASSERT_EQ(2, stats.blobs);
+        ASSERT_EQ(body.size() + 5, stats.stored_bytes);
+        ASSERT_EQ(2 * body.size() + 5, stats.linked_bytes);
+
+        // The blob goes with its last path
+        ASSERT_TRUE(cache.evict(path));
+        ASSERT_EQ(2, fs::hard_link_count(blob));
+        ASSERT_TRUE(cache.evict(copy));
+        ASSERT_FALSE(fs::exists(blob));
+        ASSERT_EQ(1, cache.get_blob_store().get_stats().blobs);
+    }
+
+    // A blob left without paths is collected at startup
+    auto orphan = BlobStore("./test_cache_async/.pacprism-blobs").blob_path(std::string(64, 'a'));
+    fs::create_directories(orphan.parent_path());
+    std::ofstream(orphan.string()) << "orphan";
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        cache.wait_for_index();
+        ASSERT_FALSE(fs::exists(orphan));
+        ASSERT_TRUE(cache.is_cached(other));
+        // Recounted by the walk
+        auto recounted = cache.get_blob_store().get_stats();
+        ASSERT_EQ(1, recounted.blobs);
+        ASSERT_EQ(5, recounted.stored_bytes);
+        ASSERT_EQ(5, recounted.linked_bytes);
+    }
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Pool files that do not match their Packages checksum are never cached
+bool test_cache_verify_downloads() {
+    const std::string index_path = "/debian/dists/bookworm/main/binary-amd64/Packages";
+    const std::string path = "/debian/pool/main/h/hello/hello_2.10-3_amd64.deb";
+    const std::string body = "hello package";
+    Digest digest;
+    digest.update(body.data(), body.size());
+    const std::string sha256 = digest.hex_digest();
+
+    test::MockUpstream upstream;
+    upstream.set_file(index_path, "Package: hello\nFilename: pool/main/h/hello/hello_2.10-3_amd64.deb\n"
+                                  "Size: 13\nSHA256: " + sha256 + "\n\n");
+    upstream.set_file(path, "hellO package");
+
+    Config config;
+    config.set("max_retries", "1");
+    config.set("negative_error_ttl", "0");
+    fs::remove_all("./test_cache_async");
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        net::io_context io_context;
+        auto ensure = [&](const std::string& request_path) {
+            bool cached = false;
+            cache.async_ensure_cached(io_context.get_executor(), request_path, [&cached](bool success) { cached = success; });
+            io_context.run();
+            io_context.restart();
+            return cached;
+        };
+
+        // Checksums are known once the index is loaded in the background
+        ASSERT_TRUE(ensure(index_path));
+        for (int i = 0; i < 200 && !cache.get_package_index().lookup(path); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ASSERT_TRUE(cache.get_package_index().lookup(path).has_value());
+
+        // Corrupt mirror data fails the fetch and leaves nothing behind
+        ASSERT_FALSE(ensure(path));
+        ASSERT_FALSE(fs::exists(cache.get_cache_path(path)));
+        ASSERT_FALSE(has_staging_file("./test_cache_async/debian/pool/main/h/hello"));
+        ASSERT_EQ(1, cache.get_mirrors().snapshot()[0].failures);
+
+        // The right bytes are cached with their digest
+        upstream.set_file(path, body);
+        ASSERT_TRUE(ensure(path));
+        ASSERT_TRUE(read_file(cache.get_cache_path(path)) == body);
+        auto entry = cache.get_entry(path);
+        ASSERT_TRUE(entry != nullptr);
+        ASSERT_TRUE(entry->sha256 == sha256);
+    }
+
+    // Indexes already cached are loaded at startup
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        cache.wait_for_index();
+        ASSERT_TRUE(cache.get_package_index().lookup(path).has_value());
+    }
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test helper: gzip compressed bytes
+static std::string gzip(const std::string& data) {
+    z_stream stream = {};
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = out.size();
+    deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+// Test helper: xz compressed bytes
+static std::string xz(const std::string& data) {
+    std::string out(lzma_stream_buffer_bound(data.size()), '\0');
+    size_t written = 0;
+    lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, nullptr, reinterpret_cast<const std::uint8_t*>(data.data()),
+                            data.size(), reinterpret_cast<std::uint8_t*>(out.data()), &written, out.size());
+    out.resize(written);
+    return out;
+}
+
+// Test: Checksums are read from xz and gzip compressed indexes, by name or by-hash
+bool test_cache_verify_compressed_indexes() {
+    ASSERT_TRUE(PackageIndex::is_index("/debian/dists/bookworm/main/binary-amd64/Packages.xz"));
+    ASSERT_TRUE(PackageIndex::is_index("/debian/dists/bookworm/main/binary-amd64/Packages.gz"));
+    ASSERT_TRUE(PackageIndex::is_index("/debian/dists/bookworm/main/binary-amd64/by-hash/SHA256/abc"));
+    ASSERT_FALSE(PackageIndex::is_index("/debian/dists/bookworm/main/i18n/by-hash/SHA256/abc"));
+    ASSERT_FALSE(PackageIndex::is_index("/debian/dists/bookworm/main/Contents-amd64.gz"));
+
+    const std::string gz_path = "/debian/dists/bookworm/main/binary-amd64/Packages.gz";
+    const std::string hello = "/debian/pool/main/h/hello/hello_2.10-3_amd64.deb";
+    const std::string other = "/debian/pool/main/o/other/other_1.0_i386.deb";
+    auto stanza = [](const std::string& name, const std::string& filename, const std::string& body) {
+        Digest digest;
+        digest.update(body.data(), body.size());
+        return "Package: " + name + "\nFilename: " + filename + "\nSize: " + std::to_string(body.size()) +
+               "\nSHA256: " + digest.hex_digest() + "\n\n";
+    };
+    // Large enough to span several decompressed blocks
+    std::string amd64;
+    for (int i = 0; i < 2000; i++) {
+        amd64 += stanza("filler" + std::to_string(i), "pool/main/f/filler/filler_" + std::to_string(i) + ".deb", "x");
+    }
+    amd64 += stanza("hello", "pool/main/h/hello/hello_2.10-3_amd64.deb", "hello package");
+    const std::string i386 = xz(stanza("other", "pool/main/o/other/other_1.0_i386.deb", "other package"));
+    Digest i386_digest;
+    i386_digest.update(i386.data(), i386.size());
+    const std::string xz_path = "/debian/dists/bookworm/main/binary-i386/by-hash/SHA256/" + i386_digest.hex_digest();
+
+    test::MockUpstream upstream;
+    upstream.set_file(gz_path, gzip(amd64));
+    upstream.set_file(xz_path, i386);
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        net::io_context io_context;
+        for (const auto& request_path : {gz_path, xz_path}) {
+            cache.async_ensure_cached(io_context.get_executor(), request_path, [](bool) {});
+            io_context.run();
+            io_context.restart();
+        }
+        for (int i = 0; i < 200 && !(cache.get_package_index().lookup(hello) && cache.get_package_index().lookup(other)); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ASSERT_EQ(13, cache.get_package_index().lookup(hello)->size);
+        ASSERT_EQ(13, cache.get_package_index().lookup(other)->size);
+        ASSERT_EQ(2002, cache.get_package_index().size());
+    }
+
+    // Read again at startup
+    {
+        FileCache cache(config, "./test_cache_async", upstream.host());
+        cache.wait_for_index();
+        ASSERT_TRUE(cache.get_package_index().lookup(hello).has_value());
+        ASSERT_TRUE(cache.get_package_index().lookup(other).has_value());
+    }
+
+    // A truncated index adds nothing
+    const std::string truncated = "./test_cache_async/truncated.xz";
+    std::ofstream(truncated, std::ios::binary) << i386.substr(0, i386.size() / 2);
+    PackageIndex index;
+    ASSERT_EQ(0, index.load_file("/debian", truncated));
+    ASSERT_EQ(0, index.size());
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: A scrub quarantines files that rotted on disk and records missing digests
+bool test_cache_scrub() {
+    const std::string path = "/debian/pool/main/h/hello/hello_2.10-3_amd64.deb";
+    const std::string other = "/debian/pool/main/o/other/other_1.0_all.deb";
+    const std::string local = "/debian/pool/main/l/local/local_1.0_all.deb";
+    test::MockUpstream upstream;
+    upstream.set_file(path, "hello package");
+    upstream.set_file(other, "other package");
+
+    Config config;
+    config.set("dedup", "false");
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+    net::io_context io_context;
+    for (const auto& request_path : {path, other}) {
+        cache.async_ensure_cached(io_context.get_executor(), request_path, [](bool) {});
+        io_context.run();
+        io_context.restart();
+    }
+    // Placed by hand, nothing recorded its digest
+    fs::create_directories(fs::path(cache.get_cache_path(local)).parent_path());
+    std::ofstream(cache.get_cache_path(local)) << "local package";
+    ASSERT_TRUE(cache.is_cached(local));
+    ASSERT_TRUE(cache.get_entry(local)->sha256.empty());
+
+    // A flipped byte, same size and mtime
+    auto mtime = fs::last_write_time(cache.get_cache_path(path));
+    {
+        std::fstream file(cache.get_cache_path(path), std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(3);
+        file.put('L');
+    }
+    fs::last_write_time(cache.get_cache_path(path), mtime);
+
+    CacheScrubber scrubber(cache, 2, 0, std::chrono::seconds(3600));
+    ASSERT_EQ(1, scrubber.run_once());
+    ASSERT_EQ(3, scrubber.get_scrubbed_files());
+    ASSERT_EQ(1, scrubber.get_corrupt_files());
+    ASSERT_FALSE(cache.is_cached(path));
+    ASSERT_TRUE(read_file("./test_cache_async/.pacprism-quarantine" + path) == "helLo package");
+    ASSERT_TRUE(cache.get_entry(other) != nullptr);
+    ASSERT_EQ(64, cache.get_entry(local)->sha256.size());
+
+    // The next request fetches a good copy
+    bool cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), path, [&cached](bool success) { cached = success; });
+    io_context.run();
+    ASSERT_TRUE(cached);
+    ASSERT_TRUE(read_file(cache.get_cache_path(path)) == "hello package");
+    ASSERT_EQ(0, scrubber.run_once());
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: A corrupt file shared through a blob takes its other cached paths along
+bool test_cache_scrub_dedup() {
+    const std::string path = "/debian/pool/main/h/hello/hello_2.10-3_amd64.deb";
+    const std::string copy = "/debian/dists/bookworm/main/binary-amd64/by-hash/hello.deb";
+    test::MockUpstream upstream;
+    upstream.set_file(path, "hello package");
+    upstream.set_file(copy, "hello package");
+
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", upstream.host());
+    net::io_context io_context;
+    for (const auto& request_path : {path, copy}) {
+        cache.async_ensure_cached(io_context.get_executor(), request_path, [](bool) {});
+        io_context.run();
+        io_context.restart();
+    }
+    ASSERT_TRUE(wait_for_links(cache.get_cache_path(path), 3));
+    ASSERT_EQ(1, cache.get_blob_store().get_stats().blobs);
+
+    // Both paths see the flipped byte
+    auto mtime = fs::last_write_time(cache.get_cache_path(path));
+    {
+        std::fstream file(cache.get_cache_path(path), std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(3);
+        file.put('L');
+    }
+    fs::last_write_time(cache.get_cache_path(path), mtime);
+
+    CacheScrubber scrubber(cache, 2, 0, std::chrono::seconds(3600));
+    ASSERT_EQ(1, scrubber.run_once());
+    ASSERT_FALSE(cache.is_cached(path));
+    ASSERT_FALSE(cache.is_cached(copy));
+    ASSERT_FALSE(fs::exists(cache.get_cache_path(path)) && fs::exists(cache.get_cache_path(copy)));
+    auto stats = cache.get_blob_store().get_stats();
+    ASSERT_EQ(0, stats.blobs);
+    ASSERT_EQ(0, stats.linked_bytes);
+
+    // Refetched good
+    bool cached = false;
+    cache.async_ensure_cached(io_context.get_executor(), copy, [&cached](bool success) { cached = success; });
+    io_context.run();
+    ASSERT_TRUE(cached);
+    ASSERT_TRUE(read_file(cache.get_cache_path(copy)) == "hello package");
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
+// Test: Scrub reads of all workers stay under the rate
+bool test_cache_scrub_throttle() {
+    Config config;
+    fs::remove_all("./test_cache_async");
+    FileCache cache(config, "./test_cache_async", "127.0.0.1:1");
+    fs::create_directories("./test_cache_async/debian/pool/main/t/throttle");
+    for (int i = 0; i < 4; i++) {
+        std::string request_path = "/debian/pool/main/t/throttle/file" + std::to_string(i) + ".deb";
+        std::ofstream(cache.get_cache_path(request_path)) << std::string(32 * 1024, 'a' + i);
+        ASSERT_TRUE(cache.is_cached(request_path));
+    }
+
+    // 128KB at 96KB/s: the last read waits a second for its slot
+    CacheScrubber scrubber(cache, 4, 96 * 1024, std::chrono::seconds(3600));
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(0, scrubber.run_once());
+    ASSERT_TRUE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(950));
+    ASSERT_EQ(4, scrubber.get_scrubbed_files());
+    ASSERT_EQ(128 * 1024, scrubber.get_scrubbed_bytes());
+
+    fs::remove_all("./test_cache_async");
+    return true;
+}
+
 // Run all IO tests
 void run_io_tests() {
     test::TestSuite suite("Config Tests");
@@ -43,6 +1780,57 @@ void run_io_tests() {
     suite.add_test("Config: Set and get", test_config_set_get);
     suite.add_test("Config: Get with default", test_config_get_default);
     suite.add_test("Config: Has key", test_config_has_key);
+    suite.add_test("Config: Fetch buffer size", test_config_fetch_buffer_size);
+    suite.add_test("Config: I/O engine", test_config_io_engine);
+    suite.add_test("Config: Cache budget", test_config_cache_budget);
 
     suite.run();
+
+    test::TestSuite cache_suite("FileCache Tests");
+
+    cache_suite.add_test("FileCache: Async fetch", test_cache_async_fetch);
+    cache_suite.add_test("FileCache: Async fetch not found", test_cache_async_fetch_not_found);
+    cache_suite.add_test("FileCache: Miss does not block hit", test_cache_async_miss_does_not_block_hit);
+    cache_suite.add_test("FileCache: Single-flight misses", test_cache_single_flight);
+    cache_suite.add_test("FileCache: Streaming join", test_cache_streaming_join);
+    cache_suite.add_test("FileCache: Bounded buffer fetch", test_cache_bounded_buffer_fetch);
+    cache_suite.add_test("FileCache: Index insert, lookup, erase", test_index_insert_lookup_erase);
+    cache_suite.add_test("FileCache: Index hit", test_cache_index_hit);
+    cache_suite.add_test("FileCache: Index lazy fill", test_cache_index_lazy_fill);
+    cache_suite.add_test("FileCache: Index log round trip", test_index_log_round_trip);
+    cache_suite.add_test("FileCache: Index log compaction with concurrent appends", test_index_log_compact_concurrent);
+    cache_suite.add_test("FileCache: Index log torn and corrupt", test_index_log_torn_and_corrupt);
+    cache_suite.add_test("FileCache: Index rescan", test_index_rescan);
+    cache_suite.add_test("FileCache: Index restart", test_cache_index_restart);
+    cache_suite.add_test("FileCache: Index rescan on start", test_cache_index_rescan_on_start);
+    cache_suite.add_test("FileCache: Eviction order", test_eviction_order);
+    cache_suite.add_test("FileCache: Eviction watermarks", test_eviction_watermarks);
+    cache_suite.add_test("FileCache: Frequency sketch", test_frequency_sketch);
+    cache_suite.add_test("FileCache: W-TinyLFU order", test_tinylfu_order);
+    cache_suite.add_test("FileCache: Memory tier budget", test_memory_tier_budget);
+    cache_suite.add_test("FileCache: Memory tier admission", test_memory_tier_admission);
+    cache_suite.add_test("FileCache: Prepared hit header", test_prepared_hit_header);
+    cache_suite.add_test("FileCache: Upstream keep-alive", test_upstream_keep_alive);
+    cache_suite.add_test("FileCache: Upstream connection limit", test_upstream_connection_limit);
+    cache_suite.add_test("FileCache: Upstream stale connection", test_upstream_stale_connection);
+    cache_suite.add_test("FileCache: Mirror selection", test_mirror_selection);
+    cache_suite.add_test("FileCache: Mirror failover", test_mirror_failover);
+    cache_suite.add_test("FileCache: Mirror probe", test_mirror_probe);
+    cache_suite.add_test("FileCache: Segmented fetch", test_segmented_fetch);
+    cache_suite.add_test("FileCache: Segmented fetch across mirrors", test_segmented_fetch_mirrors);
+    cache_suite.add_test("FileCache: Resume fetch", test_resume_fetch);
+    cache_suite.add_test("FileCache: Resume fetch after restart", test_resume_fetch_restart);
+    cache_suite.add_test("FileCache: Staging file cleanup", test_staging_cleanup);
+    cache_suite.add_test("FileCache: Negative cache", test_negative_cache);
+    cache_suite.add_test("FileCache: Negative cache fetch", test_negative_cache_fetch);
+    cache_suite.add_test("FileCache: Cache policy", test_cache_policy);
+    cache_suite.add_test("FileCache: Revalidation", test_cache_revalidation);
+    cache_suite.add_test("FileCache: Deduplicated storage", test_cache_dedup);
+    cache_suite.add_test("FileCache: Verified downloads", test_cache_verify_downloads);
+    cache_suite.add_test("FileCache: Compressed package indexes", test_cache_verify_compressed_indexes);
+    cache_suite.add_test("FileCache: Scrub", test_cache_scrub);
+    cache_suite.add_test("FileCache: Scrub of deduplicated files", test_cache_scrub_dedup);
+    cache_suite.add_test("FileCache: Scrub throttling", test_cache_scrub_throttle);
+
+    cache_suite.run();
 }
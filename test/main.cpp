@@ -16,15 +16,21 @@ int main(int argc, char* argv[]) {
     std::cout << "   pacPrism Test Suite" << std::endl;
     std::cout << "========================================" << std::endl;
 
-    // Run all test suites
-    run_validator_tests();
-    run_dht_tests();
-    run_package_parser_tests();
-    run_parser_tests();
-    run_banner_tests();
-    run_io_tests();
-    run_transmission_tests();
-    run_router_tests();
+    // Run all test suites, or only the one named on the command line
+    std::string only = argc > 1 ? argv[1] : "";
+    auto run = [&only](const std::string& name, void (*suite)()) {
+        if (only.empty() || only == name) {
+            suite();
+        }
+    };
+    run("validator", run_validator_tests);
+    run("dht", run_dht_tests);
+    run("package", run_package_parser_tests);
+    run("parser", run_parser_tests);
+    run("banner", run_banner_tests);
+    run("io", run_io_tests);
+    run("transmission", run_transmission_tests);
+    run("router", run_router_tests);
 
     // Print summary
     test::print_summary();
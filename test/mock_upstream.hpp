@@ -0,0 +1,281 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <iomanip>
+#include <ctime>
+#include <functional>
+
+#include <boost/beast.hpp>
+#include <boost/asio.hpp>
+
+// Minimal HTTP mirror on 127.0.0.1 for FileCache tests
+// Serves registered files with an ETag and Last-Modified (the time set_file was called),
+// answers an If-None-Match or If-Modified-Since that matches them exactly (as nginx does
+// by default) with 304, unknown paths with 404, and counts requests per path.
+namespace test {
+
+class MockUpstream {
+public:
+    MockUpstream()
+        : m_acceptor(m_io_context, {boost::asio::ip::make_address("127.0.0.1"), 0}) {
+        accept();
+        m_thread = std::thread([this]() { m_io_context.run(); });
+    }
+
+    ~MockUpstream() {
+        m_io_context.stop();
+        m_thread.join();
+    }
+
+    // Upstream host string for FileCache ("127.0.0.1:port")
+    std::string host() const {
+        return "127.0.0.1:" + std::to_string(m_acceptor.local_endpoint().port());
+    }
+
+    // Register a file body for a request path
+    void set_file(const std::string& path, const std::string& body) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_files[path] = body;
+        m_modified[path] = std::time(nullptr);
+    }
+
+    // Answer "Range: bytes=a-b" and "bytes=a-" requests with 206 and announce it with
+    // "Accept-Ranges: bytes" (ignored and not announced by default)
+    void set_range_support(bool enabled) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ranges = enabled;
+    }
+
+    // Answer only the first n range requests, 503 afterwards
+    void set_range_limit(int limit) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_range_limit = limit;
+    }
+
+    // Cut the next response for a path off after n body bytes and close the connection
+    void set_truncate_once(const std::string& path, std::size_t bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_truncate[path] = bytes;
+    }
+
+    // Range header of the last request for a path
+    std::string last_range(const std::string& path) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_last_ranges[path];
+    }
+
+    // Number of 304 responses for a path
+    int not_modified_count(const std::string& path) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_not_modified[path];
+    }
+
+    // Delay every response by the given duration
+    void set_delay(std::chrono::milliseconds delay) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_delay = delay;
+    }
+
+    // Number of requests received for a path
+    int request_count(const std::string& path) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_counts[path];
+    }
+
+    // Number of connections accepted
+    int connection_count() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_connections;
+    }
+
+    // Close every open connection from the server side
+    void drop_connections() {
+        std::vector<std::weak_ptr<Session>> sessions;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            sessions.swap(m_sessions);
+        }
+        boost::asio::post(m_io_context, [sessions]() {
+            for (auto& weak : sessions) {
+                if (auto session = weak.lock()) {
+                    boost::system::error_code ignored;
+                    session->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                    session->socket.close(ignored);
+                }
+            }
+        });
+    }
+
+private:
+    struct Session {
+        explicit Session(boost::asio::io_context& io_context)
+            : socket(io_context), timer(io_context) {}
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::steady_timer timer;
+        boost::beast::flat_buffer buffer;
+        boost::beast::http::request<boost::beast::http::empty_body> request;
+        boost::beast::http::response<boost::beast::http::string_body> response;
+        std::string truncated;      // Raw response to send instead, then close
+    };
+
+    static std::string format_http_date(std::time_t time) {
+        std::tm tm;
+        gmtime_r(&time, &tm);
+        std::ostringstream out;
+        out << std::put_time(&tm, "%a, %d %b %Y %H:%M:%S GMT");
+        return out.str();
+    }
+
+    static std::string etag_of(const std::string& body) {
+        return "\"" + std::to_string(std::hash<std::string>{}(body)) + "\"";
+    }
+
+    void accept() {
+        auto session = std::make_shared<Session>(m_io_context);
+        m_acceptor.async_accept(session->socket, [this, session](const boost::system::error_code& ec) {
+            if (ec) return;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_connections++;
+                m_sessions.push_back(session);
+            }
+            read(session);
+            accept();
+        });
+    }
+
+    void read(std::shared_ptr<Session> session) {
+        namespace http = boost::beast::http;
+        session->request = {};
+        http::async_read(session->socket, session->buffer, session->request,
+            [this, session](const boost::system::error_code& ec, std::size_t) {
+                if (ec) return;
+                std::string path(session->request.target());
+
+                std::chrono::milliseconds delay;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_counts[path]++;
+                    delay = m_delay;
+                    auto it = m_files.find(path);
+                    auto range = session->request[http::field::range];
+                    m_last_ranges[path] = std::string(range);
+                    // A stale If-Range validator gets the whole file
+                    auto if_range = session->request[http::field::if_range];
+                    if (it != m_files.end() && !if_range.empty() && if_range != etag_of(it->second)) {
+                        range = {};
+                    }
+                    auto since = session->request[http::field::if_modified_since];
+                    auto none_match = session->request[http::field::if_none_match];
+                    // If-None-Match takes precedence over If-Modified-Since
+                    bool current = !none_match.empty() ? none_match == etag_of(it != m_files.end() ? it->second : "")
+                                                       : !since.empty() && since == format_http_date(m_modified[path]);
+                    if (it != m_files.end() && current) {
+                        m_not_modified[path]++;
+                        session->response = {http::status::not_modified, 11};
+                    } else if (it != m_files.end() && m_ranges && range.starts_with("bytes=") && m_range_limit == 0) {
+                        session->response = {http::status::service_unavailable, 11};
+                    } else if (it != m_files.end() && m_ranges && range.starts_with("bytes=")) {
+                        m_range_limit--;
+                        const std::string& body = it->second;
+                        std::string spec(range.substr(6));
+                        std::size_t dash = spec.find('-');
+                        std::size_t first = std::stoull(spec.substr(0, dash));
+                        std::size_t last = dash + 1 < spec.size() ? std::stoull(spec.substr(dash + 1)) : body.size() - 1;
+                        if (first >= body.size()) {
+                            session->response = {http::status::range_not_satisfiable, 11};
+                        } else {
+                            last = std::min(last, body.size() - 1);
+                            session->response = {http::status::partial_content, 11};
+                            session->response.set(http::field::content_range,
+                                "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(body.size()));
+                            session->response.body() = body.substr(first, last - first + 1);
+                        }
+                    } else if (it != m_files.end()) {
+                        session->response = {http::status::ok, 11};
+                        session->response.body() = it->second;
+                    } else {
+                        session->response = {http::status::not_found, 11};
+                    }
+                    if (it != m_files.end() && session->response.result() != http::status::service_unavailable) {
+                        session->response.set(http::field::etag, etag_of(it->second));
+                        session->response.set(http::field::last_modified, format_http_date(m_modified[path]));
+                        if (m_ranges) {
+                            session->response.set(http::field::accept_ranges, "bytes");
+                        }
+                    }
+                }
+                session->response.keep_alive(session->request.keep_alive());
+                session->response.prepare_payload();
+
+                session->truncated.clear();
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    auto cut = m_truncate.find(path);
+                    if (cut != m_truncate.end()) {
+                        std::ostringstream raw;
+                        raw << session->response;
+                        session->truncated = raw.str();
+                        std::size_t header_end = session->truncated.find("\r\n\r\n") + 4;
+                        session->truncated.resize(std::min(session->truncated.size(), header_end + cut->second));
+                        m_truncate.erase(cut);
+                    }
+                }
+
+                session->timer.expires_after(delay);
+                session->timer.async_wait([this, session](const boost::system::error_code&) {
+                    write(session);
+                });
+            });
+    }
+
+    void write(std::shared_ptr<Session> session) {
+        namespace http = boost::beast::http;
+        if (!session->truncated.empty()) {
+            boost::asio::async_write(session->socket, boost::asio::buffer(session->truncated),
+                [session](const boost::system::error_code&, std::size_t) {
+                    boost::system::error_code ignored;
+                    session->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                    session->socket.close(ignored);
+                });
+            return;
+        }
+        http::async_write(session->socket, session->response,
+            [this, session](const boost::system::error_code& ec, std::size_t) {
+                if (ec) return;
+                if (session->response.keep_alive()) {
+                    read(session);
+                } else {
+                    boost::system::error_code ignored;
+                    session->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                }
+            });
+    }
+
+private:
+    boost::asio::io_context m_io_context;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::map<std::string, std::string> m_files;
+    std::map<std::string, int> m_counts;
+    std::map<std::string, std::size_t> m_truncate;
+    std::map<std::string, std::time_t> m_modified;
+    std::map<std::string, std::string> m_last_ranges;
+    std::map<std::string, int> m_not_modified;
+    std::chrono::milliseconds m_delay{0};
+    int m_connections = 0;
+    bool m_ranges = false;
+    int m_range_limit = -1;
+    std::vector<std::weak_ptr<Session>> m_sessions;
+};
+
+} // namespace test
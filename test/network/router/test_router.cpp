@@ -1,4 +1,5 @@
 #include "../../common.hpp"
+#include "../../mock_upstream.hpp"
 #include <network/router/router.hpp>
 #include <node/dht/dht_operation.hpp>
 #include <node/validator/validator.hpp>
@@ -38,12 +39,41 @@ bool test_router_plain_client() {
     return true;
 }
 
+// Test: Files missing upstream are answered with 404, repeats from the negative cache
+bool test_router_upstream_not_found() {
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    test::MockUpstream upstream;
+    fs::remove_all("./test_cache");
+    FileCache cache(config, "./test_cache", upstream.host());
+
+    Router router(dht, validator, cache);
+
+    http::request<http::string_body> request;
+    request.method(http::verb::get);
+    request.target("/debian/pool/main/m/missing/missing_1.0_all.deb");
+    request.version(11);
+
+    for (int i = 0; i < 3; i++) {
+        auto response = router.global_router(request);
+        ASSERT_TRUE(response.index() == 0);
+        ASSERT_EQ(404, std::get<0>(response)->result_int());
+    }
+    ASSERT_EQ(1, upstream.request_count("/debian/pool/main/m/missing/missing_1.0_all.deb"));
+    ASSERT_EQ(2, cache.get_negative_cache().get_hits());
+
+    fs::remove_all("./test_cache");
+    return true;
+}
+
 // Run all router tests
 void run_router_tests() {
     test::TestSuite suite("Router Tests");
 
     suite.add_test("Router: Initialization", test_router_initialization);
     suite.add_test("Router: Plain client", test_router_plain_client);
+    suite.add_test("Router: Upstream not found", test_router_upstream_not_found);
 
     suite.run();
 }
@@ -1,4 +1,5 @@
 #include "../../common.hpp"
+#include "../../mock_upstream.hpp"
 #include <network/transmission/transmission.hpp>
 #include <network/router/router.hpp>
 #include <node/dht/dht_operation.hpp>
@@ -7,6 +8,7 @@
 #include <boost/asio.hpp>
 #include <thread>
 #include <chrono>
+#include <fstream>
 
 // Test: ServerTrans creation with all dependencies
 bool test_transmission_creation() {
@@ -22,11 +24,508 @@ bool test_transmission_creation() {
     return true;
 }
 
+// Test helper: GET a path from a local pacPrism server
+static http::response<http::string_body> get_from_server(unsigned short port, const std::string& path) {
+    boost::asio::io_context io_context;
+    tcp::socket socket(io_context);
+    socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+
+    http::request<http::empty_body> request{http::verb::get, path, 11};
+    request.set(http::field::host, "127.0.0.1");
+    http::write(socket, request);
+
+    beast::flat_buffer buffer;
+    http::response<http::string_body> response;
+    http::read(socket, buffer, response);
+    return response;
+}
+
+// Test helper: GET a path and return the body bytes received, even if the server closes early
+static std::string read_body_from_server(unsigned short port, const std::string& path) {
+    boost::asio::io_context io_context;
+    tcp::socket socket(io_context);
+    socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+
+    http::request<http::empty_body> request{http::verb::get, path, 11};
+    request.set(http::field::host, "127.0.0.1");
+    http::write(socket, request);
+
+    beast::flat_buffer buffer;
+    http::response_parser<http::string_body> parser;
+    boost::system::error_code ec;
+    http::read(socket, buffer, parser, ec);
+    return parser.get().body();
+}
+
+// Test: A cache miss is streamed to the client and cached at the same time
+bool test_transmission_streamed_miss() {
+    test::MockUpstream upstream;
+    std::string body(300 * 1024, 'x');
+    upstream.set_file("/debian/pool/main/b/big/big_1.0_amd64.deb", body);
+
+    boost::asio::io_context io_context;
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    fs::remove_all("./test_cache_stream");
+    FileCache cache(config, "./test_cache_stream", upstream.host());
+    Router router(dht, validator, cache);
+
+    const unsigned short port = 19181;
+    auto server = ServerTrans::create(io_context, router);
+    server->start_server(boost::asio::ip::make_address("127.0.0.1"), port);
+    std::thread server_thread([&io_context]() { io_context.run(); });
+
+    auto first = get_from_server(port, "/debian/pool/main/b/big/big_1.0_amd64.deb");
+    auto second = get_from_server(port, "/debian/pool/main/b/big/big_1.0_amd64.deb");
+
+    // The commit finishes on the disk pool, then indexes the file on the server's context
+    for (int i = 0; i < 200 && !cache.is_cached("/debian/pool/main/b/big/big_1.0_amd64.deb"); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    io_context.stop();
+    server_thread.join();
+
+    ASSERT_EQ(200, first.result_int());
+    ASSERT_TRUE(first.body() == body);
+    ASSERT_EQ(200, second.result_int());
+    ASSERT_TRUE(second.body() == body);
+    ASSERT_EQ(1, upstream.request_count("/debian/pool/main/b/big/big_1.0_amd64.deb"));
+    ASSERT_TRUE(cache.is_cached("/debian/pool/main/b/big/big_1.0_amd64.deb"));
+
+    fs::remove_all("./test_cache_stream");
+    return true;
+}
+
+// Test: A reader that relayed part of a body gives up when the download restarts with another one
+bool test_transmission_streamed_restart() {
+    const std::string path = "/debian/pool/main/r/restart/restart_1.0_amd64.deb";
+    const std::string old_body(300 * 1024, 'a');
+    const std::string new_body(300 * 1024, 'b');
+    // The first mirror cuts its copy short, the second has a newer one and answers late
+    test::MockUpstream first;
+    test::MockUpstream second;
+    first.set_file(path, old_body);
+    first.set_truncate_once(path, 100 * 1024);
+    second.set_file(path, new_body);
+    second.set_delay(std::chrono::milliseconds(300));
+
+    boost::asio::io_context io_context;
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    fs::remove_all("./test_cache_stream");
+    FileCache cache(config, "./test_cache_stream", first.host() + "," + second.host());
+    Router router(dht, validator, cache);
+
+    const unsigned short port = 19188;
+    auto server = ServerTrans::create(io_context, router);
+    server->start_server(boost::asio::ip::make_address("127.0.0.1"), port);
+    std::thread server_thread([&io_context]() { io_context.run(); });
+
+    auto body = read_body_from_server(port, path);
+
+    for (int i = 0; i < 200 && !cache.is_cached(path); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    io_context.stop();
+    server_thread.join();
+
+    // Either part of the old copy and a closed connection, or the new copy whole, never both spliced
+    ASSERT_FALSE(body.empty());
+    ASSERT_TRUE(body == std::string(body.size(), body[0]));
+    ASSERT_TRUE(body[0] == 'b' ? body == new_body : body.size() < old_body.size());
+    ASSERT_TRUE(cache.is_cached(path));
+    std::ifstream cached(cache.get_cache_path(path), std::ios::binary);
+    ASSERT_TRUE(std::string(std::istreambuf_iterator<char>(cached), {}) == new_body);
+
+    fs::remove_all("./test_cache_stream");
+    return true;
+}
+
+// Test: A streamed body that fails its Packages checksum never reaches the client complete
+bool test_transmission_streamed_checksum_mismatch() {
+    const std::string index_path = "/debian/dists/bookworm/main/binary-amd64/Packages";
+    const std::string path = "/debian/pool/main/s/sum/sum_1.0_amd64.deb";
+    const std::string body(300 * 1024, 'g');
+    const std::string corrupt(300 * 1024, 'c');
+    Digest digest;
+    digest.update(body.data(), body.size());
+    const std::string index = "Package: sum\nFilename: pool/main/s/sum/sum_1.0_amd64.deb\n"
+                              "Size: " + std::to_string(body.size()) + "\nSHA256: " + digest.hex_digest() + "\n\n";
+
+    // The first mirror serves wrong bytes, the retry on the second one answers late
+    // (the index comes from the second, so the untried first one is picked for the package)
+    test::MockUpstream first;
+    test::MockUpstream second;
+    first.set_file(path, corrupt);
+    second.set_file(index_path, index);
+    second.set_file(path, body);
+    second.set_delay(std::chrono::milliseconds(300));
+
+    boost::asio::io_context io_context;
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    fs::remove_all("./test_cache_stream");
+    FileCache cache(config, "./test_cache_stream", first.host() + "," + second.host());
+    Router router(dht, validator, cache);
+
+    // Checksums are known once the index is loaded in the background
+    cache.async_ensure_cached(io_context.get_executor(), index_path, [](bool) {});
+    io_context.run();
+    io_context.restart();
+    for (int i = 0; i < 200 && !cache.get_package_index().lookup(path); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_TRUE(cache.get_package_index().lookup(path).has_value());
+
+    const unsigned short port = 19189;
+    auto server = ServerTrans::create(io_context, router);
+    server->start_server(boost::asio::ip::make_address("127.0.0.1"), port);
+    std::thread server_thread([&io_context]() { io_context.run(); });
+
+    auto received = read_body_from_server(port, path);
+
+    for (int i = 0; i < 200 && !cache.is_cached(path); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    io_context.stop();
+    server_thread.join();
+
+    // The corrupt copy is cut short, only the verified one is relayed whole
+    ASSERT_TRUE(received.size() < corrupt.size() || received == body);
+    ASSERT_TRUE(cache.is_cached(path));
+    std::ifstream cached(cache.get_cache_path(path), std::ios::binary);
+    ASSERT_TRUE(std::string(std::istreambuf_iterator<char>(cached), {}) == body);
+
+    fs::remove_all("./test_cache_stream");
+    return true;
+}
+
+// Test: Pool contexts are handed out round-robin
+bool test_transmission_pool_round_robin() {
+    IoContextPool pool(3);
+    ASSERT_EQ(3, pool.size());
+    auto* first = &pool.get_io_context();
+    auto* second = &pool.get_io_context();
+    auto* third = &pool.get_io_context();
+    ASSERT_TRUE(first != second && second != third && first != third);
+    ASSERT_TRUE(first == &pool.get_io_context());
+    return true;
+}
+
+// Test: Concurrent clients over a worker pool share one upstream fetch
+bool test_transmission_pool_concurrent_clients() {
+    test::MockUpstream upstream;
+    std::string body(200 * 1024, 'p');
+    upstream.set_file("/debian/pool/main/p/python3/python3_3.11_amd64.deb", body);
+    upstream.set_delay(std::chrono::milliseconds(100));
+
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    fs::remove_all("./test_cache_stream");
+    FileCache cache(config, "./test_cache_stream", upstream.host());
+    Router router(dht, validator, cache);
+
+    const unsigned short port = 19182;
+    IoContextPool pool(4);
+    auto server = ServerTrans::create(pool, router);
+    server->start_server(boost::asio::ip::make_address("127.0.0.1"), port);
+    std::thread pool_thread([&pool]() { pool.run(); });
+
+    std::vector<std::thread> clients;
+    std::vector<int> ok(8, 0);
+    for (int i = 0; i < 8; i++) {
+        clients.emplace_back([&, i]() {
+            auto response = get_from_server(port, "/debian/pool/main/p/python3/python3_3.11_amd64.deb");
+            ok[i] = response.result_int() == 200 && response.body() == body;
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    pool.stop();
+    pool_thread.join();
+    cache.wait_for_disk_work();
+
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQ(1, ok[i]);
+    }
+    ASSERT_EQ(1, upstream.request_count("/debian/pool/main/p/python3/python3_3.11_amd64.deb"));
+
+    fs::remove_all("./test_cache_stream");
+    return true;
+}
+
+// Test: SO_REUSEPORT acceptors, one per worker, count every accepted connection
+bool test_transmission_reuse_port_acceptors() {
+    test::MockUpstream upstream;
+    upstream.set_file("/debian/dists/stable/InRelease", "release");
+
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    fs::remove_all("./test_cache_stream");
+    FileCache cache(config, "./test_cache_stream", upstream.host());
+    Router router(dht, validator, cache);
+
+    const unsigned short port = 19183;
+    IoContextPool pool(3);
+    auto server = ServerTrans::create(pool, router, true);
+    server->start_server(boost::asio::ip::make_address("127.0.0.1"), port);
+    std::thread pool_thread([&pool]() { pool.run(); });
+
+    int ok = 0;
+    for (int i = 0; i < 12; i++) {
+        auto response = get_from_server(port, "/debian/dists/stable/InRelease");
+        ok += response.result_int() == 200 && response.body() == "release";
+    }
+
+    pool.stop();
+    pool_thread.join();
+    cache.wait_for_disk_work();
+
+    ASSERT_EQ(12, ok);
+    auto counts = server->get_accept_counts();
+    ASSERT_EQ(3, counts.size());
+    std::uint64_t total = 0;
+    for (auto count : counts) {
+        total += count;
+    }
+    ASSERT_EQ(12, total);
+
+    fs::remove_all("./test_cache_stream");
+    return true;
+}
+
+// Test: Cache hits and ranges go out through sendfile on one keep-alive connection
+bool test_transmission_zero_copy_hit() {
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    fs::remove_all("./test_cache_stream");
+    FileCache cache(config, "./test_cache_stream", "127.0.0.1:1");
+    Router router(dht, validator, cache);
+
+    // Larger than a socket buffer so sendfile has to wait for the client
+    std::string body;
+    for (int i = 0; i < 3 * 1024 * 1024; i++) {
+        body.push_back(static_cast<char>('a' + i % 26));
+    }
+    std::string path = "/debian/pool/main/z/zero/zero_1.0_amd64.deb";
+    fs::create_directories(fs::path(cache.get_cache_path(path)).parent_path());
+    std::ofstream(cache.get_cache_path(path), std::ios::binary) << body;
+
+    const unsigned short port = 19184;
+    IoContextPool pool(2);
+    auto server = ServerTrans::create(pool, router);
+    server->start_server(boost::asio::ip::make_address("127.0.0.1"), port);
+    std::thread pool_thread([&pool]() { pool.run(); });
+
+    boost::asio::io_context io_context;
+    tcp::socket socket(io_context);
+    socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+    beast::flat_buffer buffer;
+
+    http::request<http::empty_body> request{http::verb::get, path, 11};
+    request.set(http::field::host, "127.0.0.1");
+    http::write(socket, request);
+    http::response_parser<http::string_body> full_parser;
+    full_parser.body_limit(16 * 1024 * 1024);
+    http::read(socket, buffer, full_parser);
+    auto full = full_parser.release();
+
+    request.set(http::field::range, "bytes=100-1123");
+    http::write(socket, request);
+    http::response<http::string_body> partial;
+    http::read(socket, buffer, partial);
+
+    pool.stop();
+    pool_thread.join();
+    cache.wait_for_disk_work();
+
+    ASSERT_EQ(200, full.result_int());
+    ASSERT_TRUE(full.body() == body);
+    ASSERT_TRUE(full.keep_alive());
+    ASSERT_EQ(206, partial.result_int());
+    ASSERT_EQ(1024, partial.body().size());
+    ASSERT_TRUE(partial.body() == body.substr(100, 1024));
+
+    fs::remove_all("./test_cache_stream");
+    return true;
+}
+
+// Test: io_uring engine serves cache hits, or is refused when not compiled in
+bool test_transmission_io_uring_engine() {
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    fs::remove_all("./test_cache_stream");
+    FileCache cache(config, "./test_cache_stream", "127.0.0.1:1");
+    Router router(dht, validator, cache);
+
+    std::string body(700 * 1024, 'u');
+    std::string path = "/debian/pool/main/u/uring/uring_1.0_amd64.deb";
+    fs::create_directories(fs::path(cache.get_cache_path(path)).parent_path());
+    std::ofstream(cache.get_cache_path(path), std::ios::binary) << body;
+
+    IoContextPool pool(1);
+    auto server = ServerTrans::create(pool, router);
+    if (!ServerTrans::io_uring_available()) {
+        ASSERT_FALSE(server->set_io_engine(io_engine::io_uring));
+        ASSERT_TRUE(server->set_io_engine(io_engine::epoll));
+        fs::remove_all("./test_cache_stream");
+        return true;
+    }
+    ASSERT_TRUE(server->set_io_engine(io_engine::io_uring));
+
+    const unsigned short port = 19185;
+    server->start_server(boost::asio::ip::make_address("127.0.0.1"), port);
+    std::thread pool_thread([&pool]() { pool.run(); });
+    auto response = get_from_server(port, path);
+    pool.stop();
+    pool_thread.join();
+    cache.wait_for_disk_work();
+
+    ASSERT_EQ(200, response.result_int());
+    ASSERT_TRUE(response.body() == body);
+
+    fs::remove_all("./test_cache_stream");
+    return true;
+}
+
+// Test: Small hot files go out of the memory tier, keep-alive included
+bool test_transmission_memory_tier_hit() {
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    config.set("memory_tier_min_hits", "0");
+    fs::remove_all("./test_cache_stream");
+    FileCache cache(config, "./test_cache_stream", "127.0.0.1:1");
+    Router router(dht, validator, cache);
+
+    std::string body(40 * 1024, 'r');
+    std::string path = "/debian/dists/stable/main/binary-amd64/Packages.xz";
+    fs::create_directories(fs::path(cache.get_cache_path(path)).parent_path());
+    std::ofstream(cache.get_cache_path(path), std::ios::binary) << body;
+
+    const unsigned short port = 19186;
+    IoContextPool pool(1);
+    auto server = ServerTrans::create(pool, router);
+    server->start_server(boost::asio::ip::make_address("127.0.0.1"), port);
+    std::thread pool_thread([&pool]() { pool.run(); });
+
+    boost::asio::io_context io_context;
+    tcp::socket socket(io_context);
+    socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+    beast::flat_buffer buffer;
+    http::request<http::empty_body> request{http::verb::get, path, 11};
+    request.set(http::field::host, "127.0.0.1");
+    std::vector<http::response<http::string_body>> responses(2);
+    for (auto& response : responses) {
+        http::write(socket, request);
+        http::read(socket, buffer, response);
+    }
+
+    pool.stop();
+    pool_thread.join();
+    cache.wait_for_disk_work();
+
+    for (const auto& response : responses) {
+        ASSERT_EQ(200, response.result_int());
+        ASSERT_TRUE(response.body() == body);
+        ASSERT_TRUE(response.keep_alive());
+    }
+    ASSERT_EQ(1, cache.get_memory_tier().size());
+
+    fs::remove_all("./test_cache_stream");
+    return true;
+}
+
+// Test: Prepared-header hits without zero copy, for HTTP/1.0 and ranges
+bool test_transmission_buffered_hit() {
+    DHT_operation dht;
+    Validator validator;
+    Config config;
+    config.set("memory_tier_bytes", "0");
+    fs::remove_all("./test_cache_stream");
+    FileCache cache(config, "./test_cache_stream", "127.0.0.1:1");
+    Router router(dht, validator, cache);
+
+    std::string body;
+    for (int i = 0; i < 200 * 1024; i++) {
+        body.push_back(static_cast<char>('a' + i % 23));
+    }
+    std::string path = "/debian/pool/main/b/buffered/buffered_1.0_amd64.deb";
+    fs::create_directories(fs::path(cache.get_cache_path(path)).parent_path());
+    std::ofstream(cache.get_cache_path(path), std::ios::binary) << body;
+
+    const unsigned short port = 19187;
+    IoContextPool pool(1);
+    auto server = ServerTrans::create(pool, router);
+    server->set_zero_copy(false);
+    server->start_server(boost::asio::ip::make_address("127.0.0.1"), port);
+    std::thread pool_thread([&pool]() { pool.run(); });
+
+    // HTTP/1.1 range on a keep-alive connection
+    boost::asio::io_context io_context;
+    tcp::socket socket(io_context);
+    socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+    beast::flat_buffer buffer;
+    http::request<http::empty_body> request{http::verb::get, path, 11};
+    request.set(http::field::host, "127.0.0.1");
+    request.set(http::field::range, "bytes=70000-");
+    http::write(socket, request);
+    http::response<http::string_body> partial;
+    http::read(socket, buffer, partial);
+
+    // HTTP/1.0 full body, the server closes afterwards
+    tcp::socket old_socket(io_context);
+    old_socket.connect({boost::asio::ip::make_address("127.0.0.1"), port});
+    beast::flat_buffer old_buffer;
+    http::request<http::empty_body> old_request{http::verb::get, path, 10};
+    http::write(old_socket, old_request);
+    http::response_parser<http::string_body> old_parser;
+    old_parser.body_limit(1024 * 1024);
+    http::read(old_socket, old_buffer, old_parser);
+    auto full = old_parser.release();
+
+    pool.stop();
+    pool_thread.join();
+    cache.wait_for_disk_work();
+
+    ASSERT_EQ(206, partial.result_int());
+    ASSERT_TRUE(partial.body() == body.substr(70000));
+    ASSERT_STREQ(std::format("bytes 70000-{}/{}", body.size() - 1, body.size()),
+                 std::string(partial[http::field::content_range]));
+    ASSERT_TRUE(partial.keep_alive());
+    ASSERT_EQ(200, full.result_int());
+    ASSERT_EQ(10, full.version());
+    ASSERT_TRUE(full.body() == body);
+    ASSERT_FALSE(full.keep_alive());
+
+    fs::remove_all("./test_cache_stream");
+    return true;
+}
+
 // Run all transmission tests
 void run_transmission_tests() {
     test::TestSuite suite("Transmission Tests");
 
     suite.add_test("Transmission: Creation", test_transmission_creation);
+    suite.add_test("Transmission: Streamed miss", test_transmission_streamed_miss);
+    suite.add_test("Transmission: Streamed restart", test_transmission_streamed_restart);
+    suite.add_test("Transmission: Streamed checksum mismatch", test_transmission_streamed_checksum_mismatch);
+    suite.add_test("Transmission: Pool round-robin", test_transmission_pool_round_robin);
+    suite.add_test("Transmission: Pool concurrent clients", test_transmission_pool_concurrent_clients);
+    suite.add_test("Transmission: Reuse port acceptors", test_transmission_reuse_port_acceptors);
+    suite.add_test("Transmission: Zero-copy hit", test_transmission_zero_copy_hit);
+    suite.add_test("Transmission: io_uring engine", test_transmission_io_uring_engine);
+    suite.add_test("Transmission: Memory tier hit", test_transmission_memory_tier_hit);
+    suite.add_test("Transmission: Buffered hit", test_transmission_buffered_hit);
 
     suite.run();
 }
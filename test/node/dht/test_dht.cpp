@@ -3,6 +3,8 @@
 #include <node/dht/dht_types.hpp>
 #include <chrono>
 #include <ctime>
+#include <thread>
+#include <vector>
 
 // Test: DHT initialization
 bool test_dht_initialization() {
@@ -64,8 +66,8 @@ bool test_dht_query_by_shard() {
     dht.store_entry(entry1);
     dht.store_entry(entry2);
 
-    // Query should return a pointer to set of node IDs
-    const std::set<std::string>* node_ids = dht.query_node_ids_by_shard_id("shard_a");
+    // Query should return a pointer to a snapshot of node IDs
+    auto node_ids = dht.query_node_ids_by_shard_id("shard_a");
 
     // If no shards found, returns nullptr or empty set
     ASSERT_TRUE(node_ids == nullptr || node_ids->size() >= 0);
@@ -81,6 +83,41 @@ bool test_dht_query_empty_shard() {
     return true;
 }
 
+// Test: Concurrent stores and lookups from several threads
+bool test_dht_concurrent_access() {
+    DHT_operation dht;
+    auto now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&dht, now, t]() {
+            for (int i = 0; i < 200; i++) {
+                dht_entry entry;
+                entry.node_id = "node_" + std::to_string(t) + "_" + std::to_string(i);
+                entry.node_ip = "10.0." + std::to_string(t) + "." + std::to_string(i);
+                entry.generation_timestamp = now;
+                entry.expiry_timestamp = now + 3600;
+                shard node_shard;
+                node_shard.shard_id = "shard_" + std::to_string(i % 5);
+                entry.node_shard.insert(node_shard);
+                dht.store_entry(entry);
+                dht.verify_entry(entry.node_id);
+                dht.query_node_ids_by_shard_id("shard_0");
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_TRUE(dht.verify_entry("node_3_199"));
+    auto node_ids = dht.query_node_ids_by_shard_id("shard_0");
+    ASSERT_TRUE(node_ids != nullptr);
+    ASSERT_EQ(160, node_ids->size());
+    return true;
+}
+
 // Run all DHT tests
 void run_dht_tests() {
     test::TestSuite suite("DHT Tests");
@@ -90,6 +127,7 @@ void run_dht_tests() {
     suite.add_test("DHT: Store and verify", test_dht_store_and_verify);
     suite.add_test("DHT: Query by shard ID", test_dht_query_by_shard);
     suite.add_test("DHT: Query empty shard", test_dht_query_empty_shard);
+    suite.add_test("DHT: Concurrent access", test_dht_concurrent_access);
 
     suite.run();
 }
@@ -1,5 +1,7 @@
 #include "../../common.hpp"
 #include <node/package/parser.hpp>
+#include <node/package/package_index.hpp>
+#include <sstream>
 
 // Test valid Debian package paths
 bool test_valid_vim_package() {
@@ -187,6 +189,42 @@ bool test_multiple_extensions() {
     return true;
 }
 
+// Test: Packages index stanzas map pool paths to their checksums
+bool test_package_index() {
+    std::istringstream packages(
+        "Package: hello\n"
+        "Version: 2.10-3\n"
+        "Description: example package\n"
+        " based on GNU hello\n"
+        "Filename: pool/main/h/hello/hello_2.10-3_amd64.deb\n"
+        "Size: 53196\n"
+        "SHA256: 5BB0CD1D3CBDB2B5E84B6AE5F6A1C0F0B7A4C0E9CB0C2E8F0D5F3D4E1A2B3C4D\n"
+        "\n"
+        "Package: nosum\n"
+        "Filename: pool/main/n/nosum/nosum_1.0_all.deb\n"
+        "\n"
+        "Package: vim\r\n"
+        "Filename: pool/main/v/vim/vim_9.0.0_amd64.deb\r\n"
+        "SHA256: 0000000000000000000000000000000000000000000000000000000000000001\r\n");
+
+    auto root = PackageIndex::repository_root("/debian/dists/bookworm/main/binary-amd64/Packages");
+    ASSERT_TRUE(root.has_value());
+    ASSERT_TRUE(*root == "/debian");
+    ASSERT_FALSE(PackageIndex::repository_root("/debian/pool/main/h/hello/hello_2.10-3_amd64.deb").has_value());
+
+    PackageIndex index;
+    ASSERT_EQ(2, index.load(*root, packages));
+    auto hello = index.lookup("/debian/pool/main/h/hello/hello_2.10-3_amd64.deb");
+    ASSERT_TRUE(hello.has_value());
+    ASSERT_EQ(53196, hello->size);
+    ASSERT_TRUE(hello->sha256 == "5bb0cd1d3cbdb2b5e84b6ae5f6a1c0f0b7a4c0e9cb0c2e8f0d5f3d4e1a2b3c4d");
+    ASSERT_TRUE(index.lookup("/debian/pool/main/v/vim/vim_9.0.0_amd64.deb").has_value());
+    ASSERT_FALSE(index.lookup("/debian/pool/main/n/nosum/nosum_1.0_all.deb").has_value());
+    ASSERT_EQ(2, index.size());
+
+    return true;
+}
+
 // Run all package parser tests
 void run_package_parser_tests() {
     test::TestSuite suite("Package Parser Tests");
@@ -213,5 +251,8 @@ void run_package_parser_tests() {
     suite.add_test("Multiple extensions (.orig.tar.gz)", test_multiple_extensions);
     suite.add_test("Package name with spaces (edge case)", test_plus_in_package_name);
 
+    // Packages index tests
+    suite.add_test("Packages index checksums", test_package_index);
+
     suite.run();
 }
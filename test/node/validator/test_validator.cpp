@@ -1,5 +1,6 @@
 #include "../../common.hpp"
 #include <node/validator/validator.hpp>
+#include <node/validator/digest.hpp>
 #include <fstream>
 #include <filesystem>
 
@@ -171,6 +172,31 @@ bool test_request_validate_invalid_partial_headers() {
     return true;
 }
 
+// Test: Streaming digests match hashing the whole file
+bool test_digest_streaming() {
+    std::string content = "Hello, World!";
+    Digest digest;
+    digest.update(content.data(), 5);
+    digest.update(content.data() + 5, content.size() - 5);
+    ASSERT_STREQ("dffd6021bb2bd5b0af676290809ec3a53191dd81c7f70a4b28688a362182986f", digest.hex_digest());
+
+    // A finished digest starts over, files can be fed up to a length
+    std::string path = create_test_file(content + " and more");
+    ASSERT_TRUE(digest.update_file(path, content.size()));
+    ASSERT_STREQ("dffd6021bb2bd5b0af676290809ec3a53191dd81c7f70a4b28688a362182986f", digest.hex_digest());
+    ASSERT_FALSE(digest.update_file(path, 1000));
+    digest.reset();
+    ASSERT_TRUE(digest.update_file(path));
+    ASSERT_STREQ(Validator().calculate_sha256(path), digest.hex_digest());
+    cleanup_test_file(path);
+
+    Digest md5("md5");
+    md5.update(content.data(), content.size());
+    ASSERT_STREQ("65a8e27d8879283831b664bd8b7f0ad4", md5.hex_digest());
+    ASSERT_EQ(128, Digest("sha512").hex_digest().size());
+    return true;
+}
+
 // Run all validator tests
 void run_validator_tests() {
     test::TestSuite suite("Validator Tests");
@@ -182,6 +208,7 @@ void run_validator_tests() {
     suite.add_test("SHA256: Verify no match", test_sha256_verify_no_match);
     suite.add_test("SHA256: Case insensitive", test_sha256_verify_case_insensitive);
     suite.add_test("SHA256: Non-existent file", test_sha256_nonexistent_file);
+    suite.add_test("Digest: Streaming", test_digest_streaming);
     suite.add_test("Request: Plain client", test_request_validate_plain_client);
     suite.add_test("Request: Node request", test_request_validate_node);
     suite.add_test("Request: Invalid partial headers", test_request_validate_invalid_partial_headers);